@@ -5,10 +5,28 @@ include $(CLEAR_VARS)
 LOCAL_CFLAGS += -DANDROID_BUILD
 LOCAL_CFLAGS += -Wall
 
-LOCAL_SRC_FILES += host/main.c
+LOCAL_SRC_FILES += host/opteellm.c
+LOCAL_SRC_FILES += host/lora_async.c
+LOCAL_SRC_FILES += host/lora_shard.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include \
+		    $(LOCAL_PATH)/host/include
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_C_INCLUDES)
+
+LOCAL_SHARED_LIBRARIES := libteec
+LOCAL_MODULE := libopteellm
+LOCAL_VENDOR_MODULE := true
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_STATIC_LIBRARY)
 
-LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include
+include $(CLEAR_VARS)
+LOCAL_CFLAGS += -DANDROID_BUILD
+LOCAL_CFLAGS += -Wall
+
+LOCAL_SRC_FILES += host/main.c
+LOCAL_SRC_FILES += host/bench.c
 
+LOCAL_STATIC_LIBRARIES := libopteellm
 LOCAL_SHARED_LIBRARIES := libteec
 LOCAL_MODULE := optee_llm # CHANGED NAME HERE
 LOCAL_VENDOR_MODULE := true
@@ -0,0 +1,846 @@
+/*
+ * lora_bench: microbenchmark and accuracy check of the TA's compute kernels
+ * (ta/lora_kernels.c), built as a plain C library on the host with no
+ * OP-TEE or emulator in the way.
+ *
+ * Every kernel variant the CPU supports is run over a grid of kernels,
+ * input dtypes, ranks, channel counts, batch sizes and sequence lengths.
+ * A point's iteration feeds all batch x sequence tokens through the kernel
+ * the way the TA does (one call per token, or per LORA_TILE_TOKENS tokens
+ * for the tile kernels); its median time is reported as GFLOP/s and as
+ * GB/s of nominal traffic, counting the weights once per call. The outputs
+ * are checked against a double precision reference in ULPs and as error
+ * relative to the summed magnitude of each dot product's terms, which a
+ * float dot product of length n keeps below n * FLT_EPSILON. The exit
+ * status is nonzero if any point exceeds that bound.
+ */
+
+#include <err.h>
+#include <float.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lora_kernels.h"
+
+#define BENCH_MAX_LIST 16
+
+struct bench_list {
+    uint32_t v[BENCH_MAX_LIST];
+    uint32_t n;
+};
+
+// Kernels of struct lora_kernels that are measured. The dtype list applies
+// to the ones that take activations; the others run on f32 only.
+#define K_B         0   // matmul_B, or matmul_B_half for f16/bf16
+#define K_B_TILE    1   // matmul_B_tile
+#define K_A         2   // matmul_A
+#define K_A_TILE    3   // matmul_A_tile
+#define K_B_Q8      4   // matmul_B_q8
+#define K_B_Q4      5   // matmul_B_q4
+#define K_A_Q8      6   // matmul_A_q8
+#define K_ACC       7   // accumulate, or accumulate_half
+#define K_COUNT     8
+
+static const char *const kernel_names[K_COUNT] = {
+    "b", "b_tile", "a", "a_tile", "b_q8", "b_q4", "a_q8", "accumulate",
+};
+static const char *const dtype_names[] = { "f32", "f16", "bf16" };
+
+struct bench_opts {
+    struct bench_list variant;
+    struct bench_list kernel;
+    struct bench_list dtype;
+    struct bench_list rank;
+    struct bench_list in;
+    struct bench_list out;
+    struct bench_list batch;
+    struct bench_list seq;
+    uint32_t warmup;
+    uint32_t iters;
+    const char *csv;
+    const char *json;
+};
+
+struct bench_result {
+    uint32_t variant;
+    uint32_t kernel;
+    uint32_t dtype;
+    uint32_t rank;
+    uint32_t in;
+    uint32_t out;
+    uint32_t batch;
+    uint32_t seq;
+    double us;              // median time of one iteration
+    double gflops;
+    double gbytes;
+    double max_ulp;
+    double max_rel;
+    double bound;           // largest max_rel that passes
+    bool ok;
+};
+
+// Inputs of one shape, shared by every variant and kernel.
+struct bench_data {
+    uint32_t tokens, in, out, rank;
+    float *x;               // [tokens][in]
+    uint16_t *xh[3];        // [tokens][in] per half dtype (index 1, 2)
+    float *h;               // [tokens][rank] lora_A inputs
+    float *B, *A;           // [rank][in], [out][rank]
+    int8_t *B8, *A8;        // [rank][in], [out][rank]
+    float *B8_scale;        // [rank]
+    float *A8_scale;        // [out]
+    uint8_t *B4;            // [rank][in / 2]
+    float *B4_scale;        // [rank][in / LORA_Q4_GROUP]
+    float *y;               // kernel output
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const char *variant_names[8];
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: lora_bench [options]\n"
+            "  -v, --variant LIST   kernel variants (all the CPU supports)\n"
+            "  -k, --kernel LIST    b,b_tile,a,a_tile,b_q8,b_q4,a_q8,"
+            "accumulate (all)\n"
+            "  -t, --dtype LIST     input dtypes: f32,f16,bf16 (f32)\n"
+            "  -r, --rank LIST      adapter ranks (4,16)\n"
+            "  -i, --in LIST        input channels (%u)\n"
+            "  -o, --out LIST       output channels (%u)\n"
+            "  -b, --batch LIST     batch sizes (1,%u)\n"
+            "  -s, --seq LIST       sequence lengths (1,%u)\n"
+            "  -w, --warmup N       untimed iterations per point (3)\n"
+            "  -n, --iters N        timed iterations per point (20)\n"
+            "      --csv FILE       write CSV results (- for stdout)\n"
+            "      --json FILE      write JSON results (- for stdout)\n",
+            IN_CHANNELS, OUT_CHANNELS, MAX_BATCH_SIZE, MAX_SEQ_LENGTH);
+}
+
+static uint32_t parse_uint(const char *s, uint32_t min)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+
+    if (*s == '\0' || *end != '\0' || v < min || v > UINT32_MAX)
+        errx(1, "bad number '%s'", s);
+    return v;
+}
+
+static uint32_t parse_name(const char *s, const char *const *names,
+                           uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!strcmp(s, names[i]))
+            return i;
+    }
+    errx(1, "unknown value '%s'", s);
+}
+
+// Parse a comma separated list of numbers, or of names if names is set.
+static void parse_list(const char *arg, struct bench_list *list,
+                       const char *const *names, uint32_t count)
+{
+    char *copy = strdup(arg);
+    char *save = NULL;
+
+    if (!copy)
+        err(1, "strdup");
+    list->n = 0;
+    for (char *tok = strtok_r(copy, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        if (list->n == BENCH_MAX_LIST)
+            errx(1, "more than %d values in '%s'", BENCH_MAX_LIST, arg);
+        list->v[list->n++] = names ? parse_name(tok, names, count) :
+                                     parse_uint(tok, 1);
+    }
+    free(copy);
+    if (!list->n)
+        errx(1, "empty list");
+}
+
+static uint32_t list_max(const struct bench_list *list)
+{
+    uint32_t max = 0;
+
+    for (uint32_t i = 0; i < list->n; i++)
+    {
+        if (list->v[i] > max)
+            max = list->v[i];
+    }
+    return max;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t seed = 12345;
+
+static uint32_t next_rand(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Uniform in [-1, 1).
+static float rand_unit(void)
+{
+    return (float)(next_rand() & 0xffff) / 32768.0f - 1.0f;
+}
+
+// A random half value of the given dtype with magnitude in [2^-5, 2^2),
+// away from subnormals and infinities.
+static uint16_t rand_half(uint32_t dtype)
+{
+    const uint32_t r = next_rand();
+    const uint16_t sign = r & 0x8000;
+
+    if (dtype == LORA_DTYPE_F16)
+        return sign | (10 + r % 7) << 10 | (r >> 3 & 0x3ff);
+    return sign | (122 + r % 7) << 7 | (r >> 3 & 0x7f);
+}
+
+// Exact value of a half element.
+static double half_value(uint16_t v, uint32_t dtype)
+{
+    const double sign = v & 0x8000 ? -1.0 : 1.0;
+
+    if (dtype == LORA_DTYPE_F16)
+        return sign * ldexp(1.0 + (v & 0x3ff) / 1024.0,
+                            (int)(v >> 10 & 0x1f) - 15);
+    return sign * ldexp(1.0 + (v & 0x7f) / 128.0, (int)(v >> 7 & 0xff) - 127);
+}
+
+static void *xmalloc(size_t size)
+{
+    void *p = aligned_alloc(LORA_WEIGHT_ALIGN,
+                            (size + LORA_WEIGHT_ALIGN - 1) &
+                            ~(size_t)(LORA_WEIGHT_ALIGN - 1));
+
+    if (!p)
+        err(1, "malloc");
+    return p;
+}
+
+static void make_data(struct bench_data *d, uint32_t tokens, uint32_t in,
+                      uint32_t out, uint32_t rank)
+{
+    const size_t tin = (size_t)tokens * in;
+    const uint32_t groups = in / LORA_Q4_GROUP;
+    const uint32_t width = rank > out ? rank : out;
+
+    d->tokens = tokens;
+    d->in = in;
+    d->out = out;
+    d->rank = rank;
+    d->x = xmalloc(tin * sizeof(float));
+    for (uint32_t t = LORA_DTYPE_F16; t <= LORA_DTYPE_BF16; t++)
+        d->xh[t] = xmalloc(tin * sizeof(uint16_t));
+    d->h = xmalloc((size_t)tokens * rank * sizeof(float));
+    d->B = xmalloc((size_t)rank * in * sizeof(float));
+    d->A = xmalloc((size_t)out * rank * sizeof(float));
+    d->B8 = xmalloc((size_t)rank * in);
+    d->A8 = xmalloc((size_t)out * rank);
+    d->B8_scale = xmalloc(rank * sizeof(float));
+    d->A8_scale = xmalloc(out * sizeof(float));
+    d->B4 = xmalloc((size_t)rank * in / 2);
+    d->B4_scale = xmalloc(((size_t)rank * groups + 1) * sizeof(float));
+    d->y = xmalloc((size_t)tokens * (width > in ? width : in) *
+                   sizeof(float));
+
+    for (size_t i = 0; i < tin; i++)
+    {
+        d->x[i] = rand_unit();
+        d->xh[LORA_DTYPE_F16][i] = rand_half(LORA_DTYPE_F16);
+        d->xh[LORA_DTYPE_BF16][i] = rand_half(LORA_DTYPE_BF16);
+    }
+    for (size_t i = 0; i < (size_t)tokens * rank; i++)
+        d->h[i] = rand_unit();
+    for (size_t i = 0; i < (size_t)rank * in; i++)
+    {
+        d->B[i] = rand_unit();
+        d->B8[i] = (int8_t)(next_rand() % 255 - 127);
+    }
+    for (size_t i = 0; i < (size_t)out * rank; i++)
+    {
+        d->A[i] = rand_unit();
+        d->A8[i] = (int8_t)(next_rand() % 255 - 127);
+    }
+    for (size_t i = 0; i < (size_t)rank * in / 2; i++)
+        d->B4[i] = (uint8_t)next_rand();
+    for (uint32_t r = 0; r < rank; r++)
+        d->B8_scale[r] = (1.0f + rand_unit()) / 127.0f;
+    for (size_t i = 0; i < (size_t)rank * groups; i++)
+        d->B4_scale[i] = (1.0f + rand_unit()) / 8.0f;
+    for (uint32_t o = 0; o < out; o++)
+        d->A8_scale[o] = (1.0f + rand_unit()) / 127.0f;
+}
+
+static void free_data(struct bench_data *d)
+{
+    free(d->x);
+    free(d->xh[LORA_DTYPE_F16]);
+    free(d->xh[LORA_DTYPE_BF16]);
+    free(d->h);
+    free(d->B);
+    free(d->A);
+    free(d->B8);
+    free(d->A8);
+    free(d->B8_scale);
+    free(d->A8_scale);
+    free(d->B4);
+    free(d->B4_scale);
+    free(d->y);
+}
+
+// Input element c of token t, exactly as the kernels see it.
+static double x_value(const struct bench_data *d, uint32_t dtype, uint32_t t,
+                      uint32_t c)
+{
+    const size_t i = (size_t)t * d->in + c;
+
+    return dtype == LORA_DTYPE_F32 ? d->x[i] : half_value(d->xh[dtype][i],
+                                                          dtype);
+}
+
+// Dequantized lora_B[r][c] of the kernel's weight format.
+static double b_value(const struct bench_data *d, uint32_t kernel,
+                      uint32_t r, uint32_t c)
+{
+    const uint32_t groups = d->in / LORA_Q4_GROUP;
+    const uint32_t j = c % LORA_Q4_GROUP;
+    uint8_t q;
+
+    switch (kernel)
+    {
+    case K_B_Q8:
+        return d->B8[(size_t)r * d->in + c] * (double)d->B8_scale[r];
+    case K_B_Q4:
+        q = d->B4[(size_t)r * d->in / 2 + c / LORA_Q4_GROUP *
+                  (LORA_Q4_GROUP / 2) + j % (LORA_Q4_GROUP / 2)];
+        q = j < LORA_Q4_GROUP / 2 ? q & 0x0f : q >> 4;
+        return ((int)q - 8) *
+               (double)d->B4_scale[(size_t)r * groups + c / LORA_Q4_GROUP];
+    default:
+        return d->B[(size_t)r * d->in + c];
+    }
+}
+
+static double a_value(const struct bench_data *d, uint32_t kernel,
+                      uint32_t o, uint32_t r)
+{
+    const size_t i = (size_t)o * d->rank + r;
+
+    return kernel == K_A_Q8 ? d->A8[i] * (double)d->A8_scale[o] : d->A[i];
+}
+
+// One iteration: every token through the kernel, as the TA calls it.
+static void run_kernel(const struct lora_kernels *k, uint32_t kernel,
+                       uint32_t dtype, struct bench_data *d)
+{
+    const uint32_t in = d->in, out = d->out, rank = d->rank;
+    const size_t stride = (size_t)in * lora_dtype_size(dtype);
+    const void *X = dtype == LORA_DTYPE_F32 ? (const void *)d->x :
+                                              (const void *)d->xh[dtype];
+
+    if (kernel == K_ACC)
+        memset(d->y, 0, in * sizeof(float));
+    for (uint32_t t = 0; t < d->tokens; t++)
+    {
+        const float *x = d->x + (size_t)t * in;
+        const uint16_t *xh = (const uint16_t *)((const uint8_t *)X +
+                                                t * stride);
+        const uint32_t n = d->tokens - t < LORA_TILE_TOKENS ?
+                           d->tokens - t : LORA_TILE_TOKENS;
+
+        switch (kernel)
+        {
+        case K_B:
+            if (dtype == LORA_DTYPE_F32)
+                k->matmul_B(x, d->B, rank, in, d->y + t * rank);
+            else
+                k->matmul_B_half(xh, dtype, d->B, rank, in,
+                                 d->y + t * rank);
+            break;
+        case K_B_TILE:
+            k->matmul_B_tile(xh, dtype, n, d->B, rank, in, d->y + t * rank);
+            t += n - 1;
+            break;
+        case K_A:
+            k->matmul_A(d->h + t * rank, d->A, out, rank, d->y + t * out);
+            break;
+        case K_A_TILE:
+            k->matmul_A_tile(d->h + t * rank, n, d->A, out, rank,
+                             d->y + t * out);
+            t += n - 1;
+            break;
+        case K_B_Q8:
+            k->matmul_B_q8(x, d->B8, d->B8_scale, rank, in, d->y + t * rank);
+            break;
+        case K_B_Q4:
+            k->matmul_B_q4(x, d->B4, d->B4_scale, rank, in, d->y + t * rank);
+            break;
+        case K_A_Q8:
+            k->matmul_A_q8(d->h + t * rank, d->A8, d->A8_scale, out, rank,
+                           d->y + t * out);
+            break;
+        case K_ACC:
+            if (dtype == LORA_DTYPE_F32)
+                k->accumulate(d->y, x, in);
+            else
+                k->accumulate_half(d->y, xh, dtype, in);
+            break;
+        }
+    }
+}
+
+// Floats in order as integers, so their difference counts ULPs.
+static int64_t float_order(float f)
+{
+    int32_t i;
+
+    memcpy(&i, &f, sizeof(i));
+    return i < 0 ? -(int64_t)(i & 0x7fffffff) : i;
+}
+
+// Record one output's error against the reference value ref whose terms
+// sum to mag in magnitude.
+static void check_value(struct bench_result *r, float got, double ref,
+                        double mag)
+{
+    const double ulp = fabs((double)(float_order(got) -
+                                     float_order((float)ref)));
+    const double rel = mag > 0.0 ? fabs(got - ref) / mag :
+                                   (got == ref ? 0.0 : INFINITY);
+
+    if (ulp > r->max_ulp)
+        r->max_ulp = ulp;
+    if (!(rel <= r->max_rel))
+        r->max_rel = rel;
+}
+
+// Compare the kernel's last outputs with a double precision reference.
+static void check_kernel(struct bench_result *r, uint32_t kernel,
+                         uint32_t dtype, const struct bench_data *d)
+{
+    const uint32_t in = d->in, out = d->out, rank = d->rank;
+
+    r->max_ulp = 0.0;
+    r->max_rel = 0.0;
+    switch (kernel)
+    {
+    case K_B:
+    case K_B_TILE:
+    case K_B_Q8:
+    case K_B_Q4:
+        r->bound = in * FLT_EPSILON;
+        for (uint32_t t = 0; t < d->tokens; t++)
+        {
+            for (uint32_t k = 0; k < rank; k++)
+            {
+                double ref = 0.0, mag = 0.0;
+
+                for (uint32_t c = 0; c < in; c++)
+                {
+                    const double v = x_value(d, kernel == K_B ||
+                                             kernel == K_B_TILE ? dtype :
+                                             LORA_DTYPE_F32, t, c) *
+                                     b_value(d, kernel, k, c);
+
+                    ref += v;
+                    mag += fabs(v);
+                }
+                check_value(r, d->y[(size_t)t * rank + k], ref, mag);
+            }
+        }
+        break;
+    case K_A:
+    case K_A_TILE:
+    case K_A_Q8:
+        r->bound = rank * FLT_EPSILON;
+        for (uint32_t t = 0; t < d->tokens; t++)
+        {
+            for (uint32_t o = 0; o < out; o++)
+            {
+                double ref = 0.0, mag = 0.0;
+
+                for (uint32_t k = 0; k < rank; k++)
+                {
+                    const double v = d->h[(size_t)t * rank + k] *
+                                     a_value(d, kernel, o, k);
+
+                    ref += v;
+                    mag += fabs(v);
+                }
+                check_value(r, d->y[(size_t)t * out + o], ref, mag);
+            }
+        }
+        break;
+    case K_ACC:
+        r->bound = d->tokens * FLT_EPSILON;
+        for (uint32_t c = 0; c < in; c++)
+        {
+            double ref = 0.0, mag = 0.0;
+
+            for (uint32_t t = 0; t < d->tokens; t++)
+            {
+                const double v = x_value(d, dtype, t, c);
+
+                ref += v;
+                mag += fabs(v);
+            }
+            check_value(r, d->y[c], ref, mag);
+        }
+        break;
+    }
+    r->ok = r->max_rel <= r->bound;
+}
+
+// Multiply-adds count as two FLOPs. Traffic counts each call's weights,
+// activations and outputs once.
+static void count_work(const struct bench_data *d, uint32_t kernel,
+                       uint32_t dtype, double *flops, double *bytes)
+{
+    const double tokens = d->tokens;
+    const double in = d->in, out = d->out, rank = d->rank;
+    const double esz = lora_dtype_size(dtype);
+    const double tiles = (d->tokens + LORA_TILE_TOKENS - 1) /
+                         LORA_TILE_TOKENS;
+
+    switch (kernel)
+    {
+    case K_B:
+    case K_B_Q8:
+    case K_B_Q4:
+        *flops = 2 * tokens * rank * in;
+        *bytes = tokens * (in * esz + rank * 4);
+        if (kernel == K_B)
+            *bytes += tokens * rank * in * 4;
+        else if (kernel == K_B_Q8)
+            *bytes += tokens * (rank * in + rank * 4);
+        else
+            *bytes += tokens * (rank * in / 2 +
+                                rank * in / LORA_Q4_GROUP * 4);
+        break;
+    case K_B_TILE:
+        *flops = 2 * tokens * rank * in;
+        *bytes = tiles * rank * in * 4 + tokens * (in * esz + rank * 4);
+        break;
+    case K_A:
+        *flops = 2 * tokens * out * rank;
+        *bytes = tokens * (out * rank * 4 + rank * 4 + out * 4);
+        break;
+    case K_A_TILE:
+        *flops = 2 * tokens * out * rank;
+        *bytes = tiles * out * rank * 4 + tokens * (rank * 4 + out * 4);
+        break;
+    case K_A_Q8:
+        *flops = 2 * tokens * out * rank;
+        *bytes = tokens * (out * rank + out * 4 + rank * 4 + out * 4);
+        break;
+    default:
+        *flops = tokens * in;
+        *bytes = tokens * (in * esz + in * 8);
+        break;
+    }
+}
+
+static void run_point(const struct bench_opts *o, const struct lora_kernels *k,
+                      struct bench_data *d, struct bench_result *r)
+{
+    double *samples = malloc(o->iters * sizeof(*samples));
+    double flops, bytes;
+
+    if (!samples)
+        err(1, "malloc");
+    for (uint32_t i = 0; i < o->warmup; i++)
+        run_kernel(k, r->kernel, r->dtype, d);
+    for (uint32_t i = 0; i < o->iters; i++)
+    {
+        const uint64_t start = now_ns();
+
+        run_kernel(k, r->kernel, r->dtype, d);
+        samples[i] = (now_ns() - start) / 1e3;
+    }
+    qsort(samples, o->iters, sizeof(*samples), cmp_double);
+    r->us = samples[(o->iters - 1) / 2];
+    free(samples);
+
+    count_work(d, r->kernel, r->dtype, &flops, &bytes);
+    r->gflops = r->us > 0.0 ? flops / r->us / 1e3 : 0.0;
+    r->gbytes = r->us > 0.0 ? bytes / r->us / 1e3 : 0.0;
+    check_kernel(r, r->kernel, r->dtype, d);
+}
+
+static void print_row(const struct bench_result *r)
+{
+    printf("%-7s %-10s %-4s %4u %6u %5u %5u %5u | %10.2f %8.2f %8.2f |"
+           " %8.0f %9.2e %s\n",
+           variant_names[r->variant], kernel_names[r->kernel],
+           dtype_names[r->dtype], r->rank, r->in, r->out, r->batch, r->seq,
+           r->us, r->gflops, r->gbytes, r->max_ulp, r->max_rel,
+           r->ok ? "ok" : "FAIL");
+}
+
+static FILE *open_output(const char *path)
+{
+    FILE *f;
+
+    if (!strcmp(path, "-"))
+        return stdout;
+    f = fopen(path, "w");
+    if (!f)
+        err(1, "%s", path);
+    return f;
+}
+
+static void close_output(FILE *f)
+{
+    if (f != stdout)
+        fclose(f);
+}
+
+static void write_csv(const char *path, const struct bench_opts *o,
+                      const struct bench_result *res, uint32_t n)
+{
+    FILE *f = open_output(path);
+
+    fprintf(f, "variant,kernel,dtype,rank,in_channels,out_channels,batch,"
+               "seq,iters,p50_us,gflops,gbytes_per_s,max_ulp,max_rel,"
+               "rel_bound,ok\n");
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const struct bench_result *r = &res[i];
+
+        fprintf(f, "%s,%s,%s,%u,%u,%u,%u,%u,%u,%.3f,%.3f,%.3f,%.0f,%.3e,"
+                   "%.3e,%d\n",
+                variant_names[r->variant], kernel_names[r->kernel],
+                dtype_names[r->dtype], r->rank, r->in, r->out, r->batch,
+                r->seq, o->iters, r->us, r->gflops, r->gbytes, r->max_ulp,
+                r->max_rel, r->bound, r->ok);
+    }
+    close_output(f);
+}
+
+static void write_json(const char *path, const struct bench_opts *o,
+                       const struct bench_result *res, uint32_t n)
+{
+    FILE *f = open_output(path);
+
+    fprintf(f, "{\n  \"warmup\": %u,\n  \"iters\": %u,\n  \"results\": [",
+            o->warmup, o->iters);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const struct bench_result *r = &res[i];
+
+        fprintf(f, "%s\n    {\"variant\": \"%s\", \"kernel\": \"%s\", "
+                   "\"dtype\": \"%s\", \"rank\": %u, \"in_channels\": %u, "
+                   "\"out_channels\": %u, \"batch\": %u, \"seq\": %u,\n",
+                i ? "," : "", variant_names[r->variant],
+                kernel_names[r->kernel], dtype_names[r->dtype], r->rank,
+                r->in, r->out, r->batch, r->seq);
+        fprintf(f, "     \"p50_us\": %.3f, \"gflops\": %.3f, "
+                   "\"gbytes_per_s\": %.3f, \"max_ulp\": %.0f, "
+                   "\"max_rel\": %.3e, \"rel_bound\": %.3e, \"ok\": %s}",
+                r->us, r->gflops, r->gbytes, r->max_ulp, r->max_rel,
+                r->bound, r->ok ? "true" : "false");
+    }
+    fprintf(f, "\n  ]\n}\n");
+    close_output(f);
+}
+
+// Whether the kernel runs at this point: only the activation kernels take
+// half inputs, and LORA_FMT_Q4 rows come in whole groups.
+static bool point_applies(uint32_t kernel, uint32_t dtype, uint32_t in)
+{
+    if (dtype != LORA_DTYPE_F32 && kernel != K_B && kernel != K_B_TILE &&
+        kernel != K_ACC)
+        return false;
+    return kernel != K_B_Q4 || in % LORA_Q4_GROUP == 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "variant", required_argument, NULL, 'v' },
+        { "kernel", required_argument, NULL, 'k' },
+        { "dtype", required_argument, NULL, 't' },
+        { "rank", required_argument, NULL, 'r' },
+        { "in", required_argument, NULL, 'i' },
+        { "out", required_argument, NULL, 'o' },
+        { "batch", required_argument, NULL, 'b' },
+        { "seq", required_argument, NULL, 's' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "iters", required_argument, NULL, 'n' },
+        { "csv", required_argument, NULL, 'C' },
+        { "json", required_argument, NULL, 'J' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct bench_opts o = {
+        .kernel = { { K_B, K_B_TILE, K_A, K_A_TILE, K_B_Q8, K_B_Q4, K_A_Q8,
+                      K_ACC }, K_COUNT },
+        .dtype = { { LORA_DTYPE_F32 }, 1 },
+        .rank = { { 4, 16 }, 2 },
+        .in = { { IN_CHANNELS }, 1 },
+        .out = { { OUT_CHANNELS }, 1 },
+        .batch = { { 1, MAX_BATCH_SIZE }, 2 },
+        .seq = { { 1, MAX_SEQ_LENGTH }, 2 },
+        .warmup = 3,
+        .iters = 20,
+    };
+    struct bench_result *results;
+    uint32_t count = 0;
+    int failed = 0;
+    int c;
+
+    if (lora_kernel_count > ARRAY_SIZE(variant_names))
+        errx(1, "too many kernel variants");
+    for (uint32_t v = 0; v < lora_kernel_count; v++)
+    {
+        variant_names[v] = lora_kernel_table[v].name;
+        if (lora_kernel_table[v].supported())
+            o.variant.v[o.variant.n++] = v;
+    }
+
+    while ((c = getopt_long(argc, argv, "v:k:t:r:i:o:b:s:w:n:h", long_opts,
+                            NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'v':
+            parse_list(optarg, &o.variant, variant_names, lora_kernel_count);
+            break;
+        case 'k':
+            parse_list(optarg, &o.kernel, kernel_names, K_COUNT);
+            break;
+        case 't':
+            parse_list(optarg, &o.dtype, dtype_names,
+                       ARRAY_SIZE(dtype_names));
+            break;
+        case 'r':
+            parse_list(optarg, &o.rank, NULL, 0);
+            break;
+        case 'i':
+            parse_list(optarg, &o.in, NULL, 0);
+            break;
+        case 'o':
+            parse_list(optarg, &o.out, NULL, 0);
+            break;
+        case 'b':
+            parse_list(optarg, &o.batch, NULL, 0);
+            break;
+        case 's':
+            parse_list(optarg, &o.seq, NULL, 0);
+            break;
+        case 'w':
+            o.warmup = parse_uint(optarg, 0);
+            break;
+        case 'n':
+            o.iters = parse_uint(optarg, 1);
+            break;
+        case 'C':
+            o.csv = optarg;
+            break;
+        case 'J':
+            o.json = optarg;
+            break;
+        default:
+            usage();
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc)
+    {
+        usage();
+        return 1;
+    }
+    for (uint32_t i = 0; i < o.variant.n; i++)
+    {
+        if (!lora_kernel_table[o.variant.v[i]].supported())
+            errx(1, "variant %s is not supported by this CPU",
+                 variant_names[o.variant.v[i]]);
+    }
+    if (list_max(&o.rank) > LORA_MAX_RANK ||
+        list_max(&o.in) > LORA_MAX_CHANNELS ||
+        list_max(&o.out) > LORA_MAX_CHANNELS)
+        errx(1, "rank or channels above the TA's limits");
+
+    results = calloc((size_t)o.variant.n * o.kernel.n * o.dtype.n *
+                     o.rank.n * o.in.n * o.out.n * o.batch.n * o.seq.n,
+                     sizeof(*results));
+    if (!results)
+        err(1, "malloc");
+
+    printf("%u warm-up and %u timed iterations; error bound n * FLT_EPSILON"
+           " relative to the summed |terms|\n", o.warmup, o.iters);
+    printf("variant kernel     type rank     in   out batch   seq |"
+           "    p50 us  GFLOP/s     GB/s |  max ulp   max rel\n");
+
+    for (uint32_t ri = 0; ri < o.rank.n; ri++)
+    for (uint32_t ii = 0; ii < o.in.n; ii++)
+    for (uint32_t oi = 0; oi < o.out.n; oi++)
+    for (uint32_t bi = 0; bi < o.batch.n; bi++)
+    for (uint32_t si = 0; si < o.seq.n; si++)
+    {
+        struct bench_data d;
+
+        // One data set per shape serves every variant and kernel.
+        make_data(&d, o.batch.v[bi] * o.seq.v[si], o.in.v[ii], o.out.v[oi],
+                  o.rank.v[ri]);
+        for (uint32_t vi = 0; vi < o.variant.n; vi++)
+        for (uint32_t ki = 0; ki < o.kernel.n; ki++)
+        for (uint32_t ti = 0; ti < o.dtype.n; ti++)
+        {
+            struct bench_result *r = &results[count];
+
+            if (!point_applies(o.kernel.v[ki], o.dtype.v[ti], d.in))
+                continue;
+            r->variant = o.variant.v[vi];
+            r->kernel = o.kernel.v[ki];
+            r->dtype = o.dtype.v[ti];
+            r->rank = d.rank;
+            r->in = d.in;
+            r->out = d.out;
+            r->batch = o.batch.v[bi];
+            r->seq = o.seq.v[si];
+            run_point(&o, &lora_kernel_table[r->variant], &d, r);
+            print_row(r);
+            if (!r->ok)
+                failed = 1;
+            count++;
+        }
+        free_data(&d);
+    }
+
+    if (o.csv)
+        write_csv(o.csv, &o, results, count);
+    if (o.json)
+        write_json(o.json, &o, results, count);
+
+    free(results);
+    if (failed)
+        fprintf(stderr, "lora_bench: some outputs exceed the error bound\n");
+    return failed;
+}
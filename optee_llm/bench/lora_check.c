@@ -0,0 +1,290 @@
+/*
+ * lora_check: equivalence check of the TA's mean-pooled fast path against
+ * the per-token reference path (LORA_FLAG_REFERENCE), run in the host
+ * emulator.
+ *
+ * The LoRA branch is linear, so projecting the mean token and averaging
+ * the per-token projections agree up to float rounding. For every point
+ * of a grid of weight formats, ranks, output channels (merged and factored
+ * adapters), input dtypes and sequence lengths, the same random batch goes
+ * through both paths and each sample's largest difference, relative to
+ * the sample's largest reference output, must stay within the tolerance.
+ * A streamed request whose adapter is reloaded between chunks must then
+ * fail rather than mix the two sets of weights.
+ * The exit status is nonzero if any point does not.
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <opteellm.h>
+
+static const char *const format_names[] = { "f32", "q8", "q4" };
+static const char *const dtype_names[] = { "f32", "f16", "bf16" };
+
+static const uint32_t ranks[] = { 4, 16 };
+// 3 outputs run merged, 64 run factored.
+static const uint32_t outs[] = { OUT_CHANNELS, 64 };
+static const uint32_t seqs[] = { 1, 17, MAX_SEQ_LENGTH };
+
+#define CHECK_BATCH 4
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint32_t seed = 12345;
+
+static uint32_t next_rand(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Random input element of the given dtype in about [-4, 4).
+static void fill_input(void *x, uint32_t dtype, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        const uint32_t r = next_rand();
+
+        if (dtype == LORA_DTYPE_F32)
+            ((float *)x)[i] = (float)(r & 0xffff) / 8192.0f - 4.0f;
+        else if (dtype == LORA_DTYPE_F16)
+            ((uint16_t *)x)[i] = (r & 0x8000) | (10 + r % 7) << 10 |
+                                 (r >> 3 & 0x3ff);
+        else
+            ((uint16_t *)x)[i] = (r & 0x8000) | (122 + r % 7) << 7 |
+                                 (r >> 3 & 0x7f);
+    }
+}
+
+static TEEC_Result stream_invoke(struct opteellm *ol, uint32_t cmd,
+                                 TEEC_Operation *op)
+{
+    uint32_t origin;
+
+    return TEEC_InvokeCommand(opteellm_session(ol), cmd, op, &origin);
+}
+
+// Stream two chunks with the adapter reloaded, same shape, in between. The
+// second chunk and the finalize must both fail with TEEC_ERROR_BAD_STATE,
+// while the same stream without the reload succeeds. Returns nonzero on
+// failure.
+static int check_stream_reload(struct opteellm *ol, void *input)
+{
+    const lora_adapter_desc_t desc = {
+        .format = LORA_FMT_F32,
+        .in_channels = IN_CHANNELS,
+        .out_channels = OUT_CHANNELS,
+        .rank = 4,
+        .max_batch_size = CHECK_BATCH,
+        .max_seq_length = MAX_SEQ_LENGTH,
+    };
+    const tensor_dims_t dims = {
+        .batch_size = CHECK_BATCH,
+        .in_channels = IN_CHANNELS,
+        .output_mode = LORA_OUT_MEAN,
+        .input_dtype = LORA_DTYPE_F32,
+        .output_dtype = LORA_DTYPE_F32,
+    };
+    const uint32_t chunk = 8;
+    float output[CHECK_BATCH * OUT_CHANNELS];
+    TEEC_Result res[2][3];
+    TEEC_Operation op;
+
+    fill_input(input, LORA_DTYPE_F32,
+               (size_t)CHECK_BATCH * chunk * IN_CHANNELS);
+    for (int reload = 0; reload < 2; reload++)
+    {
+        if (opteellm_load_adapter(ol, 0, LORA_WEIGHTS_RANDOM, 0, &desc, NULL,
+                                  0) != TEEC_SUCCESS)
+            errx(1, "loading the stream adapter failed");
+
+        memset(&op, 0, sizeof(op));
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+                                         TEEC_NONE, TEEC_NONE);
+        op.params[0].tmpref.buffer = (void *)&dims;
+        op.params[0].tmpref.size = sizeof(dims);
+        res[reload][0] = stream_invoke(ol, TA_OPTEE_LLM_CMD_LORA_STREAM_BEGIN,
+                                       &op);
+
+        for (int c = 0; c < 2; c++)
+        {
+            if (c && reload &&
+                opteellm_load_adapter(ol, 0, LORA_WEIGHTS_RANDOM, 0, &desc,
+                                      NULL, 0) != TEEC_SUCCESS)
+                errx(1, "reloading the stream adapter failed");
+            memset(&op, 0, sizeof(op));
+            op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+                                             TEEC_VALUE_INPUT, TEEC_NONE,
+                                             TEEC_NONE);
+            op.params[0].tmpref.buffer = input;
+            op.params[0].tmpref.size = (size_t)CHECK_BATCH * chunk *
+                                       IN_CHANNELS * sizeof(float);
+            op.params[1].value.a = chunk;
+            res[reload][1] = stream_invoke(
+                ol, TA_OPTEE_LLM_CMD_LORA_STREAM_APPEND, &op);
+            if (res[reload][1] != TEEC_SUCCESS)
+                break;
+        }
+
+        memset(&op, 0, sizeof(op));
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE,
+                                         TEEC_NONE, TEEC_NONE);
+        op.params[0].tmpref.buffer = output;
+        op.params[0].tmpref.size = sizeof(output);
+        res[reload][2] = stream_invoke(
+            ol, TA_OPTEE_LLM_CMD_LORA_STREAM_FINALIZE, &op);
+    }
+
+    const int ok = res[0][0] == TEEC_SUCCESS && res[0][1] == TEEC_SUCCESS &&
+                   res[0][2] == TEEC_SUCCESS && res[1][0] == TEEC_SUCCESS &&
+                   res[1][1] == TEEC_ERROR_BAD_STATE &&
+                   res[1][2] == TEEC_ERROR_BAD_STATE;
+
+    printf("stream with reload mid-stream: append 0x%x, finalize 0x%x %s\n",
+           res[1][1], res[1][2], ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: lora_check [options]\n"
+            "  -e, --tolerance X    largest relative difference (1e-5)\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "tolerance", required_argument, NULL, 'e' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    const uint32_t in = IN_CHANNELS;
+    const size_t max_input = (size_t)CHECK_BATCH * MAX_SEQ_LENGTH * in *
+                             sizeof(float);
+    float pooled[CHECK_BATCH * 64];
+    float reference[CHECK_BATCH * 64];
+    struct opteellm *ol;
+    double tolerance = 1e-5;
+    uint32_t points = 0;
+    int failed = 0;
+    void *input;
+    TEEC_Result res;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "e:h", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'e':
+            tolerance = strtod(optarg, NULL);
+            if (!(tolerance > 0.0))
+                errx(1, "bad tolerance '%s'", optarg);
+            break;
+        default:
+            usage();
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc)
+    {
+        usage();
+        return 1;
+    }
+
+    input = malloc(max_input);
+    if (!input)
+        err(1, "malloc");
+    res = opteellm_open(&ol);
+    if (res != TEEC_SUCCESS)
+        errx(1, "opteellm_open failed with code 0x%x", res);
+
+    printf("format rank  out dtype  seq | max rel diff\n");
+    for (uint32_t f = 0; f < ARRAY_SIZE(format_names); f++)
+    for (uint32_t ri = 0; ri < ARRAY_SIZE(ranks); ri++)
+    for (uint32_t oi = 0; oi < ARRAY_SIZE(outs); oi++)
+    {
+        const lora_adapter_desc_t desc = {
+            .format = f,
+            .in_channels = in,
+            .out_channels = outs[oi],
+            .rank = ranks[ri],
+            .max_batch_size = CHECK_BATCH,
+            .max_seq_length = MAX_SEQ_LENGTH,
+        };
+
+        res = opteellm_load_adapter(ol, 0, LORA_WEIGHTS_RANDOM, 0, &desc,
+                                    NULL, 0);
+        if (res != TEEC_SUCCESS)
+            errx(1, "loading a %s adapter failed with code 0x%x",
+                 format_names[f], res);
+
+        for (uint32_t dtype = 0; dtype < ARRAY_SIZE(dtype_names); dtype++)
+        for (uint32_t si = 0; si < ARRAY_SIZE(seqs); si++)
+        {
+            tensor_dims_t dims = {
+                .batch_size = CHECK_BATCH,
+                .seq_length = seqs[si],
+                .in_channels = in,
+                .output_mode = LORA_OUT_MEAN,
+                .input_dtype = dtype,
+                .output_dtype = LORA_DTYPE_F32,
+            };
+            const size_t out_size = (size_t)CHECK_BATCH * desc.out_channels *
+                                    sizeof(float);
+            uint32_t origin = 0;
+            double worst = 0.0;
+
+            fill_input(input, dtype,
+                       (size_t)CHECK_BATCH * dims.seq_length * in);
+            res = opteellm_infer(ol, &dims, input, pooled, out_size, &origin);
+            if (res == TEEC_SUCCESS)
+            {
+                dims.flags = LORA_FLAG_REFERENCE;
+                res = opteellm_infer(ol, &dims, input, reference, out_size,
+                                     &origin);
+            }
+            if (res != TEEC_SUCCESS)
+                errx(1, "inference failed with code 0x%x, origin 0x%x", res,
+                     origin);
+
+            for (uint32_t s = 0; s < CHECK_BATCH; s++)
+            {
+                const float *p = pooled + s * desc.out_channels;
+                const float *r = reference + s * desc.out_channels;
+                double diff = 0.0, mag = 0.0;
+
+                for (uint32_t o = 0; o < desc.out_channels; o++)
+                {
+                    diff = fmax(diff, fabs((double)p[o] - r[o]));
+                    mag = fmax(mag, fabs((double)r[o]));
+                }
+                diff = mag > 0.0 ? diff / mag : diff;
+                if (!(diff <= worst))
+                    worst = diff;
+            }
+
+            printf("%-6s %4u %4u %-5s %4u | %12.3e %s\n", format_names[f],
+                   desc.rank, desc.out_channels, dtype_names[dtype],
+                   dims.seq_length, worst,
+                   worst <= tolerance ? "ok" : "FAIL");
+            if (!(worst <= tolerance))
+                failed = 1;
+            points++;
+        }
+    }
+
+    if (check_stream_reload(ol, input))
+        failed = 1;
+
+    opteellm_close(ol);
+    free(input);
+    printf("%u points, tolerance %.1e: %s\n", points, tolerance,
+           failed ? "FAIL" : "ok");
+    return failed;
+}
@@ -0,0 +1,14 @@
+/*
+ * Host-native stand-in for OP-TEE's <compiler.h>.
+ */
+
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#define __maybe_unused	__attribute__((unused))
+#define __noreturn	__attribute__((__noreturn__))
+#define __aligned(x)	__attribute__((aligned(x)))
+#define __packed	__attribute__((packed))
+#define __unused	__attribute__((unused))
+
+#endif /* COMPILER_H */
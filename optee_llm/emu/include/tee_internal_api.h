@@ -0,0 +1,214 @@
+/*
+ * Host-native stand-in for the OP-TEE TEE Internal Core API header.
+ *
+ * Provides the subset of the GlobalPlatform Internal Core API that the
+ * optee_llm TA uses so that the TA sources can be compiled as ordinary
+ * Linux code and driven in-process by the emulated client library.
+ */
+
+#ifndef TEE_INTERNAL_API_H
+#define TEE_INTERNAL_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <compiler.h>
+#include <trace.h>
+
+typedef uint32_t TEE_Result;
+
+#define TEE_SUCCESS                       0x00000000
+#define TEE_ERROR_CORRUPT_OBJECT          0xF0100001
+#define TEE_ERROR_STORAGE_NOT_AVAILABLE   0xF0100003
+#define TEE_ERROR_GENERIC                 0xFFFF0000
+#define TEE_ERROR_ACCESS_DENIED           0xFFFF0001
+#define TEE_ERROR_CANCEL                  0xFFFF0002
+#define TEE_ERROR_ACCESS_CONFLICT         0xFFFF0003
+#define TEE_ERROR_EXCESS_DATA             0xFFFF0004
+#define TEE_ERROR_BAD_FORMAT              0xFFFF0005
+#define TEE_ERROR_BAD_PARAMETERS          0xFFFF0006
+#define TEE_ERROR_BAD_STATE               0xFFFF0007
+#define TEE_ERROR_ITEM_NOT_FOUND          0xFFFF0008
+#define TEE_ERROR_NOT_IMPLEMENTED         0xFFFF0009
+#define TEE_ERROR_NOT_SUPPORTED           0xFFFF000A
+#define TEE_ERROR_NO_DATA                 0xFFFF000B
+#define TEE_ERROR_OUT_OF_MEMORY           0xFFFF000C
+#define TEE_ERROR_BUSY                    0xFFFF000D
+#define TEE_ERROR_COMMUNICATION           0xFFFF000E
+#define TEE_ERROR_SECURITY                0xFFFF000F
+#define TEE_ERROR_SHORT_BUFFER            0xFFFF0010
+#define TEE_ERROR_OVERFLOW                0xFFFF300F
+#define TEE_ERROR_TARGET_DEAD             0xFFFF3024
+#define TEE_ERROR_STORAGE_NO_SPACE        0xFFFF3041
+#define TEE_ERROR_MAC_INVALID             0xFFFF3071
+
+#define TEE_PARAM_TYPE_NONE           0
+#define TEE_PARAM_TYPE_VALUE_INPUT    1
+#define TEE_PARAM_TYPE_VALUE_OUTPUT   2
+#define TEE_PARAM_TYPE_VALUE_INOUT    3
+#define TEE_PARAM_TYPE_MEMREF_INPUT   5
+#define TEE_PARAM_TYPE_MEMREF_OUTPUT  6
+#define TEE_PARAM_TYPE_MEMREF_INOUT   7
+
+#define TEE_PARAM_TYPES(t0, t1, t2, t3) \
+	((t0) | ((t1) << 4) | ((t2) << 8) | ((t3) << 12))
+
+#define TEE_PARAM_TYPE_GET(t, i) ((((uint32_t)t) >> ((i) * 4)) & 0xF)
+
+#define TEE_MALLOC_FILL_ZERO  0x00000000
+#define TEE_MALLOC_NO_FILL    0x00000001
+
+#define TEE_STORAGE_PRIVATE   0x00000001
+
+#define TEE_DATA_FLAG_ACCESS_READ        0x00000001
+#define TEE_DATA_FLAG_ACCESS_WRITE       0x00000002
+#define TEE_DATA_FLAG_ACCESS_WRITE_META  0x00000004
+#define TEE_DATA_FLAG_SHARE_READ         0x00000010
+#define TEE_DATA_FLAG_SHARE_WRITE        0x00000020
+#define TEE_DATA_FLAG_OVERWRITE          0x00000400
+
+#define TEE_DATA_MAX_POSITION  0xFFFFFFFF
+#define TEE_OBJECT_ID_MAX_LEN  64
+
+#define TEE_HANDLE_NULL  0
+
+typedef union {
+	struct {
+		void *buffer;
+		size_t size;
+	} memref;
+	struct {
+		uint32_t a;
+		uint32_t b;
+	} value;
+} TEE_Param;
+
+typedef struct {
+	uint32_t seconds;
+	uint32_t millis;
+} TEE_Time;
+
+typedef enum {
+	TEE_DATA_SEEK_SET = 0,
+	TEE_DATA_SEEK_CUR = 1,
+	TEE_DATA_SEEK_END = 2
+} TEE_Whence;
+
+typedef struct {
+	uint32_t objectType;
+	uint32_t objectSize;
+	uint32_t maxObjectSize;
+	uint32_t objectUsage;
+	size_t dataSize;
+	size_t dataPosition;
+	uint32_t handleFlags;
+} TEE_ObjectInfo;
+
+typedef struct __TEE_ObjectHandle *TEE_ObjectHandle;
+typedef struct __TEE_OperationHandle *TEE_OperationHandle;
+
+typedef struct {
+	uint32_t attributeID;
+	union {
+		struct {
+			void *buffer;
+			size_t length;
+		} ref;
+		struct {
+			uint32_t a;
+			uint32_t b;
+		} value;
+	} content;
+} TEE_Attribute;
+
+#define TEE_ALG_AES_GCM        0x40000810
+#define TEE_MODE_ENCRYPT       0
+#define TEE_MODE_DECRYPT       1
+#define TEE_TYPE_AES           0xA0000010
+#define TEE_ATTR_SECRET_VALUE  0xC0000000
+
+/* TA entry points, implemented by the TA */
+TEE_Result TA_CreateEntryPoint(void);
+void TA_DestroyEntryPoint(void);
+TEE_Result TA_OpenSessionEntryPoint(uint32_t paramTypes, TEE_Param params[4],
+				    void **sessionContext);
+void TA_CloseSessionEntryPoint(void *sessionContext);
+TEE_Result TA_InvokeCommandEntryPoint(void *sessionContext,
+				      uint32_t commandID,
+				      uint32_t paramTypes,
+				      TEE_Param params[4]);
+
+/* Panic */
+void TEE_Panic(TEE_Result panicCode) __noreturn;
+
+/* Memory management */
+void *TEE_Malloc(size_t size, uint32_t hint);
+void *TEE_Realloc(void *buffer, size_t newSize);
+void TEE_Free(void *buffer);
+void *TEE_MemMove(void *dest, const void *src, size_t size);
+int32_t TEE_MemCompare(const void *buffer1, const void *buffer2,
+		       size_t size);
+void *TEE_MemFill(void *buffer, uint32_t x, size_t size);
+
+/* Persistent objects */
+TEE_Result TEE_OpenPersistentObject(uint32_t storageID, const void *objectID,
+				    size_t objectIDLen, uint32_t flags,
+				    TEE_ObjectHandle *object);
+TEE_Result TEE_CreatePersistentObject(uint32_t storageID,
+				      const void *objectID,
+				      size_t objectIDLen, uint32_t flags,
+				      TEE_ObjectHandle attributes,
+				      const void *initialData,
+				      size_t initialDataLen,
+				      TEE_ObjectHandle *object);
+TEE_Result TEE_CloseAndDeletePersistentObject1(TEE_ObjectHandle object);
+void TEE_CloseObject(TEE_ObjectHandle object);
+TEE_Result TEE_GetObjectInfo1(TEE_ObjectHandle object,
+			      TEE_ObjectInfo *objectInfo);
+TEE_Result TEE_ReadObjectData(TEE_ObjectHandle object, void *buffer,
+			      size_t size, size_t *count);
+TEE_Result TEE_WriteObjectData(TEE_ObjectHandle object, const void *buffer,
+			       size_t size);
+TEE_Result TEE_SeekObjectData(TEE_ObjectHandle object, intmax_t offset,
+			      TEE_Whence whence);
+
+/*
+ * Transient objects and authenticated encryption: AES-GCM only, backed by
+ * OpenSSL when the emulator is built with it and TEE_ERROR_NOT_SUPPORTED
+ * otherwise.
+ */
+TEE_Result TEE_AllocateTransientObject(uint32_t objectType,
+				       uint32_t maxObjectSize,
+				       TEE_ObjectHandle *object);
+void TEE_FreeTransientObject(TEE_ObjectHandle object);
+void TEE_InitRefAttribute(TEE_Attribute *attr, uint32_t attributeID,
+			  const void *buffer, size_t length);
+TEE_Result TEE_PopulateTransientObject(TEE_ObjectHandle object,
+				       const TEE_Attribute *attrs,
+				       uint32_t attrCount);
+TEE_Result TEE_AllocateOperation(TEE_OperationHandle *operation,
+				 uint32_t algorithm, uint32_t mode,
+				 uint32_t maxKeySize);
+void TEE_FreeOperation(TEE_OperationHandle operation);
+TEE_Result TEE_SetOperationKey(TEE_OperationHandle operation,
+			       TEE_ObjectHandle key);
+TEE_Result TEE_AEInit(TEE_OperationHandle operation, const void *nonce,
+		      size_t nonceLen, uint32_t tagLen, size_t AADLen,
+		      size_t payloadLen);
+void TEE_AEUpdateAAD(TEE_OperationHandle operation, const void *AADdata,
+		     size_t AADdataLen);
+TEE_Result TEE_AEEncryptFinal(TEE_OperationHandle operation,
+			      const void *srcData, size_t srcLen,
+			      void *destData, size_t *destLen, void *tag,
+			      size_t *tagLen);
+TEE_Result TEE_AEDecryptFinal(TEE_OperationHandle operation,
+			      const void *srcData, size_t srcLen,
+			      void *destData, size_t *destLen, void *tag,
+			      size_t tagLen);
+
+/* Random numbers and time */
+void TEE_GenerateRandom(void *randomBuffer, size_t randomBufferLen);
+void TEE_GetSystemTime(TEE_Time *time);
+void TEE_GetREETime(TEE_Time *time);
+
+#endif /* TEE_INTERNAL_API_H */
@@ -0,0 +1,13 @@
+/*
+ * Host-native stand-in for OP-TEE's <tee_internal_api_extensions.h>.
+ *
+ * None of the OP-TEE specific extensions are used by the TA yet; the header
+ * exists so that the TA sources build unchanged.
+ */
+
+#ifndef TEE_INTERNAL_API_EXTENSIONS_H
+#define TEE_INTERNAL_API_EXTENSIONS_H
+
+#include <tee_internal_api.h>
+
+#endif /* TEE_INTERNAL_API_EXTENSIONS_H */
@@ -0,0 +1,27 @@
+/*
+ * Host-native stand-in for OP-TEE's <trace.h>.
+ *
+ * Messages go to stderr. The level is taken from the OPTEE_LLM_EMU_TRACE
+ * environment variable (1 = error ... 4 = flow) and defaults to errors only
+ * so that trace output does not disturb benchmark runs.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_MIN	0
+#define TRACE_ERROR	1
+#define TRACE_INFO	2
+#define TRACE_DEBUG	3
+#define TRACE_FLOW	4
+
+void emu_trace_printf(const char *func, int line, int level,
+		      const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+#define EMSG(...) emu_trace_printf(__func__, __LINE__, TRACE_ERROR, __VA_ARGS__)
+#define IMSG(...) emu_trace_printf(__func__, __LINE__, TRACE_INFO, __VA_ARGS__)
+#define DMSG(...) emu_trace_printf(__func__, __LINE__, TRACE_DEBUG, __VA_ARGS__)
+#define FMSG(...) emu_trace_printf(__func__, __LINE__, TRACE_FLOW, __VA_ARGS__)
+
+#endif /* TRACE_H */
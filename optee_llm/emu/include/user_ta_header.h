@@ -0,0 +1,26 @@
+/*
+ * Host-native stand-in for OP-TEE's <user_ta_header.h>.
+ *
+ * Only the TA flags and property types referenced from
+ * user_ta_header_defines.h are needed by the emulator.
+ */
+
+#ifndef USER_TA_HEADER_H
+#define USER_TA_HEADER_H
+
+#define TA_FLAG_USER_MODE		0
+#define TA_FLAG_EXEC_DDR		0
+#define TA_FLAG_SINGLE_INSTANCE		(1 << 2)
+#define TA_FLAG_MULTI_SESSION		(1 << 3)
+#define TA_FLAG_INSTANCE_KEEP_ALIVE	(1 << 4)
+
+enum user_ta_prop_type {
+	USER_TA_PROP_TYPE_BOOL,
+	USER_TA_PROP_TYPE_U32,
+	USER_TA_PROP_TYPE_UUID,
+	USER_TA_PROP_TYPE_IDENTITY,
+	USER_TA_PROP_TYPE_STRING,
+	USER_TA_PROP_TYPE_BINARY_BLOCK,
+};
+
+#endif /* USER_TA_HEADER_H */
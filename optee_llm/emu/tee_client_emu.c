@@ -0,0 +1,327 @@
+/*
+ * Host-native implementation of the TEE Client API declared in
+ * emu/include/tee_client_api.h.
+ *
+ * Instead of talking to the OP-TEE driver, every call is dispatched
+ * in-process straight into the TA entry points, which are linked into the
+ * same executable. Shared memory is ordinary page-aligned host memory passed
+ * to the TA by pointer, the same zero-copy view the TA gets on the device.
+ *
+ * Only one copy of the TA's globals exists in-process, so the emulator
+ * behaves like a single TA instance: TA_CreateEntryPoint() runs when the
+ * first session opens, TA_DestroyEntryPoint() when the last one closes, and
+ * all entry points are serialized by one lock.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tee_client_api.h>
+#include <tee_internal_api.h>
+#include <user_ta_header.h>
+#include <user_ta_header_defines.h>
+
+static pthread_mutex_t emu_ta_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int emu_ta_sessions;
+static uint32_t emu_next_session_id = 1;
+static int emu_next_shm_id = 1;
+
+static const TEEC_UUID emu_ta_uuid = TA_UUID;
+
+TEEC_Result TEEC_InitializeContext(const char *name, TEEC_Context *context)
+{
+	(void)name;
+
+	if (!context)
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	memset(context, 0, sizeof(*context));
+	context->fd = -1;
+	context->reg_mem = true;
+	context->memref_null = true;
+	return TEEC_SUCCESS;
+}
+
+void TEEC_FinalizeContext(TEEC_Context *context)
+{
+	(void)context;
+}
+
+static uint32_t emu_shm_param_type(const TEEC_SharedMemory *shm)
+{
+	switch (shm->flags & (TEEC_MEM_INPUT | TEEC_MEM_OUTPUT)) {
+	case TEEC_MEM_INPUT:
+		return TEE_PARAM_TYPE_MEMREF_INPUT;
+	case TEEC_MEM_OUTPUT:
+		return TEE_PARAM_TYPE_MEMREF_OUTPUT;
+	default:
+		return TEE_PARAM_TYPE_MEMREF_INOUT;
+	}
+}
+
+/*
+ * Translate a client operation into the TA's view of the parameters, the
+ * same conversion the OP-TEE supplicant and driver perform on the device.
+ */
+static TEEC_Result emu_op_to_params(const TEEC_Operation *op,
+				    uint32_t *param_types,
+				    TEE_Param params[4])
+{
+	uint32_t types = 0;
+
+	memset(params, 0, 4 * sizeof(TEE_Param));
+	if (!op) {
+		*param_types = 0;
+		return TEEC_SUCCESS;
+	}
+
+	for (int i = 0; i < TEEC_CONFIG_PAYLOAD_REF_COUNT; i++) {
+		const TEEC_Parameter *p = &op->params[i];
+		uint32_t t = TEEC_PARAM_TYPE_GET(op->paramTypes, i);
+		uint32_t ta_type;
+
+		switch (t) {
+		case TEEC_NONE:
+			ta_type = TEE_PARAM_TYPE_NONE;
+			break;
+		case TEEC_VALUE_INPUT:
+		case TEEC_VALUE_OUTPUT:
+		case TEEC_VALUE_INOUT:
+			ta_type = t;
+			params[i].value.a = p->value.a;
+			params[i].value.b = p->value.b;
+			break;
+		case TEEC_MEMREF_TEMP_INPUT:
+		case TEEC_MEMREF_TEMP_OUTPUT:
+		case TEEC_MEMREF_TEMP_INOUT:
+			ta_type = t;
+			params[i].memref.buffer = p->tmpref.buffer;
+			params[i].memref.size = p->tmpref.size;
+			break;
+		case TEEC_MEMREF_WHOLE:
+			if (!p->memref.parent)
+				return TEEC_ERROR_BAD_PARAMETERS;
+			ta_type = emu_shm_param_type(p->memref.parent);
+			params[i].memref.buffer = p->memref.parent->buffer;
+			params[i].memref.size = p->memref.parent->size;
+			break;
+		case TEEC_MEMREF_PARTIAL_INPUT:
+		case TEEC_MEMREF_PARTIAL_OUTPUT:
+		case TEEC_MEMREF_PARTIAL_INOUT:
+			if (!p->memref.parent ||
+			    p->memref.offset > p->memref.parent->size ||
+			    p->memref.size >
+			    p->memref.parent->size - p->memref.offset)
+				return TEEC_ERROR_BAD_PARAMETERS;
+			ta_type = t - (TEEC_MEMREF_PARTIAL_INPUT -
+				       TEE_PARAM_TYPE_MEMREF_INPUT);
+			params[i].memref.buffer =
+				(uint8_t *)p->memref.parent->buffer +
+				p->memref.offset;
+			params[i].memref.size = p->memref.size;
+			break;
+		default:
+			return TEEC_ERROR_BAD_PARAMETERS;
+		}
+		types |= ta_type << (i * 4);
+	}
+
+	*param_types = types;
+	return TEEC_SUCCESS;
+}
+
+static void emu_params_to_op(TEEC_Operation *op, const TEE_Param params[4])
+{
+	if (!op)
+		return;
+
+	for (int i = 0; i < TEEC_CONFIG_PAYLOAD_REF_COUNT; i++) {
+		TEEC_Parameter *p = &op->params[i];
+
+		switch (TEEC_PARAM_TYPE_GET(op->paramTypes, i)) {
+		case TEEC_VALUE_OUTPUT:
+		case TEEC_VALUE_INOUT:
+			p->value.a = params[i].value.a;
+			p->value.b = params[i].value.b;
+			break;
+		case TEEC_MEMREF_TEMP_OUTPUT:
+		case TEEC_MEMREF_TEMP_INOUT:
+			p->tmpref.size = params[i].memref.size;
+			break;
+		case TEEC_MEMREF_WHOLE:
+		case TEEC_MEMREF_PARTIAL_OUTPUT:
+		case TEEC_MEMREF_PARTIAL_INOUT:
+			p->memref.size = params[i].memref.size;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+TEEC_Result TEEC_OpenSession(TEEC_Context *context, TEEC_Session *session,
+			     const TEEC_UUID *destination,
+			     uint32_t connectionMethod,
+			     const void *connectionData,
+			     TEEC_Operation *operation,
+			     uint32_t *returnOrigin)
+{
+	TEE_Param params[4];
+	uint32_t param_types;
+	uint32_t origin = TEEC_ORIGIN_API;
+	TEEC_Result res;
+	void *sess_ctx = NULL;
+
+	(void)connectionMethod;
+	(void)connectionData;
+
+	if (!context || !session || !destination) {
+		res = TEEC_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+	if (memcmp(destination, &emu_ta_uuid, sizeof(emu_ta_uuid))) {
+		origin = TEEC_ORIGIN_TEE;
+		res = TEEC_ERROR_ITEM_NOT_FOUND;
+		goto out;
+	}
+
+	res = emu_op_to_params(operation, &param_types, params);
+	if (res != TEEC_SUCCESS)
+		goto out;
+
+	pthread_mutex_lock(&emu_ta_lock);
+	if (!emu_ta_sessions) {
+		res = TA_CreateEntryPoint();
+		if (res != TEE_SUCCESS) {
+			pthread_mutex_unlock(&emu_ta_lock);
+			origin = TEEC_ORIGIN_TRUSTED_APP;
+			goto out;
+		}
+	}
+
+	res = TA_OpenSessionEntryPoint(param_types, params, &sess_ctx);
+	origin = TEEC_ORIGIN_TRUSTED_APP;
+	if (res == TEE_SUCCESS) {
+		emu_ta_sessions++;
+		session->ctx = context;
+		session->session_id = emu_next_session_id++;
+		session->ta_sess_ctx = sess_ctx;
+		emu_params_to_op(operation, params);
+	} else if (!emu_ta_sessions) {
+		TA_DestroyEntryPoint();
+	}
+	pthread_mutex_unlock(&emu_ta_lock);
+
+out:
+	if (returnOrigin)
+		*returnOrigin = origin;
+	return res;
+}
+
+void TEEC_CloseSession(TEEC_Session *session)
+{
+	if (!session || !session->ctx)
+		return;
+
+	pthread_mutex_lock(&emu_ta_lock);
+	TA_CloseSessionEntryPoint(session->ta_sess_ctx);
+	if (!--emu_ta_sessions && !(TA_FLAGS & TA_FLAG_INSTANCE_KEEP_ALIVE))
+		TA_DestroyEntryPoint();
+	pthread_mutex_unlock(&emu_ta_lock);
+
+	session->ctx = NULL;
+	session->ta_sess_ctx = NULL;
+}
+
+TEEC_Result TEEC_InvokeCommand(TEEC_Session *session, uint32_t commandID,
+			       TEEC_Operation *operation,
+			       uint32_t *returnOrigin)
+{
+	TEE_Param params[4];
+	uint32_t param_types;
+	uint32_t origin = TEEC_ORIGIN_API;
+	TEEC_Result res;
+
+	if (!session || !session->ctx) {
+		res = TEEC_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+
+	res = emu_op_to_params(operation, &param_types, params);
+	if (res != TEEC_SUCCESS)
+		goto out;
+
+	if (operation)
+		operation->session = session;
+
+	pthread_mutex_lock(&emu_ta_lock);
+	res = TA_InvokeCommandEntryPoint(session->ta_sess_ctx, commandID,
+					 param_types, params);
+	pthread_mutex_unlock(&emu_ta_lock);
+	origin = TEEC_ORIGIN_TRUSTED_APP;
+
+	emu_params_to_op(operation, params);
+out:
+	if (returnOrigin)
+		*returnOrigin = origin;
+	return res;
+}
+
+TEEC_Result TEEC_RegisterSharedMemory(TEEC_Context *context,
+				      TEEC_SharedMemory *sharedMem)
+{
+	if (!context || !sharedMem || (!sharedMem->buffer && sharedMem->size))
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	sharedMem->id = __atomic_fetch_add(&emu_next_shm_id, 1,
+					    __ATOMIC_RELAXED);
+	sharedMem->alloced_size = sharedMem->size;
+	sharedMem->shadow_buffer = NULL;
+	sharedMem->registered_fd = -1;
+	sharedMem->buffer_allocated = false;
+	return TEEC_SUCCESS;
+}
+
+TEEC_Result TEEC_AllocateSharedMemory(TEEC_Context *context,
+				      TEEC_SharedMemory *sharedMem)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size;
+	void *buf;
+
+	if (!context || !sharedMem)
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	size = sharedMem->size ? sharedMem->size : 8;
+	if (posix_memalign(&buf, page, size))
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	sharedMem->buffer = buf;
+	sharedMem->id = __atomic_fetch_add(&emu_next_shm_id, 1,
+					    __ATOMIC_RELAXED);
+	sharedMem->alloced_size = size;
+	sharedMem->shadow_buffer = NULL;
+	sharedMem->registered_fd = -1;
+	sharedMem->buffer_allocated = true;
+	return TEEC_SUCCESS;
+}
+
+void TEEC_ReleaseSharedMemory(TEEC_SharedMemory *sharedMemory)
+{
+	if (!sharedMemory || sharedMemory->id < 0)
+		return;
+
+	if (sharedMemory->buffer_allocated)
+		free(sharedMemory->buffer);
+	sharedMemory->buffer = NULL;
+	sharedMemory->id = -1;
+	sharedMemory->alloced_size = 0;
+	sharedMemory->buffer_allocated = false;
+}
+
+void TEEC_RequestCancellation(TEEC_Operation *operation)
+{
+	(void)operation;
+}
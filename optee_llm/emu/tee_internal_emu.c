@@ -0,0 +1,681 @@
+/*
+ * Host-native implementation of the TEE Internal Core API subset declared in
+ * emu/include/tee_internal_api.h.
+ *
+ * All TA entry points are serialized by the emulated client library, so the
+ * state in this file is only ever touched by one thread at a time, exactly
+ * like a TA instance on the device.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef EMU_HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+#include <tee_internal_api.h>
+#include <user_ta_header.h>
+#include <user_ta_header_defines.h>
+
+#define EMU_STORAGE_ENV		"OPTEE_LLM_EMU_STORAGE"
+#define EMU_STORAGE_DEFAULT	"/tmp/optee_llm_emu"
+#define EMU_TRACE_ENV		"OPTEE_LLM_EMU_TRACE"
+
+/*
+ * Every heap block carries its size so that the emulator can hold the TA to
+ * the same TA_DATA_SIZE budget it gets on the device. The header is 16 bytes
+ * to keep the natural malloc alignment.
+ */
+struct emu_heap_hdr {
+	size_t size;
+	size_t pad;
+};
+
+static size_t emu_heap_used;
+
+/* A persistent object is an open file; a transient one (fp NULL) a key. */
+struct __TEE_ObjectHandle {
+	FILE *fp;
+	uint32_t flags;
+	uint32_t type;
+	size_t key_len;
+	uint8_t key[32];
+	char path[];
+};
+
+struct __TEE_OperationHandle {
+	uint32_t mode;
+	size_t key_len;
+	uint8_t key[32];
+	size_t tag_len;
+#ifdef EMU_HAVE_OPENSSL
+	EVP_CIPHER_CTX *ctx;
+#endif
+};
+
+void emu_trace_printf(const char *func, int line, int level,
+		      const char *fmt, ...)
+{
+	static int max_level = -1;
+	static const char tag[] = "-EIDF";
+	va_list ap;
+
+	if (max_level < 0) {
+		const char *env = getenv(EMU_TRACE_ENV);
+
+		max_level = env ? atoi(env) : TRACE_ERROR;
+	}
+	if (level > max_level)
+		return;
+
+	fprintf(stderr, "%c/TA: %s:%d ", tag[level], func, line);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (fmt[0] && fmt[strlen(fmt) - 1] != '\n')
+		fputc('\n', stderr);
+}
+
+void TEE_Panic(TEE_Result panicCode)
+{
+	fprintf(stderr, "TA panicked with code 0x%x\n", panicCode);
+	abort();
+}
+
+void *TEE_Malloc(size_t size, uint32_t hint)
+{
+	struct emu_heap_hdr *hdr;
+
+	if (size > TA_DATA_SIZE - emu_heap_used)
+		return NULL;
+
+	hdr = malloc(sizeof(*hdr) + size);
+	if (!hdr)
+		return NULL;
+	if (hint == TEE_MALLOC_FILL_ZERO)
+		memset(hdr + 1, 0, size);
+
+	hdr->size = size;
+	emu_heap_used += size;
+	return hdr + 1;
+}
+
+void *TEE_Realloc(void *buffer, size_t newSize)
+{
+	struct emu_heap_hdr *hdr;
+	size_t old_size = 0;
+
+	if (buffer) {
+		hdr = (struct emu_heap_hdr *)buffer - 1;
+		old_size = hdr->size;
+	} else {
+		hdr = NULL;
+	}
+
+	if (newSize > old_size &&
+	    newSize - old_size > TA_DATA_SIZE - emu_heap_used)
+		return NULL;
+
+	hdr = realloc(hdr, sizeof(*hdr) + newSize);
+	if (!hdr)
+		return NULL;
+
+	hdr->size = newSize;
+	emu_heap_used = emu_heap_used - old_size + newSize;
+	return hdr + 1;
+}
+
+void TEE_Free(void *buffer)
+{
+	struct emu_heap_hdr *hdr;
+
+	if (!buffer)
+		return;
+
+	hdr = (struct emu_heap_hdr *)buffer - 1;
+	emu_heap_used -= hdr->size;
+	free(hdr);
+}
+
+void *TEE_MemMove(void *dest, const void *src, size_t size)
+{
+	return memmove(dest, src, size);
+}
+
+int32_t TEE_MemCompare(const void *buffer1, const void *buffer2, size_t size)
+{
+	return memcmp(buffer1, buffer2, size);
+}
+
+void *TEE_MemFill(void *buffer, uint32_t x, size_t size)
+{
+	return memset(buffer, (int)x, size);
+}
+
+void TEE_GenerateRandom(void *randomBuffer, size_t randomBufferLen)
+{
+	uint8_t *p = randomBuffer;
+
+	while (randomBufferLen) {
+		ssize_t n = getrandom(p, randomBufferLen, 0);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			TEE_Panic(TEE_ERROR_GENERIC);
+		}
+		p += n;
+		randomBufferLen -= (size_t)n;
+	}
+}
+
+static void emu_clock(clockid_t id, TEE_Time *time)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	time->seconds = (uint32_t)ts.tv_sec;
+	time->millis = (uint32_t)(ts.tv_nsec / 1000000);
+}
+
+void TEE_GetSystemTime(TEE_Time *time)
+{
+	emu_clock(CLOCK_MONOTONIC, time);
+}
+
+void TEE_GetREETime(TEE_Time *time)
+{
+	emu_clock(CLOCK_REALTIME, time);
+}
+
+/*
+ * Persistent objects are plain files in a per-user directory, named after the
+ * hex encoding of the object ID. This is enough to exercise the TA's storage
+ * paths; it makes no attempt at confidentiality.
+ */
+static TEE_Result emu_object_path(const void *objectID, size_t objectIDLen,
+				  char **path)
+{
+	const char *dir = getenv(EMU_STORAGE_ENV);
+	const uint8_t *id = objectID;
+	size_t len;
+	char *p;
+
+	if (!objectID || !objectIDLen || objectIDLen > TEE_OBJECT_ID_MAX_LEN)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (!dir)
+		dir = EMU_STORAGE_DEFAULT;
+	if (mkdir(dir, 0700) && errno != EEXIST)
+		return TEE_ERROR_STORAGE_NOT_AVAILABLE;
+
+	len = strlen(dir) + 1 + objectIDLen * 2 + 1;
+	p = malloc(len);
+	if (!p)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	len = (size_t)sprintf(p, "%s/", dir);
+	for (size_t i = 0; i < objectIDLen; i++)
+		len += (size_t)sprintf(p + len, "%02x", id[i]);
+
+	*path = p;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result emu_object_open(const char *path, const char *mode,
+				  uint32_t flags, TEE_ObjectHandle *object)
+{
+	struct __TEE_ObjectHandle *h;
+	size_t len = strlen(path) + 1;
+
+	h = malloc(sizeof(*h) + len);
+	if (!h)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	h->fp = fopen(path, mode);
+	if (!h->fp) {
+		free(h);
+		return errno == ENOENT ? TEE_ERROR_ITEM_NOT_FOUND :
+					 TEE_ERROR_STORAGE_NOT_AVAILABLE;
+	}
+	h->flags = flags;
+	memcpy(h->path, path, len);
+	*object = h;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_OpenPersistentObject(uint32_t storageID, const void *objectID,
+				    size_t objectIDLen, uint32_t flags,
+				    TEE_ObjectHandle *object)
+{
+	const char *mode = "rb";
+	TEE_Result res;
+	char *path;
+
+	if (storageID != TEE_STORAGE_PRIVATE || !object)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = emu_object_path(objectID, objectIDLen, &path);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (flags & TEE_DATA_FLAG_ACCESS_WRITE)
+		mode = "r+b";
+	res = emu_object_open(path, mode, flags, object);
+	free(path);
+	return res;
+}
+
+TEE_Result TEE_CreatePersistentObject(uint32_t storageID,
+				      const void *objectID,
+				      size_t objectIDLen, uint32_t flags,
+				      TEE_ObjectHandle attributes,
+				      const void *initialData,
+				      size_t initialDataLen,
+				      TEE_ObjectHandle *object)
+{
+	TEE_ObjectHandle h;
+	TEE_Result res;
+	struct stat st;
+	char *path;
+
+	if (storageID != TEE_STORAGE_PRIVATE || attributes)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = emu_object_path(objectID, objectIDLen, &path);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (!(flags & TEE_DATA_FLAG_OVERWRITE) && !stat(path, &st)) {
+		free(path);
+		return TEE_ERROR_ACCESS_CONFLICT;
+	}
+
+	res = emu_object_open(path, "w+b", flags, &h);
+	free(path);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (initialDataLen &&
+	    fwrite(initialData, 1, initialDataLen, h->fp) != initialDataLen) {
+		TEE_CloseAndDeletePersistentObject1(h);
+		return TEE_ERROR_STORAGE_NO_SPACE;
+	}
+
+	if (object)
+		*object = h;
+	else
+		TEE_CloseObject(h);
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_CloseAndDeletePersistentObject1(TEE_ObjectHandle object)
+{
+	if (!object)
+		return TEE_SUCCESS;
+
+	fclose(object->fp);
+	remove(object->path);
+	free(object);
+	return TEE_SUCCESS;
+}
+
+void TEE_CloseObject(TEE_ObjectHandle object)
+{
+	if (!object)
+		return;
+
+	if (!object->fp) {
+		TEE_FreeTransientObject(object);
+		return;
+	}
+	fclose(object->fp);
+	free(object);
+}
+
+TEE_Result TEE_GetObjectInfo1(TEE_ObjectHandle object,
+			      TEE_ObjectInfo *objectInfo)
+{
+	struct stat st;
+
+	if (!object || !objectInfo)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	fflush(object->fp);
+	if (fstat(fileno(object->fp), &st))
+		return TEE_ERROR_CORRUPT_OBJECT;
+
+	memset(objectInfo, 0, sizeof(*objectInfo));
+	objectInfo->dataSize = (size_t)st.st_size;
+	objectInfo->dataPosition = (size_t)ftell(object->fp);
+	objectInfo->handleFlags = object->flags;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_ReadObjectData(TEE_ObjectHandle object, void *buffer,
+			      size_t size, size_t *count)
+{
+	if (!object || !count)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	*count = fread(buffer, 1, size, object->fp);
+	if (*count < size && ferror(object->fp))
+		return TEE_ERROR_CORRUPT_OBJECT;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_WriteObjectData(TEE_ObjectHandle object, const void *buffer,
+			       size_t size)
+{
+	if (!object || !(object->flags & TEE_DATA_FLAG_ACCESS_WRITE))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (fwrite(buffer, 1, size, object->fp) != size)
+		return TEE_ERROR_STORAGE_NO_SPACE;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_SeekObjectData(TEE_ObjectHandle object, intmax_t offset,
+			      TEE_Whence whence)
+{
+	static const int origin[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+
+	if (!object || (unsigned int)whence > TEE_DATA_SEEK_END)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (fseek(object->fp, (long)offset, origin[whence]))
+		return TEE_ERROR_OVERFLOW;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Transient objects hold an AES key and operations an AES-GCM context.
+ * Only what the TA uses is implemented: one key attribute, AE operations
+ * with the whole payload passed to the final call.
+ */
+TEE_Result TEE_AllocateTransientObject(uint32_t objectType,
+				       uint32_t maxObjectSize,
+				       TEE_ObjectHandle *object)
+{
+	struct __TEE_ObjectHandle *h;
+
+	if (!object)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (objectType != TEE_TYPE_AES ||
+	    (maxObjectSize != 128 && maxObjectSize != 192 &&
+	     maxObjectSize != 256))
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	h = calloc(1, sizeof(*h) + 1);
+	if (!h)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	h->type = objectType;
+	*object = h;
+	return TEE_SUCCESS;
+}
+
+void TEE_FreeTransientObject(TEE_ObjectHandle object)
+{
+	if (!object)
+		return;
+
+	memset(object->key, 0, sizeof(object->key));
+	free(object);
+}
+
+void TEE_InitRefAttribute(TEE_Attribute *attr, uint32_t attributeID,
+			  const void *buffer, size_t length)
+{
+	attr->attributeID = attributeID;
+	attr->content.ref.buffer = (void *)buffer;
+	attr->content.ref.length = length;
+}
+
+TEE_Result TEE_PopulateTransientObject(TEE_ObjectHandle object,
+				       const TEE_Attribute *attrs,
+				       uint32_t attrCount)
+{
+	size_t len;
+
+	if (!object || object->fp || attrCount != 1 ||
+	    attrs[0].attributeID != TEE_ATTR_SECRET_VALUE)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	len = attrs[0].content.ref.length;
+	if (len != 16 && len != 24 && len != 32)
+		return TEE_ERROR_BAD_PARAMETERS;
+	memcpy(object->key, attrs[0].content.ref.buffer, len);
+	object->key_len = len;
+	return TEE_SUCCESS;
+}
+
+#ifdef EMU_HAVE_OPENSSL
+static const EVP_CIPHER *emu_gcm_cipher(size_t key_len)
+{
+	switch (key_len) {
+	case 16:
+		return EVP_aes_128_gcm();
+	case 24:
+		return EVP_aes_192_gcm();
+	default:
+		return EVP_aes_256_gcm();
+	}
+}
+
+TEE_Result TEE_AllocateOperation(TEE_OperationHandle *operation,
+				 uint32_t algorithm, uint32_t mode,
+				 uint32_t maxKeySize)
+{
+	struct __TEE_OperationHandle *op;
+
+	(void)maxKeySize;
+	if (!operation)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (algorithm != TEE_ALG_AES_GCM ||
+	    (mode != TEE_MODE_ENCRYPT && mode != TEE_MODE_DECRYPT))
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	op = calloc(1, sizeof(*op));
+	if (!op)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	op->ctx = EVP_CIPHER_CTX_new();
+	if (!op->ctx) {
+		free(op);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+	op->mode = mode;
+	*operation = op;
+	return TEE_SUCCESS;
+}
+
+void TEE_FreeOperation(TEE_OperationHandle operation)
+{
+	if (!operation)
+		return;
+
+	EVP_CIPHER_CTX_free(operation->ctx);
+	memset(operation->key, 0, sizeof(operation->key));
+	free(operation);
+}
+
+TEE_Result TEE_SetOperationKey(TEE_OperationHandle operation,
+			       TEE_ObjectHandle key)
+{
+	if (!operation || !key || key->fp || !key->key_len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	memcpy(operation->key, key->key, key->key_len);
+	operation->key_len = key->key_len;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_AEInit(TEE_OperationHandle operation, const void *nonce,
+		      size_t nonceLen, uint32_t tagLen, size_t AADLen,
+		      size_t payloadLen)
+{
+	const int enc = operation->mode == TEE_MODE_ENCRYPT;
+
+	(void)AADLen;
+	(void)payloadLen;
+	if (!operation->key_len || !nonceLen || tagLen % 8 || tagLen < 96 ||
+	    tagLen > 128)
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	operation->tag_len = tagLen / 8;
+	if (!EVP_CIPHER_CTX_reset(operation->ctx) ||
+	    !EVP_CipherInit_ex(operation->ctx, emu_gcm_cipher(operation->key_len),
+			       NULL, NULL, NULL, enc) ||
+	    !EVP_CIPHER_CTX_ctrl(operation->ctx, EVP_CTRL_GCM_SET_IVLEN,
+				 (int)nonceLen, NULL) ||
+	    !EVP_CipherInit_ex(operation->ctx, NULL, NULL, operation->key,
+			       nonce, enc))
+		return TEE_ERROR_GENERIC;
+	return TEE_SUCCESS;
+}
+
+void TEE_AEUpdateAAD(TEE_OperationHandle operation, const void *AADdata,
+		     size_t AADdataLen)
+{
+	int len;
+
+	if (!EVP_CipherUpdate(operation->ctx, NULL, &len, AADdata,
+			      (int)AADdataLen))
+		TEE_Panic(TEE_ERROR_GENERIC);
+}
+
+TEE_Result TEE_AEEncryptFinal(TEE_OperationHandle operation,
+			      const void *srcData, size_t srcLen,
+			      void *destData, size_t *destLen, void *tag,
+			      size_t *tagLen)
+{
+	int len, fin;
+
+	if (operation->mode != TEE_MODE_ENCRYPT)
+		return TEE_ERROR_BAD_STATE;
+	if (*destLen < srcLen || *tagLen < operation->tag_len) {
+		*destLen = srcLen;
+		*tagLen = operation->tag_len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	if (!EVP_EncryptUpdate(operation->ctx, destData, &len, srcData,
+			       (int)srcLen) ||
+	    !EVP_EncryptFinal_ex(operation->ctx, (uint8_t *)destData + len,
+				 &fin) ||
+	    !EVP_CIPHER_CTX_ctrl(operation->ctx, EVP_CTRL_GCM_GET_TAG,
+				 (int)operation->tag_len, tag))
+		return TEE_ERROR_GENERIC;
+	*destLen = (size_t)len + fin;
+	*tagLen = operation->tag_len;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_AEDecryptFinal(TEE_OperationHandle operation,
+			      const void *srcData, size_t srcLen,
+			      void *destData, size_t *destLen, void *tag,
+			      size_t tagLen)
+{
+	int len, fin;
+
+	if (operation->mode != TEE_MODE_DECRYPT)
+		return TEE_ERROR_BAD_STATE;
+	if (tagLen != operation->tag_len)
+		return TEE_ERROR_MAC_INVALID;
+	if (*destLen < srcLen) {
+		*destLen = srcLen;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	if (!EVP_DecryptUpdate(operation->ctx, destData, &len, srcData,
+			       (int)srcLen) ||
+	    !EVP_CIPHER_CTX_ctrl(operation->ctx, EVP_CTRL_GCM_SET_TAG,
+				 (int)tagLen, tag))
+		return TEE_ERROR_GENERIC;
+	if (EVP_DecryptFinal_ex(operation->ctx, (uint8_t *)destData + len,
+				&fin) <= 0)
+		return TEE_ERROR_MAC_INVALID;
+	*destLen = (size_t)len + fin;
+	return TEE_SUCCESS;
+}
+#else
+TEE_Result TEE_AllocateOperation(TEE_OperationHandle *operation,
+				 uint32_t algorithm, uint32_t mode,
+				 uint32_t maxKeySize)
+{
+	(void)operation;
+	(void)algorithm;
+	(void)mode;
+	(void)maxKeySize;
+	return TEE_ERROR_NOT_SUPPORTED;
+}
+
+void TEE_FreeOperation(TEE_OperationHandle operation)
+{
+	(void)operation;
+}
+
+TEE_Result TEE_SetOperationKey(TEE_OperationHandle operation,
+			       TEE_ObjectHandle key)
+{
+	(void)operation;
+	(void)key;
+	return TEE_ERROR_NOT_SUPPORTED;
+}
+
+TEE_Result TEE_AEInit(TEE_OperationHandle operation, const void *nonce,
+		      size_t nonceLen, uint32_t tagLen, size_t AADLen,
+		      size_t payloadLen)
+{
+	(void)operation;
+	(void)nonce;
+	(void)nonceLen;
+	(void)tagLen;
+	(void)AADLen;
+	(void)payloadLen;
+	return TEE_ERROR_NOT_SUPPORTED;
+}
+
+void TEE_AEUpdateAAD(TEE_OperationHandle operation, const void *AADdata,
+		     size_t AADdataLen)
+{
+	(void)operation;
+	(void)AADdata;
+	(void)AADdataLen;
+}
+
+TEE_Result TEE_AEEncryptFinal(TEE_OperationHandle operation,
+			      const void *srcData, size_t srcLen,
+			      void *destData, size_t *destLen, void *tag,
+			      size_t *tagLen)
+{
+	(void)operation;
+	(void)srcData;
+	(void)srcLen;
+	(void)destData;
+	(void)destLen;
+	(void)tag;
+	(void)tagLen;
+	return TEE_ERROR_NOT_SUPPORTED;
+}
+
+TEE_Result TEE_AEDecryptFinal(TEE_OperationHandle operation,
+			      const void *srcData, size_t srcLen,
+			      void *destData, size_t *destLen, void *tag,
+			      size_t tagLen)
+{
+	(void)operation;
+	(void)srcData;
+	(void)srcLen;
+	(void)destData;
+	(void)destLen;
+	(void)tag;
+	(void)tagLen;
+	return TEE_ERROR_NOT_SUPPORTED;
+}
+#endif /* EMU_HAVE_OPENSSL */
@@ -0,0 +1,535 @@
+/*
+ * Benchmark mode of the optee_llm CLI: sweeps adapter format, rank, tensor
+ * dtype, batch size and sequence length, times each configuration end to
+ * end and as reported by the TA (lora_timing_t), and reports percentiles
+ * and throughput as a table, CSV or JSON.
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <opteellm.h>
+
+#include "bench.h"
+
+#define BENCH_MAX_LIST 16
+
+struct bench_list {
+    uint32_t v[BENCH_MAX_LIST];
+    uint32_t n;
+};
+
+struct bench_opts {
+    struct bench_list format;
+    struct bench_list rank;
+    struct bench_list dtype;
+    struct bench_list batch;
+    struct bench_list seq;
+    uint32_t in_channels;
+    uint32_t out_channels;
+    uint32_t mode;
+    uint32_t warmup;
+    uint32_t iters;
+    const char *csv;
+    const char *json;
+};
+
+// Latency percentiles, in microseconds
+#define BENCH_P50 0
+#define BENCH_P90 1
+#define BENCH_P99 2
+#define BENCH_PCTS 3
+
+static const double pct_rank[BENCH_PCTS] = { 50.0, 90.0, 99.0 };
+static const char *const pct_name[BENCH_PCTS] = { "p50", "p90", "p99" };
+
+struct bench_result {
+    uint32_t format;
+    uint32_t rank;
+    uint32_t dtype;
+    uint32_t batch;
+    uint32_t seq;
+    double e2e_us[BENCH_PCTS];
+    double ta_us[BENCH_PCTS];
+    double phase_us[LORA_PHASE_TOTAL];  // mean per phase
+    double tokens_per_s;
+};
+
+static const char *const format_names[] = { "f32", "q8", "q4" };
+static const char *const dtype_names[] = { "f32", "f16", "bf16" };
+static const char *const mode_names[] = { "mean", "tokens", "last", "max" };
+static const char *const phase_names[LORA_PHASE_TOTAL] = {
+    "lookup", "validate", "reduce", "matmul_b", "matmul_a", "output",
+    "scale", "prefix",
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: optee_llm bench [options]\n"
+            "  -f, --format LIST    weight formats: f32,q8,q4 (f32)\n"
+            "  -r, --rank LIST      adapter ranks (%u)\n"
+            "  -t, --dtype LIST     tensor dtypes: f32,f16,bf16 (f32)\n"
+            "  -b, --batch LIST     batch sizes (1,%u)\n"
+            "  -s, --seq LIST       sequence lengths (1,32,%u)\n"
+            "  -i, --in N           input channels (%u)\n"
+            "  -o, --out N          output channels (%u)\n"
+            "  -m, --mode MODE      mean, tokens, last or max (mean)\n"
+            "  -w, --warmup N       untimed iterations per point (5)\n"
+            "  -n, --iters N        timed iterations per point (50)\n"
+            "      --csv FILE       write CSV results (- for stdout)\n"
+            "      --json FILE      write JSON results (- for stdout)\n",
+            RANK, MAX_BATCH_SIZE, MAX_SEQ_LENGTH, IN_CHANNELS, OUT_CHANNELS);
+}
+
+static uint32_t parse_uint(const char *s, uint32_t min)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+
+    if (*s == '\0' || *end != '\0' || v < min || v > UINT32_MAX)
+        errx(1, "bad number '%s'", s);
+    return v;
+}
+
+static uint32_t parse_name(const char *s, const char *const *names,
+                           uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!strcmp(s, names[i]))
+            return i;
+    }
+    errx(1, "unknown value '%s'", s);
+}
+
+// Parse a comma separated list of numbers, or of names if names is set.
+static void parse_list(const char *arg, struct bench_list *list,
+                       const char *const *names, uint32_t count)
+{
+    char *copy = strdup(arg);
+    char *save = NULL;
+
+    if (!copy)
+        err(1, "strdup");
+    list->n = 0;
+    for (char *tok = strtok_r(copy, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        if (list->n == BENCH_MAX_LIST)
+            errx(1, "more than %d values in '%s'", BENCH_MAX_LIST, arg);
+        list->v[list->n++] = names ? parse_name(tok, names, count) :
+                                     parse_uint(tok, 1);
+    }
+    free(copy);
+    if (!list->n)
+        errx(1, "empty list");
+}
+
+static uint32_t list_max(const struct bench_list *list)
+{
+    uint32_t max = 0;
+
+    for (uint32_t i = 0; i < list->n; i++)
+    {
+        if (list->v[i] > max)
+            max = list->v[i];
+    }
+    return max;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentiles of n samples, sorted in place.
+static void percentiles(double *v, uint32_t n, double out[BENCH_PCTS])
+{
+    qsort(v, n, sizeof(*v), cmp_double);
+    for (uint32_t p = 0; p < BENCH_PCTS; p++)
+    {
+        uint32_t rank = (uint32_t)(pct_rank[p] / 100.0 * n + 0.999999);
+
+        out[p] = v[rank ? rank - 1 : 0];
+    }
+}
+
+// Fill n elements of a dtype tensor with small nonzero values; the kernels'
+// speed does not depend on them, but denormals and NaNs are avoided.
+static void fill_input(void *buf, uint32_t dtype, size_t n)
+{
+    uint32_t seed = 12345;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        switch (dtype)
+        {
+        case LORA_DTYPE_F16:
+            ((uint16_t *)buf)[i] = 0x2000 | (seed >> 20 & 0x0fff);
+            break;
+        case LORA_DTYPE_BF16:
+            ((uint16_t *)buf)[i] = 0x3c00 | (seed >> 23 & 0x01ff);
+            break;
+        default:
+            ((float *)buf)[i] = 0.01f + (seed >> 16 & 0xff) / 2560.0f;
+            break;
+        }
+    }
+}
+
+static TEEC_Result run_point(struct opteellm *ol, const struct bench_opts *o,
+                             const tensor_dims_t *dims, const void *input,
+                             void *output, size_t output_size,
+                             struct bench_result *r)
+{
+    double *e2e = calloc(o->iters, sizeof(*e2e));
+    double *ta = calloc(o->iters, sizeof(*ta));
+    double e2e_sum = 0.0;
+    lora_timing_t timing;
+    TEEC_Result res = TEEC_SUCCESS;
+    uint32_t origin;
+
+    if (!e2e || !ta)
+        err(1, "calloc");
+    memset(r->phase_us, 0, sizeof(r->phase_us));
+
+    for (uint32_t i = 0; i < o->warmup + o->iters && !res; i++)
+    {
+        const uint64_t start = now_ns();
+
+        res = opteellm_infer_timed(ol, dims, input, output, output_size,
+                                   &timing, &origin);
+        if (res != TEEC_SUCCESS || i < o->warmup)
+            continue;
+
+        const uint32_t k = i - o->warmup;
+
+        e2e[k] = (now_ns() - start) / 1000.0;
+        ta[k] = timing.phase_ns[LORA_PHASE_TOTAL] / 1000.0;
+        e2e_sum += e2e[k];
+        for (uint32_t p = 0; p < LORA_PHASE_TOTAL; p++)
+            r->phase_us[p] += timing.phase_ns[p] / 1000.0 / o->iters;
+    }
+    if (res == TEEC_SUCCESS)
+    {
+        percentiles(e2e, o->iters, r->e2e_us);
+        percentiles(ta, o->iters, r->ta_us);
+        r->tokens_per_s = (double)dims->batch_size * dims->seq_length *
+                          o->iters / (e2e_sum / 1e6);
+    }
+    else
+    {
+        warnx("batch %u seq %u failed: 0x%x, origin 0x%x",
+              dims->batch_size, dims->seq_length, res, origin);
+    }
+    free(e2e);
+    free(ta);
+    return res;
+}
+
+static void print_row(const struct bench_result *r)
+{
+    printf("%-4s %4u %-4s %5u %5u | %9.1f %9.1f %9.1f | %9.1f %9.1f %9.1f"
+           " | %12.0f\n",
+           format_names[r->format], r->rank, dtype_names[r->dtype],
+           r->batch, r->seq, r->e2e_us[BENCH_P50], r->e2e_us[BENCH_P90],
+           r->e2e_us[BENCH_P99], r->ta_us[BENCH_P50], r->ta_us[BENCH_P90],
+           r->ta_us[BENCH_P99], r->tokens_per_s);
+}
+
+static FILE *open_output(const char *path)
+{
+    FILE *f;
+
+    if (!strcmp(path, "-"))
+        return stdout;
+    f = fopen(path, "w");
+    if (!f)
+        err(1, "%s", path);
+    return f;
+}
+
+static void close_output(FILE *f)
+{
+    if (f != stdout)
+        fclose(f);
+}
+
+static void write_csv(const char *path, const struct bench_opts *o,
+                      const struct bench_result *res, uint32_t n)
+{
+    FILE *f = open_output(path);
+
+    fprintf(f, "format,rank,dtype,mode,in_channels,out_channels,batch,seq,"
+               "iters");
+    for (uint32_t p = 0; p < BENCH_PCTS; p++)
+        fprintf(f, ",e2e_%s_us", pct_name[p]);
+    for (uint32_t p = 0; p < BENCH_PCTS; p++)
+        fprintf(f, ",ta_%s_us", pct_name[p]);
+    for (uint32_t p = 0; p < LORA_PHASE_TOTAL; p++)
+        fprintf(f, ",ta_%s_mean_us", phase_names[p]);
+    fprintf(f, ",tokens_per_s\n");
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const struct bench_result *r = &res[i];
+
+        fprintf(f, "%s,%u,%s,%s,%u,%u,%u,%u,%u", format_names[r->format],
+                r->rank, dtype_names[r->dtype], mode_names[o->mode],
+                o->in_channels, o->out_channels, r->batch, r->seq, o->iters);
+        for (uint32_t p = 0; p < BENCH_PCTS; p++)
+            fprintf(f, ",%.3f", r->e2e_us[p]);
+        for (uint32_t p = 0; p < BENCH_PCTS; p++)
+            fprintf(f, ",%.3f", r->ta_us[p]);
+        for (uint32_t p = 0; p < LORA_PHASE_TOTAL; p++)
+            fprintf(f, ",%.3f", r->phase_us[p]);
+        fprintf(f, ",%.1f\n", r->tokens_per_s);
+    }
+    close_output(f);
+}
+
+static void write_json(const char *path, const struct bench_opts *o,
+                       const struct bench_result *res, uint32_t n)
+{
+    FILE *f = open_output(path);
+
+    fprintf(f, "{\n  \"mode\": \"%s\",\n  \"in_channels\": %u,\n"
+               "  \"out_channels\": %u,\n  \"warmup\": %u,\n"
+               "  \"iters\": %u,\n  \"results\": [",
+            mode_names[o->mode], o->in_channels, o->out_channels,
+            o->warmup, o->iters);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const struct bench_result *r = &res[i];
+
+        fprintf(f, "%s\n    {\"format\": \"%s\", \"rank\": %u, "
+                   "\"dtype\": \"%s\", \"batch\": %u, \"seq\": %u,\n",
+                i ? "," : "", format_names[r->format], r->rank,
+                dtype_names[r->dtype], r->batch, r->seq);
+        fprintf(f, "     \"e2e_us\": {");
+        for (uint32_t p = 0; p < BENCH_PCTS; p++)
+            fprintf(f, "%s\"%s\": %.3f", p ? ", " : "", pct_name[p],
+                    r->e2e_us[p]);
+        fprintf(f, "},\n     \"ta_us\": {");
+        for (uint32_t p = 0; p < BENCH_PCTS; p++)
+            fprintf(f, "%s\"%s\": %.3f", p ? ", " : "", pct_name[p],
+                    r->ta_us[p]);
+        fprintf(f, "},\n     \"ta_phase_mean_us\": {");
+        for (uint32_t p = 0; p < LORA_PHASE_TOTAL; p++)
+            fprintf(f, "%s\"%s\": %.3f", p ? ", " : "", phase_names[p],
+                    r->phase_us[p]);
+        fprintf(f, "},\n     \"tokens_per_s\": %.1f}", r->tokens_per_s);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    close_output(f);
+}
+
+int bench_main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "format", required_argument, NULL, 'f' },
+        { "rank", required_argument, NULL, 'r' },
+        { "dtype", required_argument, NULL, 't' },
+        { "batch", required_argument, NULL, 'b' },
+        { "seq", required_argument, NULL, 's' },
+        { "in", required_argument, NULL, 'i' },
+        { "out", required_argument, NULL, 'o' },
+        { "mode", required_argument, NULL, 'm' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "iters", required_argument, NULL, 'n' },
+        { "csv", required_argument, NULL, 'C' },
+        { "json", required_argument, NULL, 'J' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct bench_opts o = {
+        .format = { { LORA_FMT_F32 }, 1 },
+        .rank = { { RANK }, 1 },
+        .dtype = { { LORA_DTYPE_F32 }, 1 },
+        .batch = { { 1, MAX_BATCH_SIZE }, 2 },
+        .seq = { { 1, 32, MAX_SEQ_LENGTH }, 3 },
+        .in_channels = IN_CHANNELS,
+        .out_channels = OUT_CHANNELS,
+        .mode = LORA_OUT_MEAN,
+        .warmup = 5,
+        .iters = 50,
+    };
+    struct bench_result *results;
+    struct opteellm *ol;
+    uint32_t count = 0;
+    int failed = 0;
+    TEEC_Result res;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "f:r:t:b:s:i:o:m:w:n:h", long_opts,
+                            NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'f':
+            parse_list(optarg, &o.format, format_names,
+                       ARRAY_SIZE(format_names));
+            break;
+        case 'r':
+            parse_list(optarg, &o.rank, NULL, 0);
+            break;
+        case 't':
+            parse_list(optarg, &o.dtype, dtype_names,
+                       ARRAY_SIZE(dtype_names));
+            break;
+        case 'b':
+            parse_list(optarg, &o.batch, NULL, 0);
+            break;
+        case 's':
+            parse_list(optarg, &o.seq, NULL, 0);
+            break;
+        case 'i':
+            o.in_channels = parse_uint(optarg, 1);
+            break;
+        case 'o':
+            o.out_channels = parse_uint(optarg, 1);
+            break;
+        case 'm':
+            o.mode = parse_name(optarg, mode_names, ARRAY_SIZE(mode_names));
+            break;
+        case 'w':
+            o.warmup = parse_uint(optarg, 0);
+            break;
+        case 'n':
+            o.iters = parse_uint(optarg, 1);
+            break;
+        case 'C':
+            o.csv = optarg;
+            break;
+        case 'J':
+            o.json = optarg;
+            break;
+        default:
+            usage();
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc)
+    {
+        usage();
+        return 1;
+    }
+
+    const uint32_t max_batch = list_max(&o.batch);
+    const uint32_t max_seq = list_max(&o.seq);
+    const uint32_t out_rows = o.mode == LORA_OUT_TOKENS ? max_seq : 1;
+    const size_t input_size = (size_t)max_batch * max_seq * o.in_channels *
+                              sizeof(float);
+    const size_t output_size = (size_t)max_batch * out_rows *
+                               o.out_channels * sizeof(float);
+    void *input = malloc(input_size);
+    void *output = malloc(output_size);
+
+    results = calloc((size_t)o.format.n * o.rank.n * o.dtype.n * o.batch.n *
+                     o.seq.n, sizeof(*results));
+    if (!input || !output || !results)
+        err(1, "malloc");
+
+    res = opteellm_open(&ol);
+    if (res != TEEC_SUCCESS)
+        errx(1, "opteellm_open failed with code 0x%x", res);
+
+    printf("mode %s, in %u, out %u, %u warm-up and %u timed iterations\n",
+           mode_names[o.mode], o.in_channels, o.out_channels, o.warmup,
+           o.iters);
+    printf("fmt  rank type batch   seq |   e2e p50       p90       p99 |"
+           "    TA p50       p90       p99 |     tokens/s\n");
+
+    for (uint32_t fi = 0; fi < o.format.n; fi++)
+    {
+        for (uint32_t ri = 0; ri < o.rank.n; ri++)
+        {
+            const lora_adapter_desc_t desc = {
+                .format = o.format.v[fi],
+                .in_channels = o.in_channels,
+                .out_channels = o.out_channels,
+                .rank = o.rank.v[ri],
+                .max_batch_size = max_batch,
+                .max_seq_length = max_seq,
+            };
+
+            // Random placeholder weights: the timing does not depend on
+            // their values.
+            res = opteellm_load_adapter(ol, 0, LORA_WEIGHTS_RANDOM, 0, &desc,
+                                        NULL, 0);
+            if (res != TEEC_SUCCESS)
+            {
+                warnx("%s rank %u: load failed with 0x%x, skipped",
+                      format_names[desc.format], desc.rank, res);
+                failed = 1;
+                continue;
+            }
+
+            for (uint32_t ti = 0; ti < o.dtype.n; ti++)
+            {
+                const uint32_t dtype = o.dtype.v[ti];
+
+                fill_input(input, dtype, input_size / sizeof(float));
+
+                for (uint32_t bi = 0; bi < o.batch.n; bi++)
+                {
+                    for (uint32_t si = 0; si < o.seq.n; si++)
+                    {
+                        const tensor_dims_t dims = {
+                            .batch_size = o.batch.v[bi],
+                            .seq_length = o.seq.v[si],
+                            .in_channels = o.in_channels,
+                            .output_mode = o.mode,
+                            .input_dtype = dtype,
+                            .output_dtype = dtype,
+                        };
+                        struct bench_result *r = &results[count];
+
+                        r->format = desc.format;
+                        r->rank = desc.rank;
+                        r->dtype = dtype;
+                        r->batch = dims.batch_size;
+                        r->seq = dims.seq_length;
+                        if (run_point(ol, &o, &dims, input, output,
+                                      output_size, r) != TEEC_SUCCESS)
+                        {
+                            failed = 1;
+                            continue;
+                        }
+                        print_row(r);
+                        count++;
+                    }
+                }
+            }
+        }
+    }
+    opteellm_close(ol);
+
+    if (o.csv)
+        write_csv(o.csv, &o, results, count);
+    if (o.json)
+        write_json(o.json, &o, results, count);
+
+    free(results);
+    free(input);
+    free(output);
+    return failed;
+}
@@ -0,0 +1,11 @@
+/*
+ * Benchmark mode of the optee_llm CLI ("optee_llm bench").
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// argv[0] is "bench"; returns the process exit status.
+int bench_main(int argc, char **argv);
+
+#endif /* BENCH_H */
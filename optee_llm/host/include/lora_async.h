@@ -0,0 +1,85 @@
+/*
+ * Asynchronous LoRA inference client.
+ *
+ * A pool of worker threads, each owning one session to the TA, serves a
+ * queue of requests. Every request slot owns a pre-allocated input/output
+ * pair of shared memory, so the caller can fill the input of the next batch
+ * directly in shared memory while earlier batches are being computed:
+ *
+ *   req = lora_async_acquire(la);      // blocks until a slot is free
+ *   fill req->input, set req->dims;
+ *   lora_async_submit(la, req);
+ *   ...
+ *   req = lora_async_wait(la);         // or lora_async_poll()
+ *   read req->result and req->output;
+ *   lora_async_release(la, req);
+ *
+ * Completions are returned in the order they finish, which with several
+ * workers need not be the submission order; req->seq and req->user identify
+ * them.
+ */
+
+#ifndef LORA_ASYNC_H
+#define LORA_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <tee_client_api.h>
+#include <optee_llm_ta.h>
+
+struct lora_async_config {
+    uint32_t workers;           // sessions / threads, at least 1
+    uint32_t slots_per_worker;  // input/output pairs per worker, at least 2
+    size_t input_size;          // bytes of each input buffer
+    size_t output_size;         // bytes of each output buffer
+    // Called once for each worker session before it serves requests, e.g.
+    // to load adapters into its registry. May be NULL.
+    TEEC_Result (*session_init)(TEEC_Session *session, void *arg);
+    void *session_init_arg;
+};
+
+struct lora_async_req {
+    // Filled by the caller before lora_async_submit()
+    void *input;                // input_size bytes of shared memory
+    tensor_dims_t dims;
+    void *user;                 // opaque caller cookie
+
+    // Valid after the request is returned by poll/wait
+    void *output;               // output_size bytes of shared memory
+    TEEC_Result result;
+    uint32_t origin;
+    uint64_t seq;               // submission number, from 0
+
+    // Owned by lora_async
+    TEEC_SharedMemory input_shm;
+    TEEC_SharedMemory output_shm;
+    struct lora_async_req *next;
+};
+
+struct lora_async;
+
+// Open cfg->workers sessions on ctx and allocate their shared memory.
+TEEC_Result lora_async_open(TEEC_Context *ctx,
+                            const struct lora_async_config *cfg,
+                            struct lora_async **la);
+// Finish all submitted requests, then close the sessions and free
+// everything, including requests that were never released.
+void lora_async_close(struct lora_async *la);
+
+// Take a free request slot, blocking while requests are in flight. Returns
+// NULL if no slot is free and none is in flight: completed requests must be
+// collected and released first.
+struct lora_async_req *lora_async_acquire(struct lora_async *la);
+// Queue an acquired request for inference. Requests with LORA_FLAG_RAGGED
+// or LORA_FLAG_PREFIX are not supported here and complete at once with
+// TEEC_ERROR_NOT_SUPPORTED; use opteellm_infer_ragged()/_prefix() instead.
+void lora_async_submit(struct lora_async *la, struct lora_async_req *req);
+// Return a completed request, or NULL if none has completed yet.
+struct lora_async_req *lora_async_poll(struct lora_async *la);
+// Return a completed request, blocking until one completes. Returns NULL if
+// nothing is in flight.
+struct lora_async_req *lora_async_wait(struct lora_async *la);
+// Hand a completed request slot back for reuse.
+void lora_async_release(struct lora_async *la, struct lora_async_req *req);
+
+#endif /* LORA_ASYNC_H */
@@ -0,0 +1,59 @@
+/*
+ * Sharded LoRA inference client.
+ *
+ * An OP-TEE TA instance serves one invocation at a time, so a single
+ * session computes on one core however large the batch is. The optee_llm
+ * TA is not TA_FLAG_SINGLE_INSTANCE, so every session is its own instance
+ * and sessions run in parallel. lora_shard opens several sessions, each
+ * driven by its own worker thread (optionally pinned to a core; the secure
+ * world runs on the core that issues the call), and splits each request
+ * across them:
+ *
+ *  - by sample: each session gets a contiguous range of the batch;
+ *  - by token chunk, when the batch is smaller than the number of sessions
+ *    and the sequences are long: each session gets part of a sample's
+ *    sequence. LORA_OUT_TOKENS rows are written in place; LORA_OUT_MEAN
+ *    and LORA_OUT_MAX chunk results are merged on the host, which is exact
+ *    up to rounding since the LoRA branch is linear. Chunking these two
+ *    modes needs LORA_DTYPE_F32 output, so the merge is not rounded twice.
+ *
+ * The caller's tensors are registered as shared memory once per request and
+ * each shard reads and writes its slice in place.
+ */
+
+#ifndef LORA_SHARD_H
+#define LORA_SHARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tee_client_api.h>
+#include <optee_llm_ta.h>
+
+struct lora_shard_config {
+    uint32_t sessions;          // sessions / worker threads, at least 1
+    bool pin;                   // pin worker i to CPU i modulo the CPU count
+    uint32_t min_chunk_tokens;  // shortest token chunk; 0 for 32
+    // Called once for each session before it serves requests, e.g. to
+    // load the adapters every shard needs. May be NULL.
+    TEEC_Result (*session_init)(TEEC_Session *session, void *arg);
+    void *session_init_arg;
+};
+
+struct lora_shard;
+
+TEEC_Result lora_shard_open(TEEC_Context *ctx,
+                            const struct lora_shard_config *cfg,
+                            struct lora_shard **ls);
+void lora_shard_close(struct lora_shard *ls);
+
+// Run one request across the sessions. input and output are laid out as
+// for TA_OPTEE_LLM_CMD_LORA; out_channels is the adapter's output width.
+// LORA_FLAG_RAGGED and LORA_FLAG_PREFIX are not supported.
+// Thread safe; concurrent requests are served one after another.
+TEEC_Result lora_shard_infer(struct lora_shard *ls, const tensor_dims_t *dims,
+                             uint32_t out_channels, const void *input,
+                             void *output, size_t output_size,
+                             uint32_t *origin);
+
+#endif /* LORA_SHARD_H */
@@ -0,0 +1,159 @@
+/*
+ * libopteellm: client library for the optee_llm TA.
+ *
+ * A struct opteellm holds a long-lived TEE context and session, so a
+ * service pays for TEEC_InitializeContext()/TEEC_OpenSession() once rather
+ * than per request. Requests can be made two ways:
+ *
+ *  - opteellm_infer() takes the caller's own tensors and registers them
+ *    with TEEC_RegisterSharedMemory() for the duration of the call, so the
+ *    tensors are not copied into separate shared buffers.
+ *  - opteellm_infer_shm() takes buffers from the shared-memory pool
+ *    (opteellm_shm_get()), which callers can fill in place and reuse.
+ *
+ * Pool buffers are grouped in power-of-two size classes and kept for reuse
+ * when put back, so steady-state requests allocate no shared memory.
+ * All functions are thread safe; invocations on the one session are
+ * serialized by the TA.
+ */
+
+#ifndef OPTEELLM_H
+#define OPTEELLM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <tee_client_api.h>
+#include <optee_llm_ta.h>
+
+struct opteellm;
+
+// Open a TEE context and a session to the optee_llm TA.
+TEEC_Result opteellm_open(struct opteellm **ol);
+// Close the session and context and free the pool.
+void opteellm_close(struct opteellm *ol);
+
+TEEC_Context *opteellm_context(struct opteellm *ol);
+TEEC_Session *opteellm_session(struct opteellm *ol);
+
+// Load an adapter into the session's registry (TA_OPTEE_LLM_CMD_LORA_LOAD).
+// desc may be NULL for the default shape; weights/size are only used with
+// LORA_WEIGHTS_MEMREF.
+TEEC_Result opteellm_load_adapter(struct opteellm *ol, uint32_t adapter_id,
+                                  uint32_t source, uint32_t flags,
+                                  const lora_adapter_desc_t *desc,
+                                  const void *weights, size_t size);
+
+// Install or rotate the AES-256 key sealed adapters are decrypted with
+// (TA_OPTEE_LLM_CMD_LORA_UPLOAD_KEY). The key arrives wrapped, under the
+// TA's provisioning key or the current upload key (see lora_key_wrap_t),
+// and only the TA sees it in the clear.
+TEEC_Result opteellm_set_upload_key(struct opteellm *ol,
+                                    const lora_key_wrap_t *wrap);
+// Upload a sealed adapter blob (see lora_sealed_hdr_t) as adapter_id,
+// chunk by chunk. flags are LORA_LOAD_* flags. The blob is registered as
+// shared memory once and each chunk is passed by offset, so it is not
+// copied on the way in.
+TEEC_Result opteellm_upload_adapter(struct opteellm *ol, uint32_t adapter_id,
+                                    uint32_t flags, const void *blob,
+                                    size_t size, uint32_t *origin);
+
+// Take a pooled shared buffer of at least size bytes, usable for input and
+// output. The buffer's size field holds the requested size.
+TEEC_Result opteellm_shm_get(struct opteellm *ol, size_t size,
+                             TEEC_SharedMemory **shm);
+// Return a buffer taken with opteellm_shm_get() to the pool.
+void opteellm_shm_put(struct opteellm *ol, TEEC_SharedMemory *shm);
+
+// Run inference on caller memory: input holds the
+// [batch_size][seq_length][in_channels] tensor of dims->input_dtype described
+// by dims and output receives output_size bytes at most.
+TEEC_Result opteellm_infer(struct opteellm *ol, const tensor_dims_t *dims,
+                           const void *input, void *output,
+                           size_t output_size, uint32_t *origin);
+// opteellm_infer() that also returns the TA's phase timing of the request.
+TEEC_Result opteellm_infer_timed(struct opteellm *ol,
+                                 const tensor_dims_t *dims,
+                                 const void *input, void *output,
+                                 size_t output_size, lora_timing_t *timing,
+                                 uint32_t *origin);
+// Run inference on a ragged batch (LORA_FLAG_RAGGED): offsets holds
+// dims->batch_size + 1 token offsets into the packed input, and
+// dims->seq_length is ignored.
+TEEC_Result opteellm_infer_ragged(struct opteellm *ol,
+                                  const tensor_dims_t *dims,
+                                  const uint32_t *offsets,
+                                  const void *input, void *output,
+                                  size_t output_size, uint32_t *origin);
+// Run inference on a batch whose samples all start with the same prompt
+// prefix (LORA_FLAG_PREFIX). The TA projects the prefix once for the batch
+// and keeps its state for later requests with the same prefix->hash.
+// offsets are token offsets as for opteellm_infer_ragged(), or NULL for a
+// dense batch.
+TEEC_Result opteellm_infer_prefix(struct opteellm *ol,
+                                  const tensor_dims_t *dims,
+                                  const uint32_t *offsets,
+                                  const lora_prefix_t *prefix,
+                                  const void *input, void *output,
+                                  size_t output_size, uint32_t *origin);
+// Run inference on shared buffers, e.g. from opteellm_shm_get().
+TEEC_Result opteellm_infer_shm(struct opteellm *ol, const tensor_dims_t *dims,
+                               TEEC_SharedMemory *input,
+                               TEEC_SharedMemory *output, uint32_t *origin);
+
+// Apply a table of adapters in one invocation
+// (TA_OPTEE_LLM_CMD_LORA_MULTI): hdr->count entries, each reading
+// hdr->tokens rows at its input_offset in input and writing, or with
+// LORA_ENTRY_ADD adding to, its delta at its output_offset in output.
+TEEC_Result opteellm_infer_multi(struct opteellm *ol,
+                                 const lora_multi_hdr_t *hdr,
+                                 const lora_multi_entry_t *entries,
+                                 const void *input, size_t input_size,
+                                 void *output, size_t output_size,
+                                 uint32_t *origin);
+
+// A request ring (TA_OPTEE_LLM_CMD_LORA_RING_DRAIN): one long-lived shared
+// buffer that queues requests until opteellm_ring_drain() serves all of
+// them in one invocation. Push and drain on one ring are serialized.
+struct opteellm_ring;
+
+// Create a ring of slots requests (1 to LORA_RING_MAX_SLOTS) and data_size
+// bytes for their dims and tensors.
+TEEC_Result opteellm_ring_create(struct opteellm *ol, uint32_t slots,
+                                 size_t data_size,
+                                 struct opteellm_ring **ring);
+void opteellm_ring_destroy(struct opteellm_ring *ring);
+// Queue a request. dims is dims_size bytes laid out as for the TA,
+// including any ragged offsets and lora_prefix_t after it; dims and input
+// are copied into the ring now. The next drain writes at most output_size
+// bytes to output and the request's result to *status. Returns
+// TEEC_ERROR_BUSY when the ring has no free slot or space left; drain it
+// and push again. A request too large for an empty ring fails with
+// TEEC_ERROR_SHORT_BUFFER.
+TEEC_Result opteellm_ring_push(struct opteellm_ring *ring,
+                               const tensor_dims_t *dims, size_t dims_size,
+                               const void *input, void *output,
+                               size_t output_size, TEEC_Result *status);
+// Serve every queued request in one invocation. *served (unless NULL) is
+// the number served, failed ones included.
+TEEC_Result opteellm_ring_drain(struct opteellm_ring *ring, uint32_t *served,
+                                uint32_t *origin);
+
+// Run one fine-tuning step (TA_OPTEE_LLM_CMD_LORA_TRAIN) on the resident
+// adapter step->adapter_id: input is [step->tokens][in_channels] and grad
+// the [step->tokens][out_channels] gradient of the loss with respect to
+// each token's delta.
+TEEC_Result opteellm_train(struct opteellm *ol, const lora_train_step_t *step,
+                           const void *input, size_t input_size,
+                           const void *grad, size_t grad_size,
+                           uint32_t *origin);
+
+// Read the session's prefix cache counters.
+TEEC_Result opteellm_prefix_stats(struct opteellm *ol,
+                                  lora_prefix_stats_t *stats);
+
+// Read the TA's request counters into stats (unless NULL), then apply the
+// LORA_STATS_* operations in ops.
+TEEC_Result opteellm_stats(struct opteellm *ol, uint32_t ops,
+                           lora_stats_t *stats);
+
+#endif /* OPTEELLM_H */
@@ -0,0 +1,325 @@
+/*
+ * Asynchronous LoRA inference client: worker threads with one TA session
+ * each, serving a FIFO of requests whose buffers live in pre-allocated
+ * shared memory.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lora_async.h>
+
+struct lora_queue {
+    struct lora_async_req *head;
+    struct lora_async_req *tail;
+};
+
+struct lora_worker {
+    struct lora_async *la;
+    pthread_t thread;
+    TEEC_Session session;
+    bool session_open;
+    bool thread_started;
+};
+
+struct lora_async {
+    TEEC_Context *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t free_cond;       // a slot was released or completed
+    pthread_cond_t submit_cond;     // a request was submitted, or stop
+    pthread_cond_t done_cond;       // a request completed
+    struct lora_queue free;
+    struct lora_queue submitted;
+    struct lora_queue done;
+    uint32_t in_flight;             // submitted but not yet completed
+    uint64_t next_seq;
+    bool stop;
+
+    uint32_t num_workers;
+    struct lora_worker *workers;
+    uint32_t num_slots;
+    struct lora_async_req *slots;
+};
+
+static void queue_push(struct lora_queue *q, struct lora_async_req *req)
+{
+    req->next = NULL;
+    if (q->tail)
+        q->tail->next = req;
+    else
+        q->head = req;
+    q->tail = req;
+}
+
+static struct lora_async_req *queue_pop(struct lora_queue *q)
+{
+    struct lora_async_req *req = q->head;
+
+    if (req)
+    {
+        q->head = req->next;
+        if (!q->head)
+            q->tail = NULL;
+    }
+    return req;
+}
+
+static void run_request(struct lora_worker *w, struct lora_async_req *req)
+{
+    const tensor_dims_t *dims = &req->dims;
+    TEEC_Operation op;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+                                     TEEC_MEMREF_WHOLE,
+                                     TEEC_MEMREF_TEMP_INPUT,
+                                     TEEC_NONE);
+    // Only pass the part of the input the dimensions cover.
+    op.params[0].memref.parent = &req->input_shm;
+    op.params[0].memref.size = (size_t)dims->batch_size * dims->seq_length *
+                               dims->in_channels *
+                               lora_dtype_size(dims->input_dtype);
+    op.params[1].memref.parent = &req->output_shm;
+    op.params[2].tmpref.buffer = &req->dims;
+    op.params[2].tmpref.size = sizeof(req->dims);
+
+    if (op.params[0].memref.size > req->input_shm.size)
+    {
+        req->result = TEEC_ERROR_BAD_PARAMETERS;
+        req->origin = TEEC_ORIGIN_API;
+        return;
+    }
+    req->result = TEEC_InvokeCommand(&w->session, TA_OPTEE_LLM_CMD_LORA,
+                                     &op, &req->origin);
+}
+
+static void *worker_main(void *arg)
+{
+    struct lora_worker *w = arg;
+    struct lora_async *la = w->la;
+    struct lora_async_req *req;
+
+    pthread_mutex_lock(&la->lock);
+    for (;;)
+    {
+        while (!la->submitted.head && !la->stop)
+            pthread_cond_wait(&la->submit_cond, &la->lock);
+        req = queue_pop(&la->submitted);
+        if (!req)
+            break;  // stopping and the queue is drained
+        pthread_mutex_unlock(&la->lock);
+
+        run_request(w, req);
+
+        pthread_mutex_lock(&la->lock);
+        queue_push(&la->done, req);
+        la->in_flight--;
+        pthread_cond_signal(&la->done_cond);
+        pthread_cond_broadcast(&la->free_cond);
+    }
+    pthread_mutex_unlock(&la->lock);
+    return NULL;
+}
+
+static TEEC_Result alloc_slot(struct lora_async *la,
+                              const struct lora_async_config *cfg,
+                              struct lora_async_req *req)
+{
+    TEEC_Result res;
+
+    req->input_shm.size = cfg->input_size;
+    req->input_shm.flags = TEEC_MEM_INPUT;
+    res = TEEC_AllocateSharedMemory(la->ctx, &req->input_shm);
+    if (res != TEEC_SUCCESS)
+        return res;
+
+    req->output_shm.size = cfg->output_size;
+    req->output_shm.flags = TEEC_MEM_OUTPUT;
+    res = TEEC_AllocateSharedMemory(la->ctx, &req->output_shm);
+    if (res != TEEC_SUCCESS)
+    {
+        TEEC_ReleaseSharedMemory(&req->input_shm);
+        req->input_shm.buffer = NULL;
+        return res;
+    }
+
+    req->input = req->input_shm.buffer;
+    req->output = req->output_shm.buffer;
+    return TEEC_SUCCESS;
+}
+
+TEEC_Result lora_async_open(TEEC_Context *ctx,
+                            const struct lora_async_config *cfg,
+                            struct lora_async **out)
+{
+    TEEC_UUID uuid = TA_OPTEE_LLM_UUID;
+    struct lora_async *la;
+    TEEC_Result res = TEEC_SUCCESS;
+    uint32_t err_origin;
+
+    if (!cfg->workers || cfg->slots_per_worker < 2 ||
+        !cfg->input_size || !cfg->output_size)
+        return TEEC_ERROR_BAD_PARAMETERS;
+
+    la = calloc(1, sizeof(*la));
+    if (!la)
+        return TEEC_ERROR_OUT_OF_MEMORY;
+    la->ctx = ctx;
+    pthread_mutex_init(&la->lock, NULL);
+    pthread_cond_init(&la->free_cond, NULL);
+    pthread_cond_init(&la->submit_cond, NULL);
+    pthread_cond_init(&la->done_cond, NULL);
+
+    la->num_workers = cfg->workers;
+    la->num_slots = cfg->workers * cfg->slots_per_worker;
+    la->workers = calloc(la->num_workers, sizeof(*la->workers));
+    la->slots = calloc(la->num_slots, sizeof(*la->slots));
+    if (!la->workers || !la->slots)
+    {
+        res = TEEC_ERROR_OUT_OF_MEMORY;
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < la->num_slots; i++)
+    {
+        res = alloc_slot(la, cfg, &la->slots[i]);
+        if (res != TEEC_SUCCESS)
+            goto err;
+        queue_push(&la->free, &la->slots[i]);
+    }
+
+    for (uint32_t i = 0; i < la->num_workers; i++)
+    {
+        struct lora_worker *w = &la->workers[i];
+
+        w->la = la;
+        res = TEEC_OpenSession(ctx, &w->session, &uuid, TEEC_LOGIN_PUBLIC,
+                               NULL, NULL, &err_origin);
+        if (res != TEEC_SUCCESS)
+            goto err;
+        w->session_open = true;
+
+        if (cfg->session_init)
+        {
+            res = cfg->session_init(&w->session, cfg->session_init_arg);
+            if (res != TEEC_SUCCESS)
+                goto err;
+        }
+
+        if (pthread_create(&w->thread, NULL, worker_main, w))
+        {
+            res = TEEC_ERROR_GENERIC;
+            goto err;
+        }
+        w->thread_started = true;
+    }
+
+    *out = la;
+    return TEEC_SUCCESS;
+
+err:
+    lora_async_close(la);
+    return res;
+}
+
+void lora_async_close(struct lora_async *la)
+{
+    pthread_mutex_lock(&la->lock);
+    la->stop = true;
+    pthread_cond_broadcast(&la->submit_cond);
+    pthread_mutex_unlock(&la->lock);
+
+    for (uint32_t i = 0; la->workers && i < la->num_workers; i++)
+    {
+        struct lora_worker *w = &la->workers[i];
+
+        if (w->thread_started)
+            pthread_join(w->thread, NULL);
+        if (w->session_open)
+            TEEC_CloseSession(&w->session);
+    }
+
+    for (uint32_t i = 0; la->slots && i < la->num_slots; i++)
+    {
+        if (la->slots[i].input_shm.buffer)
+            TEEC_ReleaseSharedMemory(&la->slots[i].input_shm);
+        if (la->slots[i].output_shm.buffer)
+            TEEC_ReleaseSharedMemory(&la->slots[i].output_shm);
+    }
+
+    pthread_cond_destroy(&la->done_cond);
+    pthread_cond_destroy(&la->submit_cond);
+    pthread_cond_destroy(&la->free_cond);
+    pthread_mutex_destroy(&la->lock);
+    free(la->slots);
+    free(la->workers);
+    free(la);
+}
+
+struct lora_async_req *lora_async_acquire(struct lora_async *la)
+{
+    struct lora_async_req *req;
+
+    pthread_mutex_lock(&la->lock);
+    // Once nothing is in flight, only the caller can free a slot.
+    while (!la->free.head && la->in_flight)
+        pthread_cond_wait(&la->free_cond, &la->lock);
+    req = queue_pop(&la->free);
+    pthread_mutex_unlock(&la->lock);
+    return req;
+}
+
+void lora_async_submit(struct lora_async *la, struct lora_async_req *req)
+{
+    pthread_mutex_lock(&la->lock);
+    req->seq = la->next_seq++;
+    // Ragged and prefixed requests need offsets or a prefix after the
+    // dims and a differently sized input, which run_request() does not
+    // build: complete them at once rather than send them malformed.
+    if (req->dims.flags & (LORA_FLAG_RAGGED | LORA_FLAG_PREFIX))
+    {
+        req->result = TEEC_ERROR_NOT_SUPPORTED;
+        req->origin = TEEC_ORIGIN_API;
+        queue_push(&la->done, req);
+        pthread_cond_signal(&la->done_cond);
+    }
+    else
+    {
+        req->result = TEEC_ERROR_BUSY;
+        queue_push(&la->submitted, req);
+        la->in_flight++;
+        pthread_cond_signal(&la->submit_cond);
+    }
+    pthread_mutex_unlock(&la->lock);
+}
+
+struct lora_async_req *lora_async_poll(struct lora_async *la)
+{
+    struct lora_async_req *req;
+
+    pthread_mutex_lock(&la->lock);
+    req = queue_pop(&la->done);
+    pthread_mutex_unlock(&la->lock);
+    return req;
+}
+
+struct lora_async_req *lora_async_wait(struct lora_async *la)
+{
+    struct lora_async_req *req;
+
+    pthread_mutex_lock(&la->lock);
+    while (!la->done.head && la->in_flight)
+        pthread_cond_wait(&la->done_cond, &la->lock);
+    req = queue_pop(&la->done);
+    pthread_mutex_unlock(&la->lock);
+    return req;
+}
+
+void lora_async_release(struct lora_async *la, struct lora_async_req *req)
+{
+    pthread_mutex_lock(&la->lock);
+    queue_push(&la->free, req);
+    pthread_cond_signal(&la->free_cond);
+    pthread_mutex_unlock(&la->lock);
+}
@@ -0,0 +1,464 @@
+/*
+ * Sharded LoRA inference client: one TA session and worker thread per
+ * shard, each running its slice of a request in parallel.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <lora_shard.h>
+
+#define DEFAULT_MIN_CHUNK_TOKENS 32
+
+// One shard of a request: a TA_OPTEE_LLM_CMD_LORA invocation on a slice of
+// the caller's tensors.
+struct shard_job {
+    tensor_dims_t dims;
+    size_t in_offset;           // bytes into the request input
+    size_t out_offset;          // bytes into the request output, or
+    float *partial;             // out_channels floats merged afterwards
+    size_t out_size;
+};
+
+struct lora_shard_worker {
+    struct lora_shard *ls;
+    uint32_t index;
+    pthread_t thread;
+    bool thread_started;
+    TEEC_Session session;
+    bool session_open;
+    uint64_t generation;        // last request generation served
+};
+
+struct lora_shard {
+    TEEC_Context *ctx;
+    bool pin;
+    uint32_t min_chunk_tokens;
+    uint32_t num_workers;
+    struct lora_shard_worker *workers;
+
+    pthread_mutex_t call_lock;  // serializes lora_shard_infer()
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    uint64_t generation;        // bumped for each request
+    uint32_t pending;           // workers yet to finish this generation
+    bool stop;
+
+    // The request being served, valid while pending
+    struct shard_job *jobs;     // num_workers entries
+    uint32_t num_jobs;
+    TEEC_SharedMemory input_shm;
+    TEEC_SharedMemory output_shm;
+    TEEC_Result result;
+    uint32_t origin;
+
+    float *partials;            // num_workers * partial_width floats
+    uint32_t partial_width;
+};
+
+static void run_job(struct lora_shard_worker *w, const struct shard_job *job,
+                    uint32_t *origin, TEEC_Result *res)
+{
+    struct lora_shard *ls = w->ls;
+    const tensor_dims_t *dims = &job->dims;
+    TEEC_Operation op;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+                                     job->partial ? TEEC_MEMREF_TEMP_OUTPUT :
+                                                    TEEC_MEMREF_PARTIAL_OUTPUT,
+                                     TEEC_MEMREF_TEMP_INPUT,
+                                     TEEC_NONE);
+    op.params[0].memref.parent = &ls->input_shm;
+    op.params[0].memref.offset = job->in_offset;
+    op.params[0].memref.size = (size_t)dims->batch_size * dims->seq_length *
+                               dims->in_channels *
+                               lora_dtype_size(dims->input_dtype);
+    if (job->partial)
+    {
+        op.params[1].tmpref.buffer = job->partial;
+        op.params[1].tmpref.size = job->out_size;
+    }
+    else
+    {
+        op.params[1].memref.parent = &ls->output_shm;
+        op.params[1].memref.offset = job->out_offset;
+        op.params[1].memref.size = job->out_size;
+    }
+    op.params[2].tmpref.buffer = (void *)dims;
+    op.params[2].tmpref.size = sizeof(*dims);
+
+    *res = TEEC_InvokeCommand(&w->session, TA_OPTEE_LLM_CMD_LORA, &op,
+                              origin);
+}
+
+static void pin_worker(struct lora_shard_worker *w)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (cpus <= 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(w->index % cpus, &set);
+    // Best effort: an unpinned worker still works, it may just migrate.
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void *worker_main(void *arg)
+{
+    struct lora_shard_worker *w = arg;
+    struct lora_shard *ls = w->ls;
+
+    if (ls->pin)
+        pin_worker(w);
+
+    pthread_mutex_lock(&ls->lock);
+    for (;;)
+    {
+        while (w->generation == ls->generation && !ls->stop)
+            pthread_cond_wait(&ls->work_cond, &ls->lock);
+        if (ls->stop)
+            break;
+        w->generation = ls->generation;
+
+        if (w->index < ls->num_jobs)
+        {
+            const struct shard_job *job = &ls->jobs[w->index];
+            TEEC_Result res;
+            uint32_t origin;
+
+            pthread_mutex_unlock(&ls->lock);
+            run_job(w, job, &origin, &res);
+            pthread_mutex_lock(&ls->lock);
+            if (res != TEEC_SUCCESS && ls->result == TEEC_SUCCESS)
+            {
+                ls->result = res;
+                ls->origin = origin;
+            }
+        }
+        if (--ls->pending == 0)
+            pthread_cond_signal(&ls->done_cond);
+    }
+    pthread_mutex_unlock(&ls->lock);
+    return NULL;
+}
+
+TEEC_Result lora_shard_open(TEEC_Context *ctx,
+                            const struct lora_shard_config *cfg,
+                            struct lora_shard **out)
+{
+    TEEC_UUID uuid = TA_OPTEE_LLM_UUID;
+    struct lora_shard *ls;
+    TEEC_Result res = TEEC_SUCCESS;
+    uint32_t err_origin;
+
+    if (!cfg->sessions)
+        return TEEC_ERROR_BAD_PARAMETERS;
+
+    ls = calloc(1, sizeof(*ls));
+    if (!ls)
+        return TEEC_ERROR_OUT_OF_MEMORY;
+    ls->ctx = ctx;
+    ls->pin = cfg->pin;
+    ls->min_chunk_tokens = cfg->min_chunk_tokens ? cfg->min_chunk_tokens :
+                                                   DEFAULT_MIN_CHUNK_TOKENS;
+    pthread_mutex_init(&ls->call_lock, NULL);
+    pthread_mutex_init(&ls->lock, NULL);
+    pthread_cond_init(&ls->work_cond, NULL);
+    pthread_cond_init(&ls->done_cond, NULL);
+
+    ls->num_workers = cfg->sessions;
+    ls->workers = calloc(ls->num_workers, sizeof(*ls->workers));
+    ls->jobs = calloc(ls->num_workers, sizeof(*ls->jobs));
+    if (!ls->workers || !ls->jobs)
+    {
+        res = TEEC_ERROR_OUT_OF_MEMORY;
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < ls->num_workers; i++)
+    {
+        struct lora_shard_worker *w = &ls->workers[i];
+
+        w->ls = ls;
+        w->index = i;
+        res = TEEC_OpenSession(ctx, &w->session, &uuid, TEEC_LOGIN_PUBLIC,
+                               NULL, NULL, &err_origin);
+        if (res != TEEC_SUCCESS)
+            goto err;
+        w->session_open = true;
+
+        if (cfg->session_init)
+        {
+            res = cfg->session_init(&w->session, cfg->session_init_arg);
+            if (res != TEEC_SUCCESS)
+                goto err;
+        }
+
+        if (pthread_create(&w->thread, NULL, worker_main, w))
+        {
+            res = TEEC_ERROR_GENERIC;
+            goto err;
+        }
+        w->thread_started = true;
+    }
+
+    *out = ls;
+    return TEEC_SUCCESS;
+
+err:
+    lora_shard_close(ls);
+    return res;
+}
+
+void lora_shard_close(struct lora_shard *ls)
+{
+    pthread_mutex_lock(&ls->lock);
+    ls->stop = true;
+    pthread_cond_broadcast(&ls->work_cond);
+    pthread_mutex_unlock(&ls->lock);
+
+    for (uint32_t i = 0; ls->workers && i < ls->num_workers; i++)
+    {
+        struct lora_shard_worker *w = &ls->workers[i];
+
+        if (w->thread_started)
+            pthread_join(w->thread, NULL);
+        if (w->session_open)
+            TEEC_CloseSession(&w->session);
+    }
+
+    pthread_cond_destroy(&ls->done_cond);
+    pthread_cond_destroy(&ls->work_cond);
+    pthread_mutex_destroy(&ls->lock);
+    pthread_mutex_destroy(&ls->call_lock);
+    free(ls->partials);
+    free(ls->jobs);
+    free(ls->workers);
+    free(ls);
+}
+
+// Token chunks per sample: enough to give every session work, but no chunk
+// shorter than min_chunk_tokens. 1 means the request is split by sample.
+static uint32_t chunks_per_sample(const struct lora_shard *ls,
+                                  const tensor_dims_t *dims)
+{
+    uint32_t chunks;
+
+    if (dims->batch_size >= ls->num_workers)
+        return 1;
+    switch (dims->output_mode)
+    {
+    case LORA_OUT_TOKENS:
+        break;
+    case LORA_OUT_MEAN:
+    case LORA_OUT_MAX:
+        if (dims->output_dtype != LORA_DTYPE_F32)
+            return 1;
+        break;
+    default:
+        // LORA_OUT_LAST only reads one token per sample.
+        return 1;
+    }
+    chunks = ls->num_workers / dims->batch_size;
+    if (chunks > dims->seq_length / ls->min_chunk_tokens)
+        chunks = dims->seq_length / ls->min_chunk_tokens;
+    return chunks ? chunks : 1;
+}
+
+// Split the request into at most num_workers jobs. Returns the job count,
+// or 0 if the output buffer is too small.
+static uint32_t plan_jobs(struct lora_shard *ls, const tensor_dims_t *dims,
+                          uint32_t out_channels, size_t output_size)
+{
+    const size_t in_token = (size_t)dims->in_channels *
+                            lora_dtype_size(dims->input_dtype);
+    const size_t out_row = (size_t)out_channels *
+                           lora_dtype_size(dims->output_dtype);
+    const uint32_t out_rows = dims->output_mode == LORA_OUT_TOKENS ?
+                              dims->seq_length : 1;
+    const uint32_t chunks = chunks_per_sample(ls, dims);
+    uint32_t n = 0;
+
+    if (output_size < (size_t)dims->batch_size * out_rows * out_row)
+        return 0;
+
+    if (chunks == 1)
+    {
+        const uint32_t jobs = dims->batch_size < ls->num_workers ?
+                              dims->batch_size : ls->num_workers;
+
+        for (uint32_t j = 0, s0 = 0; j < jobs; j++)
+        {
+            const uint32_t s1 = (uint64_t)dims->batch_size * (j + 1) / jobs;
+            struct shard_job *job = &ls->jobs[n++];
+
+            job->dims = *dims;
+            job->dims.batch_size = s1 - s0;
+            job->in_offset = (size_t)s0 * dims->seq_length * in_token;
+            job->out_offset = (size_t)s0 * out_rows * out_row;
+            job->out_size = (size_t)(s1 - s0) * out_rows * out_row;
+            job->partial = NULL;
+            s0 = s1;
+        }
+        return n;
+    }
+
+    for (uint32_t s = 0; s < dims->batch_size; s++)
+    {
+        for (uint32_t c = 0, t0 = 0; c < chunks; c++)
+        {
+            const uint32_t t1 = (uint64_t)dims->seq_length * (c + 1) / chunks;
+            const size_t token = (size_t)s * dims->seq_length + t0;
+            struct shard_job *job = &ls->jobs[n];
+
+            job->dims = *dims;
+            job->dims.batch_size = 1;
+            job->dims.seq_length = t1 - t0;
+            job->in_offset = token * in_token;
+            if (dims->output_mode == LORA_OUT_TOKENS)
+            {
+                job->out_offset = token * out_row;
+                job->out_size = (size_t)(t1 - t0) * out_row;
+                job->partial = NULL;
+            }
+            else
+            {
+                job->partial = ls->partials + (size_t)n * out_channels;
+                job->out_size = out_row;
+            }
+            n++;
+            t0 = t1;
+        }
+    }
+    return n;
+}
+
+// Combine the chunk results of each sample into the request output: the
+// length-weighted mean of the chunk means, or the max of the chunk maxima.
+static void merge_partials(struct lora_shard *ls, const tensor_dims_t *dims,
+                           uint32_t out_channels, float *output)
+{
+    const uint32_t chunks = ls->num_jobs / dims->batch_size;
+
+    for (uint32_t s = 0; s < dims->batch_size; s++)
+    {
+        const struct shard_job *job = &ls->jobs[s * chunks];
+        float *out = output + (size_t)s * out_channels;
+
+        for (uint32_t o = 0; o < out_channels; o++)
+        {
+            if (dims->output_mode == LORA_OUT_MAX)
+            {
+                float v = job[0].partial[o];
+
+                for (uint32_t c = 1; c < chunks; c++)
+                {
+                    if (job[c].partial[o] > v)
+                        v = job[c].partial[o];
+                }
+                out[o] = v;
+            }
+            else
+            {
+                double v = 0.0;
+
+                for (uint32_t c = 0; c < chunks; c++)
+                    v += (double)job[c].partial[o] * job[c].dims.seq_length;
+                out[o] = v / dims->seq_length;
+            }
+        }
+    }
+}
+
+TEEC_Result lora_shard_infer(struct lora_shard *ls, const tensor_dims_t *dims,
+                             uint32_t out_channels, const void *input,
+                             void *output, size_t output_size,
+                             uint32_t *origin)
+{
+    TEEC_Result res;
+    uint32_t err_origin;
+
+    if (!origin)
+        origin = &err_origin;
+    *origin = TEEC_ORIGIN_API;
+    if (!dims->batch_size || !dims->seq_length || !out_channels ||
+        !lora_dtype_size(dims->input_dtype) ||
+        !lora_dtype_size(dims->output_dtype))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    // Shards are slices of a dense batch, and the dims memref carries no
+    // ragged offsets or prefix.
+    if (dims->flags & (LORA_FLAG_RAGGED | LORA_FLAG_PREFIX))
+        return TEEC_ERROR_NOT_SUPPORTED;
+
+    pthread_mutex_lock(&ls->call_lock);
+
+    if (ls->partial_width < out_channels)
+    {
+        float *p = realloc(ls->partials, (size_t)ls->num_workers *
+                                         out_channels * sizeof(float));
+
+        if (!p)
+        {
+            pthread_mutex_unlock(&ls->call_lock);
+            return TEEC_ERROR_OUT_OF_MEMORY;
+        }
+        ls->partials = p;
+        ls->partial_width = out_channels;
+    }
+
+    ls->num_jobs = plan_jobs(ls, dims, out_channels, output_size);
+    if (!ls->num_jobs)
+    {
+        pthread_mutex_unlock(&ls->call_lock);
+        return TEEC_ERROR_SHORT_BUFFER;
+    }
+
+    // Register the caller's tensors in place for all shards.
+    memset(&ls->input_shm, 0, sizeof(ls->input_shm));
+    ls->input_shm.buffer = (void *)input;
+    ls->input_shm.size = (size_t)dims->batch_size * dims->seq_length *
+                         dims->in_channels *
+                         lora_dtype_size(dims->input_dtype);
+    ls->input_shm.flags = TEEC_MEM_INPUT;
+    memset(&ls->output_shm, 0, sizeof(ls->output_shm));
+    ls->output_shm.buffer = output;
+    ls->output_shm.size = output_size;
+    ls->output_shm.flags = TEEC_MEM_OUTPUT;
+
+    res = TEEC_RegisterSharedMemory(ls->ctx, &ls->input_shm);
+    if (res != TEEC_SUCCESS)
+        goto out;
+    res = TEEC_RegisterSharedMemory(ls->ctx, &ls->output_shm);
+    if (res != TEEC_SUCCESS)
+    {
+        TEEC_ReleaseSharedMemory(&ls->input_shm);
+        goto out;
+    }
+
+    pthread_mutex_lock(&ls->lock);
+    ls->result = TEEC_SUCCESS;
+    ls->origin = TEEC_ORIGIN_API;
+    ls->pending = ls->num_workers;
+    ls->generation++;
+    pthread_cond_broadcast(&ls->work_cond);
+    while (ls->pending)
+        pthread_cond_wait(&ls->done_cond, &ls->lock);
+    res = ls->result;
+    *origin = ls->origin;
+    pthread_mutex_unlock(&ls->lock);
+
+    TEEC_ReleaseSharedMemory(&ls->output_shm);
+    TEEC_ReleaseSharedMemory(&ls->input_shm);
+
+    if (res == TEEC_SUCCESS && ls->jobs[0].partial)
+        merge_partials(ls, dims, out_channels, output);
+out:
+    pthread_mutex_unlock(&ls->call_lock);
+    return res;
+}
@@ -25,141 +25,84 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <err.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <tee_client_api.h>
-#include <optee_llm_ta.h>
+#include <opteellm.h>
 
-#define INPUT_NUM_ELEMENTS (MAX_BATCH_SIZE * MAX_SEQ_LENGTH * IN_CHANNELS)
-#define INPUT_SIZE_BYTES (INPUT_NUM_ELEMENTS * sizeof(float))
-#define OUTPUT_NUM_ELEMENTS (MAX_BATCH_SIZE * OUT_CHANNELS)
-#define OUTPUT_SIZE_BYTES (OUTPUT_NUM_ELEMENTS * sizeof(float))
+#include "bench.h"
 
-int main(void)
+int main(int argc, char *argv[])
 {
     TEEC_Result res;
-    TEEC_Context context;
-    TEEC_Session session;
-    TEEC_Operation op;
-    TEEC_UUID uuid = TA_OPTEE_LLM_UUID;
-    TEEC_SharedMemory input_shm = {0};
-    TEEC_SharedMemory output_shm = {0};
-    TEEC_SharedMemory dims_shm = {0};
-    uint32_t err_origin;
+    struct opteellm *ol;
+    uint32_t err_origin = 0;
+    const tensor_dims_t dims = {
+        .batch_size = MAX_BATCH_SIZE,
+        .seq_length = MAX_SEQ_LENGTH,
+        .in_channels = IN_CHANNELS,
+        .flags = 0,
+        .adapter_id = 0,
+    };
+    const size_t input_elems = (size_t)dims.batch_size * dims.seq_length *
+                               dims.in_channels;
+    float output[MAX_BATCH_SIZE * OUT_CHANNELS];
+    float *input;
 
-    /* Initialize a context connecting us to the TEE */
-    res = TEEC_InitializeContext(NULL, &context);
-    if (res != TEEC_SUCCESS)
-        errx(1, "TEEC_InitializeContext failed with code 0x%x", res);
-
-    /*
-     * Open a session to the "hello world" TA, the TA will print "hello
-     * world!" in the log when the session is created.
-     */
-    res = TEEC_OpenSession(&context, &session, &uuid,
-                           TEEC_LOGIN_PUBLIC, NULL, NULL, &err_origin);
-    if (res != TEEC_SUCCESS)
-        errx(1, "TEEC_Opensession failed with code 0x%x origin 0x%x",
-             res, err_origin);
-
-    /*
-     * Execute a function in the TA by invoking it, in this case
-     * we're incrementing a number.
-     *
-     * The value of command ID part and how the parameters are
-     * interpreted is part of the interface provided by the TA.
-     */
-
-    // 3. Allocate shared memory for the input tensor.
-    input_shm.size = INPUT_SIZE_BYTES;
-    input_shm.flags = TEEC_MEM_INPUT;
-    res = TEEC_AllocateSharedMemory(&context, &input_shm);
-    if (res != TEEC_SUCCESS)
-    {
-        printf("TEEC_AllocateSharedMemory (input) failed: 0x%x\n", res);
-        goto cleanup_session;
-    }
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+        return bench_main(argc - 1, argv + 1);
 
-    // 4. Allocate shared memory for the output tensor.
-    output_shm.size = OUTPUT_SIZE_BYTES;
-    output_shm.flags = TEEC_MEM_OUTPUT;
-    res = TEEC_AllocateSharedMemory(&context, &output_shm);
+    // 1. Open the library's context and session to the TA.
+    res = opteellm_open(&ol);
     if (res != TEEC_SUCCESS)
-    {
-        printf("TEEC_AllocateSharedMemory (output) failed: 0x%x\n", res);
-        goto cleanup_input;
-    }
+        errx(1, "opteellm_open failed with code 0x%x", res);
 
-    // 5. Allocate shared memory for the tensor dimensions structure.
-    dims_shm.size = sizeof(tensor_dims_t);
-    dims_shm.flags = TEEC_MEM_INPUT;
-    res = TEEC_AllocateSharedMemory(&context, &dims_shm);
+    // 2. Load the adapter weights once for this session. Placeholder
+    // random weights until real adapters are provisioned.
+    res = opteellm_load_adapter(ol, dims.adapter_id, LORA_WEIGHTS_RANDOM, 0,
+                                NULL, NULL, 0);
     if (res != TEEC_SUCCESS)
     {
-        printf("TEEC_AllocateSharedMemory (dims) failed: 0x%x\n", res);
-        goto cleanup_output;
+        printf("opteellm_load_adapter failed: 0x%x\n", res);
+        goto cleanup;
     }
 
-    // 6. Initialize the input tensor.
-    // The input tensor is very large, so we fill it here using the shared memory.
+    // 3. Initialize the input tensor in ordinary memory; the library
+    // registers it as shared memory for the call instead of copying it.
+    input = malloc(input_elems * sizeof(float));
+    if (!input)
     {
-        float *input_data = (float *)input_shm.buffer;
-        for (size_t i = 0; i < INPUT_NUM_ELEMENTS; i++)
-        {
-            input_data[i] = 0.01f; // Test data for latency testing.
-        }
+        res = TEEC_ERROR_OUT_OF_MEMORY;
+        goto cleanup;
     }
-
-    // 7. Prepare the tensor dimensions.
+    for (size_t i = 0; i < input_elems; i++)
     {
-        tensor_dims_t *dims = (tensor_dims_t *)dims_shm.buffer;
-        dims->batch_size = MAX_BATCH_SIZE;
-        dims->seq_length = MAX_SEQ_LENGTH;
-        dims->in_channels = IN_CHANNELS;
+        input[i] = 0.01f; // Test data for latency testing.
     }
 
-    // 8. Set up the operation parameters.
-    memset(&op, 0, sizeof(op));
-    op.paramTypes = TEEC_PARAM_TYPES(
-        TEEC_MEMREF_WHOLE, // Param0: Input tensor
-        TEEC_MEMREF_WHOLE, // Param1: Output tensor
-        TEEC_MEMREF_WHOLE, // Param2: Tensor dimensions
-        TEEC_NONE);
-    op.params[0].memref.parent = &input_shm;
-    op.params[1].memref.parent = &output_shm;
-    op.params[2].memref.parent = &dims_shm;
-
-    // 9. Invoke the TA command.
-    res = TEEC_InvokeCommand(&session, TA_OPTEE_LLM_CMD_LORA, &op, &err_origin);
+    // 4. Run the inference.
+    res = opteellm_infer(ol, &dims, input, output, sizeof(output), &err_origin);
+    free(input);
     if (res != TEEC_SUCCESS)
     {
-        printf("TEEC_InvokeCommand failed: 0x%x, origin: 0x%x\n", res, err_origin);
-        goto cleanup_dims;
+        printf("opteellm_infer failed: 0x%x, origin: 0x%x\n", res, err_origin);
+        goto cleanup;
     }
 
-    // 10. Process and print the output tensor.
+    // 5. Process and print the output tensor.
+    printf("Output Tensor:\n");
+    for (uint32_t sample = 0; sample < dims.batch_size; sample++)
     {
-        float *output_data = (float *)output_shm.buffer;
-        printf("Output Tensor:\n");
-        for (uint32_t sample = 0; sample < MAX_BATCH_SIZE; sample++)
+        printf("Sample %u: ", sample);
+        for (uint32_t c = 0; c < OUT_CHANNELS; c++)
         {
-            printf("Sample %u: ", sample);
-            for (uint32_t c = 0; c < OUT_CHANNELS; c++)
-            {
-                printf("%f ", output_data[sample * OUT_CHANNELS + c]);
-            }
-            printf("\n");
+            printf("%f ", output[sample * OUT_CHANNELS + c]);
         }
+        printf("\n");
     }
 
-cleanup_dims:
-    TEEC_ReleaseSharedMemory(&dims_shm);
-cleanup_output:
-    TEEC_ReleaseSharedMemory(&output_shm);
-cleanup_input:
-    TEEC_ReleaseSharedMemory(&input_shm);
-cleanup_session:
-    TEEC_CloseSession(&session);
-    TEEC_FinalizeContext(&context);
+cleanup:
+    opteellm_close(ol);
     return (res == TEEC_SUCCESS ? 0 : 1);
 }
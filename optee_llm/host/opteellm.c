@@ -0,0 +1,776 @@
+/*
+ * libopteellm: long-lived session and shared-memory pool for the optee_llm
+ * TA.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <opteellm.h>
+
+// Pool size classes are powers of two from 4 KiB; larger requests than the
+// last class are allocated exactly and not pooled.
+#define SHM_MIN_SHIFT       12
+#define SHM_NUM_CLASSES     16
+// Idle buffers kept per class; extra ones are released when put back.
+#define SHM_MAX_IDLE        4
+
+struct shm_node {
+    TEEC_SharedMemory shm;      // first, so a TEEC_SharedMemory * is a node
+    size_t class_size;          // 0 if not pooled
+    struct shm_node *next;
+};
+
+struct opteellm {
+    TEEC_Context ctx;
+    TEEC_Session session;
+    pthread_mutex_t lock;
+    struct shm_node *idle[SHM_NUM_CLASSES];
+    uint32_t num_idle[SHM_NUM_CLASSES];
+};
+
+TEEC_Result opteellm_open(struct opteellm **out)
+{
+    TEEC_UUID uuid = TA_OPTEE_LLM_UUID;
+    struct opteellm *ol;
+    TEEC_Result res;
+    uint32_t err_origin;
+
+    ol = calloc(1, sizeof(*ol));
+    if (!ol)
+        return TEEC_ERROR_OUT_OF_MEMORY;
+
+    res = TEEC_InitializeContext(NULL, &ol->ctx);
+    if (res != TEEC_SUCCESS)
+    {
+        free(ol);
+        return res;
+    }
+    res = TEEC_OpenSession(&ol->ctx, &ol->session, &uuid,
+                           TEEC_LOGIN_PUBLIC, NULL, NULL, &err_origin);
+    if (res != TEEC_SUCCESS)
+    {
+        TEEC_FinalizeContext(&ol->ctx);
+        free(ol);
+        return res;
+    }
+
+    pthread_mutex_init(&ol->lock, NULL);
+    *out = ol;
+    return TEEC_SUCCESS;
+}
+
+static void free_node(struct shm_node *node)
+{
+    TEEC_ReleaseSharedMemory(&node->shm);
+    free(node);
+}
+
+void opteellm_close(struct opteellm *ol)
+{
+    for (int c = 0; c < SHM_NUM_CLASSES; c++)
+    {
+        while (ol->idle[c])
+        {
+            struct shm_node *node = ol->idle[c];
+
+            ol->idle[c] = node->next;
+            free_node(node);
+        }
+    }
+    pthread_mutex_destroy(&ol->lock);
+    TEEC_CloseSession(&ol->session);
+    TEEC_FinalizeContext(&ol->ctx);
+    free(ol);
+}
+
+TEEC_Context *opteellm_context(struct opteellm *ol)
+{
+    return &ol->ctx;
+}
+
+TEEC_Session *opteellm_session(struct opteellm *ol)
+{
+    return &ol->session;
+}
+
+TEEC_Result opteellm_load_adapter(struct opteellm *ol, uint32_t adapter_id,
+                                  uint32_t source, uint32_t flags,
+                                  const lora_adapter_desc_t *desc,
+                                  const void *weights, size_t size)
+{
+    TEEC_Operation op;
+    uint32_t err_origin;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+                                     weights ? TEEC_MEMREF_TEMP_INPUT : TEEC_NONE,
+                                     desc ? TEEC_MEMREF_TEMP_INPUT : TEEC_NONE,
+                                     TEEC_VALUE_INPUT);
+    op.params[0].value.a = source;
+    op.params[0].value.b = flags;
+    op.params[1].tmpref.buffer = (void *)weights;
+    op.params[1].tmpref.size = size;
+    op.params[2].tmpref.buffer = (void *)desc;
+    op.params[2].tmpref.size = sizeof(*desc);
+    op.params[3].value.a = adapter_id;
+    return TEEC_InvokeCommand(&ol->session, TA_OPTEE_LLM_CMD_LORA_LOAD, &op,
+                              &err_origin);
+}
+
+TEEC_Result opteellm_set_upload_key(struct opteellm *ol,
+                                    const lora_key_wrap_t *wrap)
+{
+    TEEC_Operation op;
+    uint32_t err_origin;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+                                     TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = (void *)wrap;
+    op.params[0].tmpref.size = sizeof(*wrap);
+    return TEEC_InvokeCommand(&ol->session, TA_OPTEE_LLM_CMD_LORA_UPLOAD_KEY,
+                              &op, &err_origin);
+}
+
+TEEC_Result opteellm_upload_adapter(struct opteellm *ol, uint32_t adapter_id,
+                                    uint32_t flags, const void *blob,
+                                    size_t size, uint32_t *origin)
+{
+    TEEC_SharedMemory shm = {
+        .buffer = (void *)blob,
+        .size = size,
+        .flags = TEEC_MEM_INPUT,
+    };
+    const lora_sealed_hdr_t *hdr = blob;
+    lora_weights_layout_t layout;
+    size_t offset, remaining;
+    uint32_t err_origin;
+    TEEC_Operation op;
+    TEEC_Result res;
+
+    if (!origin)
+        origin = &err_origin;
+    *origin = TEEC_ORIGIN_API;
+    if (size < sizeof(*hdr) || !hdr->chunk_size ||
+        lora_weights_layout(&hdr->desc, &layout) ||
+        size != sizeof(*hdr) + layout.size +
+                (layout.size + hdr->chunk_size - 1) / hdr->chunk_size *
+                LORA_SEALED_TAG_SIZE)
+        return TEEC_ERROR_BAD_PARAMETERS;
+
+    res = TEEC_RegisterSharedMemory(&ol->ctx, &shm);
+    if (res != TEEC_SUCCESS)
+        return res;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+                                     TEEC_MEMREF_PARTIAL_INPUT,
+                                     TEEC_NONE, TEEC_NONE);
+    op.params[0].value.a = adapter_id;
+    op.params[0].value.b = flags;
+    op.params[1].memref.parent = &shm;
+    op.params[1].memref.size = sizeof(*hdr);
+    res = TEEC_InvokeCommand(&ol->session, TA_OPTEE_LLM_CMD_LORA_UPLOAD_BEGIN,
+                             &op, origin);
+
+    offset = sizeof(*hdr);
+    remaining = layout.size;
+    for (uint32_t i = 0; res == TEEC_SUCCESS && remaining; i++)
+    {
+        const size_t len = remaining < hdr->chunk_size ? remaining :
+                                                         hdr->chunk_size;
+
+        memset(&op, 0, sizeof(op));
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+                                         TEEC_VALUE_INPUT,
+                                         TEEC_NONE, TEEC_NONE);
+        op.params[0].memref.parent = &shm;
+        op.params[0].memref.offset = offset;
+        op.params[0].memref.size = len + LORA_SEALED_TAG_SIZE;
+        op.params[1].value.a = i;
+        res = TEEC_InvokeCommand(&ol->session,
+                                 TA_OPTEE_LLM_CMD_LORA_UPLOAD_CHUNK, &op,
+                                 origin);
+        offset += len + LORA_SEALED_TAG_SIZE;
+        remaining -= len;
+    }
+
+    TEEC_ReleaseSharedMemory(&shm);
+    return res;
+}
+
+// Size class for size bytes, or -1 if it is too large to pool.
+static int shm_class(size_t size)
+{
+    int c = 0;
+
+    while (((size_t)1 << (SHM_MIN_SHIFT + c)) < size)
+    {
+        if (++c == SHM_NUM_CLASSES)
+            return -1;
+    }
+    return c;
+}
+
+TEEC_Result opteellm_shm_get(struct opteellm *ol, size_t size,
+                             TEEC_SharedMemory **shm)
+{
+    const int c = shm_class(size);
+    struct shm_node *node = NULL;
+    TEEC_Result res;
+
+    if (c >= 0)
+    {
+        pthread_mutex_lock(&ol->lock);
+        node = ol->idle[c];
+        if (node)
+        {
+            ol->idle[c] = node->next;
+            ol->num_idle[c]--;
+        }
+        pthread_mutex_unlock(&ol->lock);
+    }
+
+    if (!node)
+    {
+        node = calloc(1, sizeof(*node));
+        if (!node)
+            return TEEC_ERROR_OUT_OF_MEMORY;
+        node->class_size = c >= 0 ? (size_t)1 << (SHM_MIN_SHIFT + c) : 0;
+        node->shm.size = c >= 0 ? node->class_size : size;
+        node->shm.flags = TEEC_MEM_INPUT | TEEC_MEM_OUTPUT;
+        res = TEEC_AllocateSharedMemory(&ol->ctx, &node->shm);
+        if (res != TEEC_SUCCESS)
+        {
+            free(node);
+            return res;
+        }
+    }
+
+    // Memrefs of the whole buffer cover just what was asked for.
+    node->shm.size = size;
+    *shm = &node->shm;
+    return TEEC_SUCCESS;
+}
+
+void opteellm_shm_put(struct opteellm *ol, TEEC_SharedMemory *shm)
+{
+    struct shm_node *node = (struct shm_node *)shm;
+    const int c = node->class_size ? shm_class(node->class_size) : -1;
+
+    if (c >= 0)
+    {
+        pthread_mutex_lock(&ol->lock);
+        if (ol->num_idle[c] < SHM_MAX_IDLE)
+        {
+            node->next = ol->idle[c];
+            ol->idle[c] = node;
+            ol->num_idle[c]++;
+            node = NULL;
+        }
+        pthread_mutex_unlock(&ol->lock);
+    }
+    if (node)
+        free_node(node);
+}
+
+// Input tensor size; offsets are the ragged token offsets or NULL.
+static size_t input_bytes(const tensor_dims_t *dims, const uint32_t *offsets)
+{
+    const size_t tokens = offsets ? offsets[dims->batch_size] :
+                          (size_t)dims->batch_size * dims->seq_length;
+
+    return tokens * dims->in_channels * lora_dtype_size(dims->input_dtype);
+}
+
+// dims_size covers the ragged offsets that follow dims, if any.
+static TEEC_Result invoke_lora(struct opteellm *ol, const tensor_dims_t *dims,
+                               size_t dims_size, size_t input_size,
+                               TEEC_SharedMemory *input,
+                               TEEC_SharedMemory *output,
+                               lora_timing_t *timing, uint32_t *origin)
+{
+    TEEC_Operation op;
+    uint32_t err_origin;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+                                     TEEC_MEMREF_PARTIAL_OUTPUT,
+                                     TEEC_MEMREF_TEMP_INPUT,
+                                     timing ? TEEC_MEMREF_TEMP_OUTPUT :
+                                              TEEC_NONE);
+    op.params[0].memref.parent = input;
+    op.params[0].memref.size = input_size;
+    op.params[1].memref.parent = output;
+    op.params[1].memref.size = output->size;
+    op.params[2].tmpref.buffer = (void *)dims;
+    op.params[2].tmpref.size = dims_size;
+    op.params[3].tmpref.buffer = timing;
+    op.params[3].tmpref.size = sizeof(*timing);
+    return TEEC_InvokeCommand(&ol->session, TA_OPTEE_LLM_CMD_LORA, &op,
+                              origin ? origin : &err_origin);
+}
+
+TEEC_Result opteellm_infer_shm(struct opteellm *ol, const tensor_dims_t *dims,
+                               TEEC_SharedMemory *input,
+                               TEEC_SharedMemory *output, uint32_t *origin)
+{
+    const size_t input_size = input_bytes(dims, NULL);
+
+    if (input_size > input->size)
+        return TEEC_ERROR_BAD_PARAMETERS;
+    return invoke_lora(ol, dims, sizeof(*dims), input_size, input, output,
+                       NULL, origin);
+}
+
+TEEC_Result opteellm_infer(struct opteellm *ol, const tensor_dims_t *dims,
+                           const void *input, void *output,
+                           size_t output_size, uint32_t *origin)
+{
+    return opteellm_infer_timed(ol, dims, input, output, output_size, NULL,
+                                origin);
+}
+
+// Run a request on caller memory, registered in place rather than copied
+// into allocated shared memory.
+static TEEC_Result infer_registered(struct opteellm *ol,
+                                    const tensor_dims_t *dims,
+                                    size_t dims_size, size_t input_size,
+                                    const void *input, void *output,
+                                    size_t output_size, lora_timing_t *timing,
+                                    uint32_t *origin)
+{
+    TEEC_SharedMemory in_shm = {
+        .buffer = (void *)input,
+        .size = input_size,
+        .flags = TEEC_MEM_INPUT,
+    };
+    TEEC_SharedMemory out_shm = {
+        .buffer = output,
+        .size = output_size,
+        .flags = TEEC_MEM_OUTPUT,
+    };
+    TEEC_Result res;
+
+    res = TEEC_RegisterSharedMemory(&ol->ctx, &in_shm);
+    if (res != TEEC_SUCCESS)
+        return res;
+    res = TEEC_RegisterSharedMemory(&ol->ctx, &out_shm);
+    if (res == TEEC_SUCCESS)
+    {
+        res = invoke_lora(ol, dims, dims_size, input_size, &in_shm, &out_shm,
+                          timing, origin);
+        TEEC_ReleaseSharedMemory(&out_shm);
+    }
+    TEEC_ReleaseSharedMemory(&in_shm);
+    return res;
+}
+
+TEEC_Result opteellm_infer_timed(struct opteellm *ol,
+                                 const tensor_dims_t *dims,
+                                 const void *input, void *output,
+                                 size_t output_size, lora_timing_t *timing,
+                                 uint32_t *origin)
+{
+    if (dims->flags & (LORA_FLAG_RAGGED | LORA_FLAG_PREFIX))
+        return TEEC_ERROR_BAD_PARAMETERS;
+    return infer_registered(ol, dims, sizeof(*dims), input_bytes(dims, NULL),
+                            input, output, output_size, timing, origin);
+}
+
+TEEC_Result opteellm_infer_ragged(struct opteellm *ol,
+                                  const tensor_dims_t *dims,
+                                  const uint32_t *offsets,
+                                  const void *input, void *output,
+                                  size_t output_size, uint32_t *origin)
+{
+    const size_t offsets_size = ((size_t)dims->batch_size + 1) *
+                                sizeof(*offsets);
+    tensor_dims_t *desc;
+    TEEC_Result res;
+
+    // The TA takes the dims and the offsets as one buffer.
+    desc = malloc(sizeof(*desc) + offsets_size);
+    if (!desc)
+        return TEEC_ERROR_OUT_OF_MEMORY;
+    *desc = *dims;
+    desc->flags |= LORA_FLAG_RAGGED;
+    memcpy(desc + 1, offsets, offsets_size);
+
+    res = infer_registered(ol, desc, sizeof(*desc) + offsets_size,
+                           input_bytes(dims, offsets), input, output,
+                           output_size, NULL, origin);
+    free(desc);
+    return res;
+}
+
+TEEC_Result opteellm_infer_prefix(struct opteellm *ol,
+                                  const tensor_dims_t *dims,
+                                  const uint32_t *offsets,
+                                  const lora_prefix_t *prefix,
+                                  const void *input, void *output,
+                                  size_t output_size, uint32_t *origin)
+{
+    const size_t offsets_size = offsets ? ((size_t)dims->batch_size + 1) *
+                                          sizeof(*offsets) : 0;
+    const size_t desc_size = sizeof(*dims) + offsets_size + sizeof(*prefix);
+    tensor_dims_t *desc;
+    TEEC_Result res;
+
+    // The TA takes the dims, any offsets and the prefix as one buffer.
+    desc = malloc(desc_size);
+    if (!desc)
+        return TEEC_ERROR_OUT_OF_MEMORY;
+    *desc = *dims;
+    desc->flags |= LORA_FLAG_PREFIX;
+    if (offsets)
+    {
+        desc->flags |= LORA_FLAG_RAGGED;
+        memcpy(desc + 1, offsets, offsets_size);
+    }
+    memcpy((uint8_t *)(desc + 1) + offsets_size, prefix, sizeof(*prefix));
+
+    res = infer_registered(ol, desc, desc_size, input_bytes(dims, offsets),
+                           input, output, output_size, NULL, origin);
+    free(desc);
+    return res;
+}
+
+TEEC_Result opteellm_infer_multi(struct opteellm *ol,
+                                 const lora_multi_hdr_t *hdr,
+                                 const lora_multi_entry_t *entries,
+                                 const void *input, size_t input_size,
+                                 void *output, size_t output_size,
+                                 uint32_t *origin)
+{
+    TEEC_SharedMemory in_shm = {
+        .buffer = (void *)input,
+        .size = input_size,
+        .flags = TEEC_MEM_INPUT,
+    };
+    TEEC_SharedMemory out_shm = {
+        .buffer = output,
+        .size = output_size,
+        .flags = TEEC_MEM_OUTPUT,
+    };
+    const size_t table_size = sizeof(*hdr) + hdr->count * sizeof(*entries);
+    uint32_t out_type = TEEC_MEMREF_PARTIAL_OUTPUT;
+    uint32_t err_origin;
+    TEEC_Operation op;
+    TEEC_Result res;
+    uint8_t *table;
+
+    // Entries that add to the output need it passed in as well.
+    for (uint32_t i = 0; i < hdr->count; i++)
+    {
+        if (entries[i].flags & LORA_ENTRY_ADD)
+        {
+            out_shm.flags |= TEEC_MEM_INPUT;
+            out_type = TEEC_MEMREF_PARTIAL_INOUT;
+            break;
+        }
+    }
+
+    // The TA takes the header and entries as one buffer.
+    table = malloc(table_size);
+    if (!table)
+        return TEEC_ERROR_OUT_OF_MEMORY;
+    memcpy(table, hdr, sizeof(*hdr));
+    memcpy(table + sizeof(*hdr), entries, table_size - sizeof(*hdr));
+
+    res = TEEC_RegisterSharedMemory(&ol->ctx, &in_shm);
+    if (res != TEEC_SUCCESS)
+        goto out;
+    res = TEEC_RegisterSharedMemory(&ol->ctx, &out_shm);
+    if (res == TEEC_SUCCESS)
+    {
+        memset(&op, 0, sizeof(op));
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, out_type,
+                                         TEEC_MEMREF_TEMP_INPUT, TEEC_NONE);
+        op.params[0].memref.parent = &in_shm;
+        op.params[0].memref.size = input_size;
+        op.params[1].memref.parent = &out_shm;
+        op.params[1].memref.size = output_size;
+        op.params[2].tmpref.buffer = table;
+        op.params[2].tmpref.size = table_size;
+        res = TEEC_InvokeCommand(&ol->session, TA_OPTEE_LLM_CMD_LORA_MULTI,
+                                 &op, origin ? origin : &err_origin);
+        TEEC_ReleaseSharedMemory(&out_shm);
+    }
+    TEEC_ReleaseSharedMemory(&in_shm);
+out:
+    free(table);
+    return res;
+}
+
+// A queued request's destination, kept host side per slot.
+struct ring_request {
+    void *output;
+    size_t output_size;
+    TEEC_Result *status;
+};
+
+struct opteellm_ring {
+    struct opteellm *ol;
+    TEEC_SharedMemory shm;
+    pthread_mutex_t lock;
+    size_t data_start;          // first byte after the slot table
+    size_t data_used;           // bytes of the data area taken so far
+    struct ring_request *requests;
+};
+
+// Spans in the ring are 8-byte aligned so any dtype lands aligned.
+#define RING_ALIGN(x)       (((x) + 7) & ~(size_t)7)
+
+TEEC_Result opteellm_ring_create(struct opteellm *ol, uint32_t slots,
+                                 size_t data_size,
+                                 struct opteellm_ring **out)
+{
+    struct opteellm_ring *ring;
+    lora_ring_hdr_t *hdr;
+    TEEC_Result res;
+
+    if (slots == 0 || slots > LORA_RING_MAX_SLOTS)
+        return TEEC_ERROR_BAD_PARAMETERS;
+    ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return TEEC_ERROR_OUT_OF_MEMORY;
+    ring->requests = calloc(slots, sizeof(*ring->requests));
+    if (!ring->requests)
+    {
+        free(ring);
+        return TEEC_ERROR_OUT_OF_MEMORY;
+    }
+
+    ring->ol = ol;
+    ring->data_start = RING_ALIGN(sizeof(*hdr) +
+                                  slots * sizeof(lora_ring_slot_t));
+    ring->shm.size = ring->data_start + RING_ALIGN(data_size);
+    ring->shm.flags = TEEC_MEM_INPUT | TEEC_MEM_OUTPUT;
+    res = TEEC_AllocateSharedMemory(&ol->ctx, &ring->shm);
+    if (res != TEEC_SUCCESS)
+    {
+        free(ring->requests);
+        free(ring);
+        return res;
+    }
+    memset(ring->shm.buffer, 0, ring->data_start);
+    hdr = ring->shm.buffer;
+    hdr->slots = slots;
+
+    pthread_mutex_init(&ring->lock, NULL);
+    *out = ring;
+    return TEEC_SUCCESS;
+}
+
+void opteellm_ring_destroy(struct opteellm_ring *ring)
+{
+    pthread_mutex_destroy(&ring->lock);
+    TEEC_ReleaseSharedMemory(&ring->shm);
+    free(ring->requests);
+    free(ring);
+}
+
+// Take len bytes of the ring's data area, or return 0 if it is full.
+static size_t ring_take(struct opteellm_ring *ring, size_t len)
+{
+    const size_t offset = ring->data_start + ring->data_used;
+
+    if (RING_ALIGN(len) > ring->shm.size - offset)
+        return 0;
+    ring->data_used += RING_ALIGN(len);
+    return offset;
+}
+
+TEEC_Result opteellm_ring_push(struct opteellm_ring *ring,
+                               const tensor_dims_t *dims, size_t dims_size,
+                               const void *input, void *output,
+                               size_t output_size, TEEC_Result *status)
+{
+    const uint32_t *offsets = NULL;
+    lora_ring_hdr_t *hdr = ring->shm.buffer;
+    lora_ring_slot_t *slot;
+    uint8_t *base = ring->shm.buffer;
+    size_t dims_offset, input_offset, output_offset, used, input_size;
+    uint64_t needed = sizeof(*dims);
+    TEEC_Result res = TEEC_ERROR_BUSY;
+
+    // The offsets and the prefix after dims must be there before they
+    // are read to size the input.
+    if (dims_size < needed)
+        return TEEC_ERROR_BAD_PARAMETERS;
+    if (dims->flags & LORA_FLAG_RAGGED)
+    {
+        offsets = (const uint32_t *)(dims + 1);
+        needed += ((uint64_t)dims->batch_size + 1) * sizeof(uint32_t);
+    }
+    if (dims->flags & LORA_FLAG_PREFIX)
+        needed += sizeof(lora_prefix_t);
+    if (dims_size < needed)
+        return TEEC_ERROR_BAD_PARAMETERS;
+
+    input_size = input_bytes(dims, offsets);
+    if (input_size > UINT32_MAX || output_size > UINT32_MAX)
+        return TEEC_ERROR_BAD_PARAMETERS;
+
+    pthread_mutex_lock(&ring->lock);
+    if (hdr->head - hdr->tail == hdr->slots)
+        goto out;
+    // Spans are taken in order; a request that does not fit takes none.
+    used = ring->data_used;
+    dims_offset = ring_take(ring, dims_size);
+    input_offset = dims_offset ? ring_take(ring, input_size) : 0;
+    output_offset = input_offset ? ring_take(ring, output_size) : 0;
+    if (!output_offset)
+    {
+        // Draining would not make room for it either.
+        if (!used)
+            res = TEEC_ERROR_SHORT_BUFFER;
+        ring->data_used = used;
+        goto out;
+    }
+
+    memcpy(base + dims_offset, dims, dims_size);
+    memcpy(base + input_offset, input, input_size);
+    slot = (lora_ring_slot_t *)(hdr + 1) + hdr->head % hdr->slots;
+    slot->dims_offset = dims_offset;
+    slot->dims_size = dims_size;
+    slot->input_offset = input_offset;
+    slot->input_size = input_size;
+    slot->output_offset = output_offset;
+    slot->output_size = output_size;
+    slot->status = TEEC_SUCCESS;
+    slot->reserved = 0;
+    ring->requests[hdr->head % hdr->slots] = (struct ring_request){
+        .output = output,
+        .output_size = output_size,
+        .status = status,
+    };
+    hdr->head++;
+    res = TEEC_SUCCESS;
+out:
+    pthread_mutex_unlock(&ring->lock);
+    return res;
+}
+
+TEEC_Result opteellm_ring_drain(struct opteellm_ring *ring, uint32_t *served,
+                                uint32_t *origin)
+{
+    lora_ring_hdr_t *hdr = ring->shm.buffer;
+    const lora_ring_slot_t *slots = (const lora_ring_slot_t *)(hdr + 1);
+    const uint8_t *base = ring->shm.buffer;
+    uint32_t err_origin;
+    TEEC_Operation op;
+    TEEC_Result res = TEEC_SUCCESS;
+
+    uint32_t tail;
+
+    pthread_mutex_lock(&ring->lock);
+    tail = hdr->tail;
+    if (hdr->head != tail)
+    {
+        memset(&op, 0, sizeof(op));
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_WHOLE,
+                                         TEEC_VALUE_OUTPUT,
+                                         TEEC_NONE, TEEC_NONE);
+        op.params[0].memref.parent = &ring->shm;
+        res = TEEC_InvokeCommand(&ring->ol->session,
+                                 TA_OPTEE_LLM_CMD_LORA_RING_DRAIN, &op,
+                                 origin ? origin : &err_origin);
+    }
+    if (served)
+        *served = res == TEEC_SUCCESS ? hdr->tail - tail : 0;
+
+    // Hand each served request its output and status.
+    for (uint32_t i = tail; res == TEEC_SUCCESS && i != hdr->tail; i++)
+    {
+        const lora_ring_slot_t *slot = &slots[i % hdr->slots];
+        const struct ring_request *req = &ring->requests[i % hdr->slots];
+
+        if (slot->status == TEEC_SUCCESS)
+            memcpy(req->output, base + slot->output_offset, req->output_size);
+        if (req->status)
+            *req->status = slot->status;
+    }
+    if (hdr->head == hdr->tail)
+        ring->data_used = 0;
+    pthread_mutex_unlock(&ring->lock);
+    return res;
+}
+
+TEEC_Result opteellm_train(struct opteellm *ol, const lora_train_step_t *step,
+                           const void *input, size_t input_size,
+                           const void *grad, size_t grad_size,
+                           uint32_t *origin)
+{
+    TEEC_SharedMemory in_shm = {
+        .buffer = (void *)input,
+        .size = input_size,
+        .flags = TEEC_MEM_INPUT,
+    };
+    TEEC_SharedMemory grad_shm = {
+        .buffer = (void *)grad,
+        .size = grad_size,
+        .flags = TEEC_MEM_INPUT,
+    };
+    uint32_t err_origin;
+    TEEC_Operation op;
+    TEEC_Result res;
+
+    res = TEEC_RegisterSharedMemory(&ol->ctx, &in_shm);
+    if (res != TEEC_SUCCESS)
+        return res;
+    res = TEEC_RegisterSharedMemory(&ol->ctx, &grad_shm);
+    if (res == TEEC_SUCCESS)
+    {
+        memset(&op, 0, sizeof(op));
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+                                         TEEC_MEMREF_PARTIAL_INPUT,
+                                         TEEC_MEMREF_TEMP_INPUT, TEEC_NONE);
+        op.params[0].memref.parent = &in_shm;
+        op.params[0].memref.size = input_size;
+        op.params[1].memref.parent = &grad_shm;
+        op.params[1].memref.size = grad_size;
+        op.params[2].tmpref.buffer = (void *)step;
+        op.params[2].tmpref.size = sizeof(*step);
+        res = TEEC_InvokeCommand(&ol->session, TA_OPTEE_LLM_CMD_LORA_TRAIN,
+                                 &op, origin ? origin : &err_origin);
+        TEEC_ReleaseSharedMemory(&grad_shm);
+    }
+    TEEC_ReleaseSharedMemory(&in_shm);
+    return res;
+}
+
+TEEC_Result opteellm_prefix_stats(struct opteellm *ol,
+                                  lora_prefix_stats_t *stats)
+{
+    TEEC_Operation op;
+    uint32_t err_origin;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE,
+                                     TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = stats;
+    op.params[0].tmpref.size = sizeof(*stats);
+    return TEEC_InvokeCommand(&ol->session,
+                              TA_OPTEE_LLM_CMD_LORA_PREFIX_STATS, &op,
+                              &err_origin);
+}
+
+TEEC_Result opteellm_stats(struct opteellm *ol, uint32_t ops,
+                           lora_stats_t *stats)
+{
+    TEEC_Operation op;
+    uint32_t err_origin;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(stats ? TEEC_MEMREF_TEMP_OUTPUT :
+                                             TEEC_NONE,
+                                     TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = stats;
+    op.params[0].tmpref.size = sizeof(*stats);
+    op.params[1].value.a = ops;
+    return TEEC_InvokeCommand(&ol->session, TA_OPTEE_LLM_CMD_LORA_STATS, &op,
+                              &err_origin);
+}
@@ -40,15 +40,250 @@ typedef struct {
     uint32_t batch_size;
     uint32_t seq_length;
     uint32_t in_channels;
+    uint32_t flags;         // LORA_FLAG_* request flags
+    uint32_t adapter_id;    // registry ID of the adapter to apply
+    uint32_t output_mode;   // LORA_OUT_*
+    uint32_t input_dtype;   // LORA_DTYPE_* of the input tensor
+    uint32_t output_dtype;  // LORA_DTYPE_* of the output tensor
 } tensor_dims_t;
 
-// Fixed dimensions for the LoRA branch (expected input channels)
+// Tensor element types (tensor_dims_t.input_dtype/output_dtype). Half
+// precision inputs are widened as the kernels load them and all
+// accumulation is fp32; half precision outputs are rounded to nearest even.
+#define LORA_DTYPE_F32		0
+#define LORA_DTYPE_F16		1	// IEEE 754 binary16
+#define LORA_DTYPE_BF16		2	// bfloat16
+
+// Bytes per element of a LORA_DTYPE_* tensor, or 0 for an unknown dtype.
+static inline uint32_t lora_dtype_size(uint32_t dtype)
+{
+    switch (dtype) {
+    case LORA_DTYPE_F32:
+        return 4;
+    case LORA_DTYPE_F16:
+    case LORA_DTYPE_BF16:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+// Output modes (tensor_dims_t.output_mode). LORA_OUT_TOKENS returns the
+// LoRA delta of every token, [batch_size][seq_length][out_channels]; the
+// others pool each sample's tokens into [batch_size][out_channels].
+#define LORA_OUT_MEAN		0	// mean over the sequence
+#define LORA_OUT_TOKENS		1	// per-token delta
+#define LORA_OUT_LAST		2	// last token only
+#define LORA_OUT_MAX		3	// element-wise max over the sequence
+
+// Request flags (tensor_dims_t.flags). The TA rejects any other bit with
+// TEE_ERROR_BAD_PARAMETERS.
+// Mean pooling normally projects the mean token once; this flag forces the
+// per-token reference path that projects every token and then averages.
+#define LORA_FLAG_REFERENCE	(1 << 0)
+// Ragged batch: samples have their own lengths and are packed back to back
+// with no padding. The dims memref (param2 of TA_OPTEE_LLM_CMD_LORA) is
+// followed by batch_size + 1 uint32_t token offsets; sample s is tokens
+// [offsets[s], offsets[s + 1]) of the packed [offsets[batch_size]]
+// [in_channels] input. offsets[0] is 0 and every sample has 1 to
+// max_seq_length tokens; seq_length is ignored. LORA_OUT_TOKENS output is
+// packed the same way, [offsets[batch_size]][out_channels].
+#define LORA_FLAG_RAGGED	(1 << 1)
+// Shared prefix: the first prefix.tokens tokens of every sample are the
+// same prompt prefix, named by a hash the host computes over them. A
+// lora_prefix_t follows the dims, after any ragged offsets, in the dims
+// memref. The TA keeps the rank-space state of each prefix it sees (the
+// per-token lora_B projections, their sum, the last one and the max
+// output) in a per-session cache, so a request whose prefix is cached, and
+// every sample after the first in a batch, only projects its suffix.
+// Equal hashes must mean equal prefix tokens; the TA does not check.
+#define LORA_FLAG_PREFIX	(1 << 2)
+
+typedef struct {
+    uint64_t hash;          // host hash of the prefix tokens
+    uint32_t tokens;        // prefix length, 1 to the shortest sample
+    uint32_t reserved;      // zero
+} lora_prefix_t;
+
+// Default adapter shape, used when TA_OPTEE_LLM_CMD_LORA_LOAD is not given a
+// descriptor. Other shapes are described by lora_adapter_desc_t.
 #define IN_CHANNELS 2048
 #define RANK 4
 #define OUT_CHANNELS 3
 #define MAX_BATCH_SIZE 8
 #define MAX_SEQ_LENGTH 128
 
+// Adapter weight formats (lora_adapter_desc_t.format)
+#define LORA_FMT_F32	0	// float lora_B and lora_A
+#define LORA_FMT_Q8	1	// int8 lora_B and lora_A, one scale per row
+#define LORA_FMT_Q4	2	// int4 lora_B, one scale per LORA_Q4_GROUP
+				// inputs of a row; lora_A as in LORA_FMT_Q8
+#define LORA_Q4_GROUP	32
+
+// Limits on the adapter shape accepted by the TA. With them a request of
+// up to LORA_MAX_BATCH x LORA_MAX_SEQ tokens has tensors below 2^46 bytes,
+// so their sizes cannot wrap when computed in 64 bits.
+#define LORA_MAX_CHANNELS	65536
+#define LORA_MAX_RANK		256
+#define LORA_MAX_BATCH		4096
+#define LORA_MAX_SEQ		65536
+
+// Describes the adapter passed to TA_OPTEE_LLM_CMD_LORA_LOAD (param2): its
+// weight format, its shape, and the largest request it must serve.
+typedef struct {
+    uint32_t format;        // LORA_FMT_*
+    uint32_t in_channels;
+    uint32_t out_channels;
+    uint32_t rank;
+    uint32_t max_batch_size;    // 1 to LORA_MAX_BATCH
+    uint32_t max_seq_length;    // 1 to LORA_MAX_SEQ
+} lora_adapter_desc_t;
+
+// Serialized adapter layout for an adapter with IN = in_channels,
+// OUT = out_channels and R = rank, all matrices row-major. A dequantized
+// weight is q * scale.
+//  LORA_FMT_F32: float lora_B[R][IN]
+//                float lora_A[OUT][R]
+//  LORA_FMT_Q8:  int8  lora_B[R][IN]
+//                int8  lora_A[OUT][R], padded to 4 bytes
+//                float B_scale[R]
+//                float A_scale[OUT]
+//  LORA_FMT_Q4:  lora_B rows of IN / LORA_Q4_GROUP blocks of 16 bytes;
+//                byte j of a block holds input j in its low nibble and
+//                input j + 16 in its high nibble, each stored as q + 8
+//                int8  lora_A[OUT][R], padded to 4 bytes
+//                float B_scale[R][IN / LORA_Q4_GROUP]
+//                float A_scale[OUT]
+typedef struct {
+    uint32_t B;             // byte offset of lora_B
+    uint32_t A;             // byte offset of lora_A
+    uint32_t B_scale;       // byte offset of the lora_B scales
+    uint32_t A_scale;       // byte offset of the lora_A scales
+    uint32_t size;          // total size in bytes
+} lora_weights_layout_t;
+
+// Validate desc and fill *layout for it. Returns 0, or -1 if the
+// descriptor is not supported.
+static inline int lora_weights_layout(const lora_adapter_desc_t *desc,
+                                      lora_weights_layout_t *layout)
+{
+    const uint32_t in = desc->in_channels;
+    const uint32_t out = desc->out_channels;
+    const uint32_t rank = desc->rank;
+    uint32_t b_size;
+
+    if (!in || in > LORA_MAX_CHANNELS || !out || out > LORA_MAX_CHANNELS ||
+        !rank || rank > LORA_MAX_RANK ||
+        !desc->max_batch_size || desc->max_batch_size > LORA_MAX_BATCH ||
+        !desc->max_seq_length || desc->max_seq_length > LORA_MAX_SEQ)
+        return -1;
+
+    switch (desc->format) {
+    case LORA_FMT_F32:
+        layout->B = 0;
+        layout->A = rank * in * sizeof(float);
+        layout->B_scale = layout->A_scale = 0;
+        layout->size = layout->A + out * rank * sizeof(float);
+        return 0;
+    case LORA_FMT_Q8:
+        b_size = rank * in;
+        layout->B_scale = (b_size + out * rank + 3) & ~3u;
+        layout->A_scale = layout->B_scale + rank * sizeof(float);
+        break;
+    case LORA_FMT_Q4:
+        if (in % LORA_Q4_GROUP)
+            return -1;
+        b_size = rank * in / 2;
+        layout->B_scale = (b_size + out * rank + 3) & ~3u;
+        layout->A_scale = layout->B_scale +
+            rank * (in / LORA_Q4_GROUP) * sizeof(float);
+        break;
+    default:
+        return -1;
+    }
+    layout->B = 0;
+    layout->A = b_size;
+    layout->size = layout->A_scale + out * sizeof(float);
+    return 0;
+}
+
+// Weight sources for TA_OPTEE_LLM_CMD_LORA_LOAD (param0 value.a). The
+// adapter format and shape come from the optional descriptor in param2
+// (default: LORA_FMT_F32 with the default shape above), the adapter ID from
+// the optional param3 value.a (default 0).
+#define LORA_WEIGHTS_RANDOM	0	// placeholder random weights
+#define LORA_WEIGHTS_MEMREF	1	// serialized adapter in param1
+#define LORA_WEIGHTS_STORAGE	2	// adapter persisted in secure storage
+
+// Load flags for TA_OPTEE_LLM_CMD_LORA_LOAD (param0 value.b)
+#define LORA_LOAD_PERSIST	(1 << 0)	// also write to secure storage
+
+// Loaded adapters live in a per-session registry keyed by adapter ID. The
+// registry keeps adapters resident up to a secure-memory budget and evicts
+// the least recently used one to make room. A request for an adapter that
+// is not resident reloads it from secure storage, so only adapters loaded
+// with LORA_LOAD_PERSIST survive eviction.
+#define LORA_CACHE_DEFAULT_BUDGET	(512 * 1024)
+
+// Registry counters returned by TA_OPTEE_LLM_CMD_LORA_CACHE_STATS (param0)
+typedef struct {
+    uint64_t hits;          // requests served by a resident adapter
+    uint64_t misses;        // requests that had to reload from storage
+    uint64_t evictions;     // adapters dropped to stay within budget
+    uint32_t resident;      // adapters currently resident
+    uint32_t resident_bytes;// secure memory held by resident adapters
+    uint32_t budget_bytes;  // current budget
+    uint32_t reserved;
+} lora_cache_stats_t;
+
+// Phases of a TA_OPTEE_LLM_CMD_LORA request, indexing lora_timing_t and the
+// histograms of lora_stats_t. LORA_PHASE_TOTAL is the whole request.
+#define LORA_PHASE_LOOKUP	0	// adapter lookup, with any storage reload
+#define LORA_PHASE_VALIDATE	1	// dimension and buffer checks
+#define LORA_PHASE_REDUCE	2	// pooling the sequence into one token
+#define LORA_PHASE_MATMUL_B	3	// lora_B projections (all of a merged
+					// adapter's projection)
+#define LORA_PHASE_MATMUL_A	4	// lora_A projections
+#define LORA_PHASE_OUTPUT	5	// output writes and rounding; fp32
+					// LORA_OUT_TOKENS rows are written by
+					// LORA_PHASE_MATMUL_A directly
+#define LORA_PHASE_SCALE	6	// request-level scaling (multi
+					// entries with a scale other than 1)
+#define LORA_PHASE_PREFIX	7	// prefix cache lookup and insertion;
+					// projecting a new prefix counts as
+					// LORA_PHASE_MATMUL_B/_A
+#define LORA_PHASE_TOTAL	8
+#define LORA_PHASE_COUNT	9
+
+// Optional per-request timing: pass a lora_timing_t as param3
+// (MEMREF_OUTPUT) of TA_OPTEE_LLM_CMD_LORA. Requests are only timed when
+// they ask to be or after LORA_STATS_TIMING_ON.
+typedef struct {
+    uint64_t phase_ns[LORA_PHASE_COUNT];
+} lora_timing_t;
+
+// Latency histograms are log2 buckets: bucket 0 counts 0 ns, bucket b
+// counts [2^(b-1), 2^b) ns and the last bucket also counts anything longer.
+#define LORA_HIST_BUCKETS	40
+
+// Counters since the TA instance was created, returned by
+// TA_OPTEE_LLM_CMD_LORA_STATS. They cover successful TA_OPTEE_LLM_CMD_LORA
+// requests; the phase totals and histograms only the timed ones.
+typedef struct {
+    uint64_t invocations;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t timed;
+    uint64_t phase_ns[LORA_PHASE_COUNT];
+    uint32_t hist[LORA_PHASE_COUNT][LORA_HIST_BUCKETS];
+} lora_stats_t;
+
+// Operations for TA_OPTEE_LLM_CMD_LORA_STATS (param1 value.a), applied
+// after the counters are copied out
+#define LORA_STATS_TIMING_ON	(1 << 0)	// time every request
+#define LORA_STATS_TIMING_OFF	(1 << 1)	// time only requests that ask
+#define LORA_STATS_RESET	(1 << 2)	// zero the counters
+
 #define TA_OPTEE_LLM_UUID \
 	{ 0x522fa39d, 0xb734, 0x4b30, \
 		{ 0x9c, 0x5a, 0x57, 0x41, 0xdb, 0x20, 0x84, 0xae} }
@@ -57,5 +292,244 @@ typedef struct {
 #define TA_OPTEE_LLM_CMD_INC_VALUE		0			// CHANGED THE NAME OF THE FUNCTIONS
 #define TA_OPTEE_LLM_CMD_DEC_VALUE		1
 #define TA_OPTEE_LLM_CMD_LORA		        2
+#define TA_OPTEE_LLM_CMD_LORA_LOAD		3
+#define TA_OPTEE_LLM_CMD_LORA_CACHE_STATS	4	// param0: MEMREF_OUTPUT stats
+#define TA_OPTEE_LLM_CMD_LORA_CACHE_BUDGET	5	// param0: VALUE_INPUT a = bytes
+
+// Streaming inference: the sequence arrives in chunks and the TA keeps the
+// running sums and token count between invocations, so sequence length is
+// not bounded by max_seq_length or by the size of one shared buffer.
+//  BEGIN:    param0 MEMREF_INPUT tensor_dims_t; seq_length is ignored and
+//            LORA_OUT_TOKENS is not supported, since tokens need no state
+//            across chunks: send each chunk to TA_OPTEE_LLM_CMD_LORA instead;
+//            nor are LORA_FLAG_RAGGED and LORA_FLAG_PREFIX
+//  APPEND:   param0 MEMREF_INPUT [batch_size][tokens][in_channels] of the
+//            input_dtype given at BEGIN,
+//            param1 VALUE_INPUT a = tokens in this chunk
+//  FINALIZE: param0 MEMREF_OUTPUT [batch_size][out_channels] of output_dtype
+// A session has at most one stream; BEGIN discards any unfinished one.
+// APPEND and FINALIZE return TEE_ERROR_BAD_STATE once the adapter has been
+// reloaded, replaced, trained or evicted since BEGIN.
+#define TA_OPTEE_LLM_CMD_LORA_STREAM_BEGIN	6
+#define TA_OPTEE_LLM_CMD_LORA_STREAM_APPEND	7
+#define TA_OPTEE_LLM_CMD_LORA_STREAM_FINALIZE	8
+// param0: MEMREF_OUTPUT lora_stats_t or NONE,
+// param1: VALUE_INPUT a = LORA_STATS_* operations or NONE
+#define TA_OPTEE_LLM_CMD_LORA_STATS		9
+
+// Fused multi-adapter invocation: a table of adapters, e.g. the q/k/v/o
+// projections of every layer, applied in one world switch.
+//  param0: MEMREF_INPUT  inputs; entry i reads [tokens][in_channels of its
+//          adapter] at input_offset
+//  param1: MEMREF_OUTPUT or MEMREF_INOUT outputs; entry i writes (or with
+//          LORA_ENTRY_ADD, adds to) [tokens][out_channels] at output_offset
+//  param2: MEMREF_INPUT lora_multi_hdr_t followed by count lora_multi_entry_t
+// Every entry produces the per-token delta, as LORA_OUT_TOKENS. Offsets are
+// in bytes and must be aligned to the element size. Entries run in table
+// order, so an entry may read what an earlier one wrote only through the
+// caller's own buffers, not within one invocation.
+#define TA_OPTEE_LLM_CMD_LORA_MULTI		10
+
+#define LORA_MULTI_MAX_ENTRIES	1024
+
+typedef struct {
+    uint32_t count;         // lora_multi_entry_t that follow
+    uint32_t tokens;        // rows of every entry's input and output
+    uint32_t input_dtype;   // LORA_DTYPE_* of param0
+    uint32_t output_dtype;  // LORA_DTYPE_* of param1
+} lora_multi_hdr_t;
+
+// Entry flags (lora_multi_entry_t.flags)
+#define LORA_ENTRY_ADD		(1 << 0)	// add the delta to the output
+						// (param1 must be MEMREF_INOUT)
+
+typedef struct {
+    uint32_t adapter_id;
+    uint32_t flags;         // LORA_ENTRY_*
+    uint32_t input_offset;
+    uint32_t output_offset;
+    float scale;            // multiplies the delta
+} lora_multi_entry_t;
+
+// Sealed adapter upload: real weights, encrypted and integrity protected,
+// streamed in chunks so neither side needs the whole adapter in one memref.
+// A sealed blob is a lora_sealed_hdr_t followed by the serialized adapter
+// (the LORA_WEIGHTS_MEMREF layout of hdr.desc) cut into chunks of
+// hdr.chunk_size bytes, the last one shorter if need be. Chunk i is sealed
+// with AES-256-GCM under the upload key:
+//   nonce = hdr.nonce || i as a 32-bit big-endian integer (12 bytes)
+//   AAD   = lora_sealed_aad_t: the header, the adapter ID the blob is
+//           sealed for and its number of chunks
+//   data  = ciphertext followed by the LORA_SEALED_TAG_SIZE byte tag
+// The TA decrypts and verifies each chunk as it arrives, straight into the
+// adapter's weight buffer. Use a fresh nonce for every blob sealed under
+// one key.
+//  UPLOAD_KEY:   param0 MEMREF_INPUT lora_key_wrap_t. The upload key never
+//                crosses the normal world in the clear: it arrives wrapped
+//                and the TA unwraps it into secure storage (see below)
+//  UPLOAD_BEGIN: param0 VALUE_INPUT a = adapter ID, b = LORA_LOAD_* flags,
+//                param1 MEMREF_INPUT lora_sealed_hdr_t
+//  UPLOAD_CHUNK: param0 MEMREF_INPUT sealed chunk,
+//                param1 VALUE_INPUT a = chunk index; chunks go in order and
+//                the last one adds the adapter to the registry (and to
+//                secure storage with LORA_LOAD_PERSIST)
+// A session has at most one upload; BEGIN discards any unfinished one and
+// a chunk that fails to verify (TEE_ERROR_MAC_INVALID) ends it. An adapter
+// already loaded under the ID keeps serving until the last chunk verifies
+// and only then is replaced, so a bad or abandoned upload leaves it be.
+#define TA_OPTEE_LLM_CMD_LORA_UPLOAD_KEY	11
+#define TA_OPTEE_LLM_CMD_LORA_UPLOAD_BEGIN	12
+#define TA_OPTEE_LLM_CMD_LORA_UPLOAD_CHUNK	13
+
+#define LORA_SEALED_MAGIC	0x4c45534c	// "LSEL"
+#define LORA_SEALED_VERSION	2
+#define LORA_SEALED_KEY_SIZE	32
+#define LORA_SEALED_TAG_SIZE	16
+#define LORA_SEALED_NONCE_SIZE	12
+#define LORA_SEALED_MIN_CHUNK	4096
+#define LORA_SEALED_MAX_CHUNK	(1024 * 1024)
+
+typedef struct {
+    uint32_t magic;         // LORA_SEALED_MAGIC
+    uint32_t version;       // LORA_SEALED_VERSION
+    lora_adapter_desc_t desc;
+    uint32_t chunk_size;    // plaintext bytes per chunk
+    uint32_t reserved;      // zero
+    uint8_t nonce[8];       // per-blob nonce prefix
+} lora_sealed_hdr_t;
+
+// Authenticated with every chunk, so a blob sealed for one adapter ID
+// cannot be uploaded as another.
+typedef struct {
+    lora_sealed_hdr_t hdr;
+    uint32_t adapter_id;    // the ID given to UPLOAD_BEGIN
+    uint32_t chunks;        // chunks in the blob
+} lora_sealed_aad_t;
+
+// Wrapped upload key. The new key is sealed with AES-256-GCM:
+//   nonce = nonce, AAD = the fields before it, data = key, tag = tag
+// under one of two keys, named by wrapping:
+//  LORA_KEY_WRAP_PROVISION: the TA's provisioning key, a secret built into
+//    the TA (CFG_LORA_PROVISION_KEY) and held by whoever provisions the
+//    devices. Installs the first key, or resets a lost or compromised one.
+//    A TA built without it accepts only rotations.
+//  LORA_KEY_WRAP_CURRENT: the upload key now stored, to rotate it.
+// epoch must exceed that of the stored key, so an old wrapped key cannot
+// be replayed to roll back a rotation. A key that fails to unwrap returns
+// TEE_ERROR_MAC_INVALID, a stale epoch TEE_ERROR_ACCESS_CONFLICT and a
+// rotation with no key stored TEE_ERROR_ITEM_NOT_FOUND.
+#define LORA_KEY_WRAP_MAGIC	0x4b45534c	// "LSEK"
+#define LORA_KEY_WRAP_PROVISION	0
+#define LORA_KEY_WRAP_CURRENT	1
+
+typedef struct {
+    uint32_t magic;         // LORA_KEY_WRAP_MAGIC
+    uint32_t wrapping;      // LORA_KEY_WRAP_*
+    uint32_t epoch;         // above the stored key's; the first is >= 1
+    uint32_t reserved;      // zero
+    uint8_t nonce[LORA_SEALED_NONCE_SIZE];
+    uint8_t key[LORA_SEALED_KEY_SIZE];  // the new key, encrypted
+    uint8_t tag[LORA_SEALED_TAG_SIZE];
+} lora_key_wrap_t;
+
+// Prefix cache (LORA_FLAG_PREFIX): entries are keyed by adapter, input
+// dtype, prefix hash and length, held to a secure-memory budget and
+// evicted least recently used first. A budget of 0 disables the cache.
+//  PREFIX_STATS:  param0 MEMREF_OUTPUT lora_prefix_stats_t
+//  PREFIX_BUDGET: param0 VALUE_INPUT a = budget in bytes
+#define TA_OPTEE_LLM_CMD_LORA_PREFIX_STATS	14
+#define TA_OPTEE_LLM_CMD_LORA_PREFIX_BUDGET	15
+
+#define LORA_PREFIX_DEFAULT_BUDGET	(64 * 1024)
+
+typedef struct {
+    uint64_t hits;          // prefixes served from the cache
+    uint64_t misses;        // prefixes that had to be projected
+    uint64_t evictions;     // entries dropped to stay within budget
+    uint32_t entries;       // prefixes currently cached
+    uint32_t resident_bytes;// secure memory held by the entries
+    uint32_t budget_bytes;  // current budget
+    uint32_t reserved;
+} lora_prefix_stats_t;
+
+// Request ring: a long-lived shared buffer of queued inference requests,
+// all served in one world switch. The buffer holds a lora_ring_hdr_t, then
+// hdr.slots lora_ring_slot_t, then the requests' dims, inputs and outputs.
+// The host fills slot head % slots and increments head (head and tail wrap
+// at 2^32 and are never more than slots apart); DRAIN serves the slots from
+// tail up to head in order, writes each one's status, sets tail to head and
+// returns. A slot's dims span is laid out as the dims memref of
+// TA_OPTEE_LLM_CMD_LORA, ragged offsets and lora_prefix_t included. Slot
+// offsets are bytes from the start of the ring, past the slot table and
+// multiples of 4. A request that fails records its status and the drain
+// goes on with the next one.
+//  RING_DRAIN: param0 MEMREF_INOUT ring,
+//              param1 VALUE_OUTPUT a = requests served, b = of those, the
+//              ones that failed
+#define TA_OPTEE_LLM_CMD_LORA_RING_DRAIN	16
+
+#define LORA_RING_MAX_SLOTS	256
+
+typedef struct {
+    uint32_t slots;         // lora_ring_slot_t that follow
+    uint32_t head;          // requests queued, written by the host
+    uint32_t tail;          // requests served, written by the TA
+    uint32_t reserved;      // zero
+} lora_ring_hdr_t;
+
+typedef struct {
+    uint32_t dims_offset;
+    uint32_t dims_size;
+    uint32_t input_offset;
+    uint32_t input_size;
+    uint32_t output_offset;
+    uint32_t output_size;
+    uint32_t status;        // TEE_Result of the request, written by the TA
+    uint32_t reserved;      // zero
+} lora_ring_slot_t;
+
+// On-device fine-tuning: one optimizer step on a batch of tokens, applied
+// in place to a resident LORA_FMT_F32 adapter's lora_A and lora_B. The TA
+// runs the forward pass of each token, keeps its rank-space projection and
+// uses it at once in the backward pass, so the batch is read once and
+// nothing is recomputed. Gradients are summed over the tokens; scale the
+// upstream gradients for a mean loss.
+//  TRAIN: param0 MEMREF_INPUT [tokens][in_channels] input of input_dtype,
+//         param1 MEMREF_INPUT [tokens][out_channels] gradient of the loss
+//         with respect to each token's LoRA delta (the LORA_OUT_TOKENS
+//         output), of grad_dtype,
+//         param2 MEMREF_INPUT lora_train_step_t
+// Optimizer state (the Adam moments and step count) lives with the
+// adapter in the session's registry and counts against its budget
+// (TA_OPTEE_LLM_CMD_LORA_CACHE_BUDGET); it follows one load of the
+// adapter, and reloading or evicting it starts the state over.
+// Trained weights are resident only; an adapter that is evicted reloads
+// what is in secure storage unless LORA_TRAIN_PERSIST wrote them there.
+#define TA_OPTEE_LLM_CMD_LORA_TRAIN		17
+
+// Optimizers (lora_train_step_t.optimizer)
+#define LORA_OPT_SGD		0	// w -= lr * (g + weight_decay * w)
+#define LORA_OPT_ADAM		1	// Adam with bias correction and
+					// decoupled weight decay (AdamW)
+
+// Step flags (lora_train_step_t.flags)
+#define LORA_TRAIN_RESET	(1 << 0)	// start the optimizer state over
+#define LORA_TRAIN_PERSIST	(1 << 1)	// write the updated adapter to
+						// secure storage
+
+typedef struct {
+    uint32_t adapter_id;
+    uint32_t tokens;
+    uint32_t input_dtype;   // LORA_DTYPE_* of param0
+    uint32_t grad_dtype;    // LORA_DTYPE_* of param1
+    uint32_t optimizer;     // LORA_OPT_*
+    uint32_t flags;         // LORA_TRAIN_*
+    float lr;               // > 0 and finite
+    float beta1;            // LORA_OPT_ADAM moment decay rates, in [0, 1)
+    float beta2;
+    float eps;              // LORA_OPT_ADAM, > 0 and finite
+    float weight_decay;     // >= 0 and finite
+    uint32_t reserved;      // zero
+} lora_train_step_t;
 
 #endif /*TA_OPTEE_LLM_H*/
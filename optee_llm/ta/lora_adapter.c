@@ -0,0 +1,420 @@
+/*
+ * LoRA adapter weights held inside the TA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "lora_adapter.h"
+
+// Secure storage object holding the persisted adapter with the given ID.
+struct lora_object_id {
+	char name[sizeof("lora_adapter_00000000")];
+};
+
+static void lora_object_id(uint32_t id, struct lora_object_id *oid)
+{
+	snprintf(oid->name, sizeof(oid->name), "lora_adapter_%08x", id);
+}
+
+#define LORA_OBJECT_MAGIC	0x41524f4c	// "LORA"
+#define LORA_OBJECT_VERSION	2
+
+// Header in front of the serialized weights in the storage object.
+struct lora_object_hdr {
+	uint32_t magic;
+	uint32_t version;
+	lora_adapter_desc_t desc;
+};
+
+TEE_Result lora_adapter_alloc(struct lora_adapter *ad,
+			      const lora_adapter_desc_t *desc)
+{
+	lora_weights_layout_t layout;
+	uintptr_t p;
+
+	if (lora_weights_layout(desc, &layout))
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	lora_adapter_free(ad);
+
+	// TEE_Malloc() only guarantees natural alignment, so over-allocate
+	// and round up to put the weight rows on a cache line boundary for
+	// the SIMD kernels.
+	ad->mem = TEE_Malloc(layout.size + LORA_WEIGHT_ALIGN - 1,
+			     TEE_MALLOC_FILL_ZERO);
+	if (!ad->mem)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	p = ((uintptr_t)ad->mem + LORA_WEIGHT_ALIGN - 1) &
+	    ~(uintptr_t)(LORA_WEIGHT_ALIGN - 1);
+
+	ad->weights = (uint8_t *)p;
+	ad->desc = *desc;
+	ad->layout = layout;
+	return TEE_SUCCESS;
+}
+
+void lora_adapter_free(struct lora_adapter *ad)
+{
+	TEE_Free(ad->mem);
+	TEE_Free(ad->merged_mem);
+	ad->mem = NULL;
+	ad->weights = NULL;
+	ad->merged_mem = NULL;
+	ad->merged = NULL;
+}
+
+static float *weights_f32(const struct lora_adapter *ad, uint32_t offset)
+{
+	return (float *)(ad->weights + offset);
+}
+
+// Scale the random values into the [0, 1) float range without math.h.
+// Cast each float value to an int, apply modulo, then convert to float.
+static void random_unit_floats(float *v, uint32_t n)
+{
+	TEE_GenerateRandom(v, n * sizeof(float));
+	for (uint32_t i = 0; i < n; i++)
+	{
+		int temp = ((int)v[i]) % 100;
+		if (temp < 0)
+			temp += 100;
+		v[i] = temp / 100.0f;
+	}
+}
+
+static void fill_floats(float *v, uint32_t n, float value)
+{
+	for (uint32_t i = 0; i < n; i++)
+		v[i] = value;
+}
+
+void lora_adapter_randomize(struct lora_adapter *ad)
+{
+	const lora_weights_layout_t *l = &ad->layout;
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t rank = ad->desc.rank;
+
+	switch (ad->desc.format)
+	{
+	case LORA_FMT_F32:
+		random_unit_floats(weights_f32(ad, l->B), rank * in);
+		random_unit_floats(weights_f32(ad, l->A), out * rank);
+		break;
+	case LORA_FMT_Q8:
+		// Any byte is a valid code; scales map codes into [-1, 1).
+		TEE_GenerateRandom(ad->weights, l->B_scale);
+		fill_floats(weights_f32(ad, l->B_scale), rank, 1.0f / 128);
+		fill_floats(weights_f32(ad, l->A_scale), out, 1.0f / 128);
+		break;
+	case LORA_FMT_Q4:
+		TEE_GenerateRandom(ad->weights, l->B_scale);
+		fill_floats(weights_f32(ad, l->B_scale),
+			    rank * (in / LORA_Q4_GROUP), 1.0f / 8);
+		fill_floats(weights_f32(ad, l->A_scale), out, 1.0f / 128);
+		break;
+	}
+}
+
+TEE_Result lora_adapter_load_storage(struct lora_adapter *ad, uint32_t id)
+{
+	struct lora_object_hdr hdr;
+	struct lora_object_id oid;
+	TEE_ObjectHandle obj;
+	TEE_Result res;
+	size_t count;
+
+	lora_object_id(id, &oid);
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+				       oid.name, strlen(oid.name),
+				       TEE_DATA_FLAG_ACCESS_READ |
+				       TEE_DATA_FLAG_SHARE_READ, &obj);
+	if (res != TEE_SUCCESS)
+	{
+		EMSG("Failed to open adapter %u, res=0x%08x", id, res);
+		return res;
+	}
+
+	res = TEE_ReadObjectData(obj, &hdr, sizeof(hdr), &count);
+	if (res == TEE_SUCCESS &&
+	    (count != sizeof(hdr) || hdr.magic != LORA_OBJECT_MAGIC ||
+	     hdr.version != LORA_OBJECT_VERSION))
+		res = TEE_ERROR_CORRUPT_OBJECT;
+	if (res == TEE_SUCCESS)
+		res = lora_adapter_alloc(ad, &hdr.desc);
+	if (res == TEE_SUCCESS)
+	{
+		res = TEE_ReadObjectData(obj, ad->weights, ad->layout.size,
+					 &count);
+		if (res == TEE_SUCCESS && count != ad->layout.size)
+			res = TEE_ERROR_CORRUPT_OBJECT;
+	}
+	TEE_CloseObject(obj);
+
+	if (res != TEE_SUCCESS)
+		EMSG("Failed to read adapter %u, res=0x%08x", id, res);
+	return res;
+}
+
+TEE_Result lora_adapter_persist(const struct lora_adapter *ad, uint32_t id)
+{
+	struct lora_object_hdr hdr = {
+		.magic = LORA_OBJECT_MAGIC,
+		.version = LORA_OBJECT_VERSION,
+		.desc = ad->desc,
+	};
+	struct lora_object_id oid;
+	TEE_ObjectHandle obj;
+	TEE_Result res;
+
+	lora_object_id(id, &oid);
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					 oid.name, strlen(oid.name),
+					 TEE_DATA_FLAG_ACCESS_WRITE |
+					 TEE_DATA_FLAG_OVERWRITE,
+					 TEE_HANDLE_NULL, NULL, 0, &obj);
+	if (res != TEE_SUCCESS)
+	{
+		EMSG("Failed to create adapter %u, res=0x%08x", id, res);
+		return res;
+	}
+
+	res = TEE_WriteObjectData(obj, &hdr, sizeof(hdr));
+	if (res == TEE_SUCCESS)
+		res = TEE_WriteObjectData(obj, ad->weights, ad->layout.size);
+	if (res != TEE_SUCCESS)
+	{
+		EMSG("Failed to write adapter %u, res=0x%08x", id, res);
+		TEE_CloseAndDeletePersistentObject1(obj);
+		return res;
+	}
+	TEE_CloseObject(obj);
+	return TEE_SUCCESS;
+}
+
+// Weight bytes taken to cost as much as one multiply-add. Every token of
+// the pooled and last-token paths streams the whole adapter, so bytes
+// count at full weight rather than amortized over a tile.
+#define LORA_COST_PER_BYTE	1
+
+bool lora_adapter_prefers_merged(const lora_adapter_desc_t *desc,
+				 const lora_weights_layout_t *layout)
+{
+	const uint64_t in = desc->in_channels;
+	const uint64_t out = desc->out_channels;
+	const uint64_t rank = desc->rank;
+	const uint64_t factored = rank * (in + out) +
+				  LORA_COST_PER_BYTE * layout->size;
+	const uint64_t merged = out * in +
+				LORA_COST_PER_BYTE * out * in * sizeof(float);
+
+	return merged < factored;
+}
+
+uint32_t lora_adapter_merged_size(const lora_adapter_desc_t *desc)
+{
+	return desc->out_channels * desc->in_channels * sizeof(float) +
+	       LORA_WEIGHT_ALIGN - 1;
+}
+
+// Dequantized lora_B[r][c].
+static float weight_B(const struct lora_adapter *ad, uint32_t r, uint32_t c)
+{
+	const lora_weights_layout_t *l = &ad->layout;
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t groups = in / LORA_Q4_GROUP;
+	const uint32_t j = c % LORA_Q4_GROUP;
+	uint8_t q;
+
+	switch (ad->desc.format)
+	{
+	case LORA_FMT_Q8:
+		return ((const int8_t *)(ad->weights + l->B))[r * in + c] *
+		       weights_f32(ad, l->B_scale)[r];
+	case LORA_FMT_Q4:
+		q = ad->weights[l->B + r * in / 2 +
+				c / LORA_Q4_GROUP * (LORA_Q4_GROUP / 2) +
+				j % (LORA_Q4_GROUP / 2)];
+		q = j < LORA_Q4_GROUP / 2 ? q & 0x0F : q >> 4;
+		return ((int)q - 8) *
+		       weights_f32(ad, l->B_scale)[r * groups +
+						   c / LORA_Q4_GROUP];
+	default:
+		return weights_f32(ad, l->B)[r * in + c];
+	}
+}
+
+// Dequantized lora_A[o][r].
+static float weight_A(const struct lora_adapter *ad, uint32_t o, uint32_t r)
+{
+	const lora_weights_layout_t *l = &ad->layout;
+	const uint32_t rank = ad->desc.rank;
+
+	if (ad->desc.format == LORA_FMT_F32)
+		return weights_f32(ad, l->A)[o * rank + r];
+	return ((const int8_t *)(ad->weights + l->A))[o * rank + r] *
+	       weights_f32(ad, l->A_scale)[o];
+}
+
+TEE_Result lora_adapter_merge(struct lora_adapter *ad)
+{
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t rank = ad->desc.rank;
+	uintptr_t p;
+
+	TEE_Free(ad->merged_mem);
+	ad->merged = NULL;
+	ad->merged_mem = TEE_Malloc(lora_adapter_merged_size(&ad->desc),
+				    TEE_MALLOC_FILL_ZERO);
+	if (!ad->merged_mem)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	p = ((uintptr_t)ad->merged_mem + LORA_WEIGHT_ALIGN - 1) &
+	    ~(uintptr_t)(LORA_WEIGHT_ALIGN - 1);
+	ad->merged = (float *)p;
+
+	// Once per load, and only for shapes where out_channels * rank is
+	// small, so a plain triple loop is enough.
+	for (uint32_t o = 0; o < out; o++)
+	{
+		float *row = ad->merged + (size_t)o * in;
+
+		for (uint32_t r = 0; r < rank; r++)
+		{
+			const float a = weight_A(ad, o, r);
+
+			for (uint32_t c = 0; c < in; c++)
+			{
+				row[c] += a * weight_B(ad, r, c);
+			}
+		}
+	}
+	return TEE_SUCCESS;
+}
+
+void lora_adapter_matmul_merged(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const void *X, uint32_t dtype, uint32_t tokens,
+				float *output)
+{
+	// The merged rows are lora_B-shaped: out_channels rows of in_channels.
+	kern->matmul_B_tile(X, dtype, tokens, ad->merged,
+			    ad->desc.out_channels, ad->desc.in_channels,
+			    output);
+}
+
+void lora_adapter_matmul_B(const struct lora_adapter *ad,
+			   const struct lora_kernels *kern,
+			   const float *x, float *intermediate)
+{
+	const lora_weights_layout_t *l = &ad->layout;
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t rank = ad->desc.rank;
+
+	switch (ad->desc.format)
+	{
+	case LORA_FMT_F32:
+		kern->matmul_B(x, weights_f32(ad, l->B), rank, in,
+			       intermediate);
+		break;
+	case LORA_FMT_Q8:
+		kern->matmul_B_q8(x, (const int8_t *)(ad->weights + l->B),
+				  weights_f32(ad, l->B_scale),
+				  rank, in, intermediate);
+		break;
+	case LORA_FMT_Q4:
+		kern->matmul_B_q4(x, ad->weights + l->B,
+				  weights_f32(ad, l->B_scale),
+				  rank, in, intermediate);
+		break;
+	}
+}
+
+void lora_adapter_matmul_A(const struct lora_adapter *ad,
+			   const struct lora_kernels *kern,
+			   const float *intermediate, float *output)
+{
+	const lora_weights_layout_t *l = &ad->layout;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t rank = ad->desc.rank;
+
+	if (ad->desc.format == LORA_FMT_F32)
+		kern->matmul_A(intermediate, weights_f32(ad, l->A),
+			       out, rank, output);
+	else
+		kern->matmul_A_q8(intermediate,
+				  (const int8_t *)(ad->weights + l->A),
+				  weights_f32(ad, l->A_scale),
+				  out, rank, output);
+}
+
+void lora_adapter_matmul_B_half(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const uint16_t *x, uint32_t dtype,
+				float *widen, float *intermediate)
+{
+	if (ad->desc.format == LORA_FMT_F32)
+	{
+		kern->matmul_B_half(x, dtype, weights_f32(ad, ad->layout.B),
+				    ad->desc.rank, ad->desc.in_channels,
+				    intermediate);
+		return;
+	}
+	// The quantized kernels widen their weights in-register already;
+	// widen the token once into L1 instead of doubling their variants.
+	kern->widen_half(widen, x, dtype, ad->desc.in_channels);
+	lora_adapter_matmul_B(ad, kern, widen, intermediate);
+}
+
+void lora_adapter_matmul_B_tile(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const void *X, uint32_t dtype, uint32_t tokens,
+				float *widen, float *intermediate)
+{
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t rank = ad->desc.rank;
+	const size_t stride = (size_t)in * lora_dtype_size(dtype);
+
+	if (ad->desc.format == LORA_FMT_F32)
+	{
+		kern->matmul_B_tile(X, dtype, tokens, weights_f32(ad, ad->layout.B),
+				    rank, in, intermediate);
+		return;
+	}
+	// The quantized formats have only single-token kernels.
+	for (uint32_t t = 0; t < tokens; t++)
+	{
+		const void *x = (const uint8_t *)X + t * stride;
+
+		if (dtype == LORA_DTYPE_F32)
+			lora_adapter_matmul_B(ad, kern, x, intermediate + t * rank);
+		else
+			lora_adapter_matmul_B_half(ad, kern, x, dtype, widen,
+						   intermediate + t * rank);
+	}
+}
+
+void lora_adapter_matmul_A_tile(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const float *intermediate, uint32_t tokens,
+				float *output)
+{
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t rank = ad->desc.rank;
+
+	if (ad->desc.format == LORA_FMT_F32)
+	{
+		kern->matmul_A_tile(intermediate, tokens,
+				    weights_f32(ad, ad->layout.A), out, rank,
+				    output);
+		return;
+	}
+	for (uint32_t t = 0; t < tokens; t++)
+	{
+		lora_adapter_matmul_A(ad, kern, intermediate + t * rank,
+				      output + (size_t)t * out);
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ * LoRA adapter weights held inside the TA: allocation, placeholder
+ * initialization, secure storage persistence and the format-aware
+ * projections used by the forward pass.
+ *
+ * An adapter can also carry the pre-multiplied product lora_A lora_B, an
+ * out_channels x in_channels matrix, when running it costs less than the
+ * two factored projections (see lora_adapter_prefers_merged()). The
+ * factors are kept either way: they are what is persisted and reloaded.
+ */
+
+#ifndef LORA_ADAPTER_H
+#define LORA_ADAPTER_H
+
+#include <tee_internal_api.h>
+#include <optee_llm_ta.h>
+
+#include "lora_kernels.h"
+
+struct lora_adapter {
+	lora_adapter_desc_t desc;
+	lora_weights_layout_t layout;
+	uint8_t *weights;	// serialized weights, LORA_WEIGHT_ALIGN aligned
+	void *mem;		// allocation backing weights
+	// lora_A lora_B as floats, [out_channels][in_channels] and
+	// LORA_WEIGHT_ALIGN aligned, or NULL to run the factored form.
+	float *merged;
+	void *merged_mem;	// allocation backing merged
+};
+
+// Allocate zeroed weight storage for desc, replacing any previous weights.
+TEE_Result lora_adapter_alloc(struct lora_adapter *ad,
+			      const lora_adapter_desc_t *desc);
+void lora_adapter_free(struct lora_adapter *ad);
+
+// Fill allocated weights with placeholder random values.
+void lora_adapter_randomize(struct lora_adapter *ad);
+
+// Allocate and read the adapter persisted in secure storage under id.
+TEE_Result lora_adapter_load_storage(struct lora_adapter *ad, uint32_t id);
+// Persist the adapter (descriptor and weights) to secure storage under id.
+TEE_Result lora_adapter_persist(const struct lora_adapter *ad, uint32_t id);
+
+// Cost model: true if, per token, the merged matrix needs fewer
+// multiply-adds and weight bytes than the factors it replaces.
+bool lora_adapter_prefers_merged(const lora_adapter_desc_t *desc,
+				 const lora_weights_layout_t *layout);
+// Secure memory taken by the merged matrix of desc.
+uint32_t lora_adapter_merged_size(const lora_adapter_desc_t *desc);
+// Compute the merged matrix from the (dequantized) factors.
+TEE_Result lora_adapter_merge(struct lora_adapter *ad);
+// output[t][out_channels] = merged X[t] for up to LORA_TILE_TOKENS tokens of
+// X ([tokens][in_channels] of the given LORA_DTYPE_*). ad->merged must be set.
+void lora_adapter_matmul_merged(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const void *X, uint32_t dtype, uint32_t tokens,
+				float *output);
+
+// intermediate[rank] = lora_B x, dequantizing on the fly.
+void lora_adapter_matmul_B(const struct lora_adapter *ad,
+			   const struct lora_kernels *kern,
+			   const float *x, float *intermediate);
+// lora_adapter_matmul_B for a half precision x of the given LORA_DTYPE_*.
+// widen is in_channels floats of scratch, used by the quantized formats.
+void lora_adapter_matmul_B_half(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const uint16_t *x, uint32_t dtype,
+				float *widen, float *intermediate);
+// output[out_channels] = lora_A intermediate, dequantizing on the fly.
+void lora_adapter_matmul_A(const struct lora_adapter *ad,
+			   const struct lora_kernels *kern,
+			   const float *intermediate, float *output);
+// Multi-token forms for up to LORA_TILE_TOKENS tokens: X is
+// [tokens][in_channels] of the given LORA_DTYPE_*, intermediate is
+// [tokens][rank] and output is [tokens][out_channels]. The quantized
+// formats fall back to one token at a time.
+void lora_adapter_matmul_B_tile(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const void *X, uint32_t dtype, uint32_t tokens,
+				float *widen, float *intermediate);
+void lora_adapter_matmul_A_tile(const struct lora_adapter *ad,
+				const struct lora_kernels *kern,
+				const float *intermediate, uint32_t tokens,
+				float *output);
+
+#endif /* LORA_ADAPTER_H */
@@ -0,0 +1,244 @@
+/*
+ * Registry of the adapters loaded into a session.
+ */
+
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "lora_cache.h"
+
+void lora_cache_init(struct lora_cache *cache, uint32_t budget)
+{
+	TAILQ_INIT(&cache->lru);
+	cache->budget = budget;
+	cache->bytes = 0;
+	cache->resident = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
+	cache->generations = 0;
+}
+
+static void free_entry(struct lora_cache *cache, struct lora_cache_entry *e)
+{
+	TAILQ_REMOVE(&cache->lru, e, link);
+	cache->bytes -= e->bytes;
+	cache->resident--;
+	lora_adapter_free(&e->adapter);
+	TEE_Free(e->scratch);
+	TEE_Free(e->train);
+	TEE_Free(e);
+}
+
+void lora_cache_clear(struct lora_cache *cache)
+{
+	while (!TAILQ_EMPTY(&cache->lru))
+		free_entry(cache, TAILQ_FIRST(&cache->lru));
+}
+
+// Evict least recently used adapters until bytes more fit in the budget.
+static void make_room(struct lora_cache *cache, uint32_t bytes)
+{
+	struct lora_cache_entry *e;
+
+	while (cache->bytes + bytes > cache->budget &&
+	       (e = TAILQ_LAST(&cache->lru, lora_cache_list)))
+	{
+		DMSG("Evicting adapter %u", e->id);
+		free_entry(cache, e);
+		cache->evictions++;
+	}
+}
+
+static struct lora_cache_entry *find(struct lora_cache *cache, uint32_t id)
+{
+	struct lora_cache_entry *e;
+
+	TAILQ_FOREACH(e, &cache->lru, link)
+	{
+		if (e->id == id)
+			return e;
+	}
+	return NULL;
+}
+
+// Secure memory an entry for desc takes, with or without the merged matrix.
+// A merged tile stages [tokens][out_channels] outputs in the tile area of
+// the scratch, so it is sized for the wider of rank and out_channels.
+static uint32_t entry_bytes(const lora_adapter_desc_t *desc,
+			    const lora_weights_layout_t *layout, bool merged,
+			    uint32_t *scratch_size)
+{
+	uint32_t tile_width = desc->rank;
+
+	if (merged && desc->out_channels > tile_width)
+		tile_width = desc->out_channels;
+	*scratch_size = (desc->in_channels + 2 * desc->out_channels +
+			 LORA_TILE_TOKENS * tile_width) * sizeof(float);
+	return layout->size + LORA_WEIGHT_ALIGN + *scratch_size +
+	       sizeof(struct lora_cache_entry) +
+	       (merged ? lora_adapter_merged_size(desc) : 0);
+}
+
+// Secure memory charged for e as it stands, with the merged matrix and the
+// training state only if the adapter has them.
+static uint32_t charged_bytes(const struct lora_cache_entry *e)
+{
+	const struct lora_adapter *ad = &e->adapter;
+
+	return ad->layout.size + LORA_WEIGHT_ALIGN + e->scratch_bytes +
+	       sizeof(*e) + e->train_bytes +
+	       (ad->merged ? lora_adapter_merged_size(&ad->desc) : 0);
+}
+
+TEE_Result lora_cache_insert(struct lora_cache *cache, uint32_t id,
+			     struct lora_adapter *ad,
+			     struct lora_cache_entry **entry)
+{
+	uint32_t scratch_size;
+	uint32_t bytes;
+	bool merge;
+	struct lora_cache_entry *e;
+
+	lora_cache_remove(cache, id);
+
+	// The merged matrix is built when the cost model prefers it and it
+	// fits the budget next to the factors; otherwise the adapter runs
+	// factored.
+	merge = lora_adapter_prefers_merged(&ad->desc, &ad->layout) &&
+		entry_bytes(&ad->desc, &ad->layout, true, &scratch_size) <=
+		cache->budget;
+	bytes = entry_bytes(&ad->desc, &ad->layout, merge, &scratch_size);
+	if (bytes > cache->budget)
+	{
+		EMSG("Adapter %u needs %u bytes, budget is %u", id, bytes,
+		     cache->budget);
+		lora_adapter_free(ad);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+	make_room(cache, bytes);
+
+	// Running factored is always possible, so a failed merge only costs
+	// speed; the entry is charged for what it ends up holding.
+	if (merge && lora_adapter_merge(ad) != TEE_SUCCESS)
+		merge = false;
+	DMSG("Adapter %u runs %s", id, merge ? "merged" : "factored");
+
+	e = TEE_Malloc(sizeof(*e), TEE_MALLOC_FILL_ZERO);
+	if (e)
+		e->scratch = TEE_Malloc(scratch_size, TEE_MALLOC_FILL_ZERO);
+	if (!e || !e->scratch)
+	{
+		TEE_Free(e);
+		lora_adapter_free(ad);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+
+	e->id = id;
+	e->adapter = *ad;
+	e->scratch_bytes = scratch_size;
+	e->bytes = charged_bytes(e);
+	e->generation = ++cache->generations;
+	ad->mem = NULL;
+	ad->weights = NULL;
+	ad->merged_mem = NULL;
+	ad->merged = NULL;
+
+	TAILQ_INSERT_HEAD(&cache->lru, e, link);
+	cache->bytes += e->bytes;
+	cache->resident++;
+	*entry = e;
+	return TEE_SUCCESS;
+}
+
+TEE_Result lora_cache_get(struct lora_cache *cache, uint32_t id,
+			  struct lora_cache_entry **entry)
+{
+	struct lora_adapter ad = { .mem = NULL };
+	struct lora_cache_entry *e = find(cache, id);
+	TEE_Result res;
+
+	if (e)
+	{
+		cache->hits++;
+		if (e != TAILQ_FIRST(&cache->lru))
+		{
+			TAILQ_REMOVE(&cache->lru, e, link);
+			TAILQ_INSERT_HEAD(&cache->lru, e, link);
+		}
+		*entry = e;
+		return TEE_SUCCESS;
+	}
+
+	cache->misses++;
+	res = lora_adapter_load_storage(&ad, id);
+	if (res != TEE_SUCCESS)
+	{
+		lora_adapter_free(&ad);
+		return res;
+	}
+	return lora_cache_insert(cache, id, &ad, entry);
+}
+
+void lora_cache_renew(struct lora_cache *cache, struct lora_cache_entry *e)
+{
+	const uint32_t bytes = charged_bytes(e);
+
+	cache->bytes = cache->bytes - e->bytes + bytes;
+	e->bytes = bytes;
+	e->generation = ++cache->generations;
+}
+
+TEE_Result lora_cache_alloc_train(struct lora_cache *cache,
+				  struct lora_cache_entry *e, size_t bytes)
+{
+	if (bytes > cache->budget || e->bytes > cache->budget - bytes)
+	{
+		EMSG("Training adapter %u needs %zu more bytes, budget is %u",
+		     e->id, bytes, cache->budget);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+
+	// With e most recently used and fitting next to its state, making
+	// room evicts every other adapter before it.
+	if (e != TAILQ_FIRST(&cache->lru))
+	{
+		TAILQ_REMOVE(&cache->lru, e, link);
+		TAILQ_INSERT_HEAD(&cache->lru, e, link);
+	}
+	make_room(cache, bytes);
+
+	e->train = TEE_Malloc(bytes, TEE_MALLOC_FILL_ZERO);
+	if (!e->train)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	e->train_bytes = bytes;
+	cache->bytes += bytes;
+	e->bytes += bytes;
+	return TEE_SUCCESS;
+}
+
+void lora_cache_remove(struct lora_cache *cache, uint32_t id)
+{
+	struct lora_cache_entry *e = find(cache, id);
+
+	if (e)
+		free_entry(cache, e);
+}
+
+void lora_cache_set_budget(struct lora_cache *cache, uint32_t budget)
+{
+	cache->budget = budget;
+	make_room(cache, 0);
+}
+
+void lora_cache_get_stats(const struct lora_cache *cache,
+			  lora_cache_stats_t *stats)
+{
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->evictions;
+	stats->resident = cache->resident;
+	stats->resident_bytes = cache->bytes;
+	stats->budget_bytes = cache->budget;
+	stats->reserved = 0;
+}
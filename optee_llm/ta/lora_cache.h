@@ -0,0 +1,86 @@
+/*
+ * Registry of the adapters loaded into a session, keyed by adapter ID.
+ *
+ * Resident adapters are kept on a list in least recently used order and
+ * their secure memory is accounted against a budget; adding an adapter
+ * evicts from the cold end until it fits. A lookup that misses reloads the
+ * adapter from secure storage.
+ */
+
+#ifndef LORA_CACHE_H
+#define LORA_CACHE_H
+
+#include <sys/queue.h>
+#include <tee_internal_api.h>
+#include <optee_llm_ta.h>
+
+#include "lora_adapter.h"
+
+struct lora_train_state;
+
+struct lora_cache_entry {
+	TAILQ_ENTRY(lora_cache_entry) link;
+	uint32_t id;
+	struct lora_adapter adapter;
+	// Working vectors for the forward pass, sized from the adapter:
+	// in_channels floats for the pooled mean, then out_channels floats
+	// each for the per-token and the per-sample output, then
+	// LORA_TILE_TOKENS * rank floats for a tile's lora_B projections
+	// (LORA_TILE_TOKENS * max(rank, out_channels) for a merged adapter,
+	// whose tiles stage outputs there instead).
+	float *scratch;
+	uint32_t scratch_bytes;
+	uint32_t bytes;		// secure memory charged to the budget
+	// Training state of the adapter (see lora_train.h) or NULL: one
+	// allocation of train_bytes, charged to the budget with the entry and
+	// freed with it.
+	struct lora_train_state *train;
+	uint32_t train_bytes;
+	// Distinguishes this load of the adapter from earlier ones with the
+	// same ID, for state derived from its weights.
+	uint64_t generation;
+};
+
+TAILQ_HEAD(lora_cache_list, lora_cache_entry);
+
+struct lora_cache {
+	struct lora_cache_list lru;	// most recently used first
+	uint32_t budget;
+	uint32_t bytes;
+	uint32_t resident;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t generations;	// loads and in-place updates so far
+};
+
+void lora_cache_init(struct lora_cache *cache, uint32_t budget);
+// Free every resident adapter.
+void lora_cache_clear(struct lora_cache *cache);
+
+// Find the adapter with the given ID, reloading it from secure storage if it
+// is not resident. Marks it most recently used.
+TEE_Result lora_cache_get(struct lora_cache *cache, uint32_t id,
+			  struct lora_cache_entry **entry);
+// Take ownership of a freshly loaded adapter, replacing any adapter with the
+// same ID. *ad is left empty whether or not this succeeds.
+TEE_Result lora_cache_insert(struct lora_cache *cache, uint32_t id,
+			     struct lora_adapter *ad,
+			     struct lora_cache_entry **entry);
+// Give an entry a new generation after its weights changed in place, so
+// state derived from the old weights is no longer used, and recharge its
+// memory in case the merged matrix was rebuilt or dropped.
+void lora_cache_renew(struct lora_cache *cache, struct lora_cache_entry *e);
+// Allocate bytes of zeroed training state as e->train and charge it to e,
+// evicting other adapters to make room. Fails with TEE_ERROR_OUT_OF_MEMORY
+// if e and its state together do not fit the budget.
+TEE_Result lora_cache_alloc_train(struct lora_cache *cache,
+				  struct lora_cache_entry *e, size_t bytes);
+// Drop the adapter with the given ID if it is resident.
+void lora_cache_remove(struct lora_cache *cache, uint32_t id);
+// Change the budget, evicting adapters that no longer fit.
+void lora_cache_set_budget(struct lora_cache *cache, uint32_t budget);
+void lora_cache_get_stats(const struct lora_cache *cache,
+			  lora_cache_stats_t *stats);
+
+#endif /* LORA_CACHE_H */
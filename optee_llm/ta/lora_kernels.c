@@ -0,0 +1,1354 @@
+/*
+ * LoRA compute kernels: portable scalar reference, NEON for the Jetson's
+ * Cortex-A78AE and AVX2/FMA for x86 host builds.
+ *
+ * The dot products in matmul_B dominate the FLOPs. The SIMD variants keep
+ * several independent accumulators per row so the FMA pipes are not
+ * serialized on a single dependency chain, stream x once for up to four
+ * rows at a time, and reduce horizontally only at the end of each row.
+ *
+ * Adapter shapes are runtime values. The f32 projections are instantiated
+ * with the rank as a compile-time constant for the common ranks (see
+ * RANK_DISPATCH), so the rank loops unroll completely and matmul_A's short
+ * dot products need no remainder handling; other ranks take the generic
+ * instantiation. matmul_B is also instantiated per input dtype, so fp16 and
+ * bf16 activations are widened inside its loads rather than converted into
+ * a separate fp32 buffer first.
+ */
+
+#include <string.h>
+
+#include "lora_kernels.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Run stmt with R bound to rank, as a constant for the specialized ranks.
+// The kernels using it are ALWAYS_INLINE bodies so the constant reaches
+// their loops.
+#define RANK_DISPATCH(rank, stmt)				\
+	do {							\
+		switch (rank)					\
+		{						\
+		case 4: { const uint32_t R = 4; stmt; break; }	\
+		case 8: { const uint32_t R = 8; stmt; break; }	\
+		case 16: { const uint32_t R = 16; stmt; break; }	\
+		case 64: { const uint32_t R = 64; stmt; break; }	\
+		default: { const uint32_t R = rank; stmt; break; }	\
+		}						\
+	} while (0)
+
+static bool always_supported(void)
+{
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Scalar reference
+// ---------------------------------------------------------------------------
+
+static ALWAYS_INLINE float bits_to_f32(uint32_t bits)
+{
+	float f;
+
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static ALWAYS_INLINE float f16_to_f32(uint16_t h)
+{
+	const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
+
+	if (exp == 0x1f)
+		return bits_to_f32(sign | 0x7f800000 | (mant << 13));
+	if (exp)
+		return bits_to_f32(sign | ((exp + 112) << 23) | (mant << 13));
+	if (!mant)
+		return bits_to_f32(sign);
+	// Subnormal: normalize into an fp32 exponent.
+	exp = 113;
+	while (!(mant & 0x400))
+	{
+		mant <<= 1;
+		exp--;
+	}
+	return bits_to_f32(sign | (exp << 23) | ((mant & 0x3ff) << 13));
+}
+
+static ALWAYS_INLINE float bf16_to_f32(uint16_t h)
+{
+	return bits_to_f32((uint32_t)h << 16);
+}
+
+// Round to nearest even, with overflow to infinity and gradual underflow.
+static uint16_t f32_to_f16(float f)
+{
+	uint32_t x;
+	uint32_t sign, mant, h, rem;
+	int32_t exp;
+
+	memcpy(&x, &f, sizeof(x));
+	sign = (x >> 16) & 0x8000;
+	exp = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+	mant = x & 0x7fffff;
+
+	if (((x >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	if (exp >= 0x1f)
+		return sign | 0x7c00;
+	if (exp <= 0)
+	{
+		const uint32_t shift = 14 - exp;
+
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		h = mant >> shift;
+		rem = mant & ((1u << shift) - 1);
+		if (rem > (1u << (shift - 1)) ||
+		    (rem == (1u << (shift - 1)) && (h & 1)))
+			h++;
+		return sign | h;
+	}
+	// A carry out of the mantissa correctly bumps the exponent.
+	h = sign | ((uint32_t)exp << 10) | (mant >> 13);
+	rem = mant & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++;
+	return h;
+}
+
+static uint16_t f32_to_bf16(float f)
+{
+	uint32_t x;
+
+	memcpy(&x, &f, sizeof(x));
+	if ((x & 0x7fffffff) > 0x7f800000)
+		return (x >> 16) | 0x40;	// keep NaNs quiet
+	return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+// Element c of an activation vector of the given dtype, as fp32.
+static ALWAYS_INLINE float load_x(const void *x, uint32_t c, uint32_t dtype)
+{
+	switch (dtype)
+	{
+	case LORA_DTYPE_F16:
+		return f16_to_f32(((const uint16_t *)x)[c]);
+	case LORA_DTYPE_BF16:
+		return bf16_to_f32(((const uint16_t *)x)[c]);
+	default:
+		return ((const float *)x)[c];
+	}
+}
+
+// Run stmt with D bound to dtype as a constant, for the half kernels.
+#define HALF_DISPATCH(dtype, stmt)					\
+	do {								\
+		if ((dtype) == LORA_DTYPE_F16)				\
+		{ const uint32_t D = LORA_DTYPE_F16; stmt; }		\
+		else							\
+		{ const uint32_t D = LORA_DTYPE_BF16; stmt; }		\
+	} while (0)
+
+// Run stmt with D bound to dtype as a constant, fp32 included.
+#define DTYPE_DISPATCH(dtype, stmt)					\
+	do {								\
+		if ((dtype) == LORA_DTYPE_F32)				\
+		{ const uint32_t D = LORA_DTYPE_F32; stmt; }		\
+		else							\
+			HALF_DISPATCH(dtype, stmt);			\
+	} while (0)
+
+// Tokens per register block of the multi-token (tile) kernels. Each block
+// of lora_B rows is loaded once per TILE_BLOCK tokens instead of per token.
+#define TILE_BLOCK 4
+
+// lora_A rows per block of the multi-token matmul_A. A block stays in L1
+// while it is applied to every token of the tile, and each token's outputs
+// are written contiguously rather than a column at a time.
+#define TILE_A_ROWS 64
+
+static ALWAYS_INLINE uint32_t tile_a_end(uint32_t out, uint32_t out_channels)
+{
+	return out_channels - out < TILE_A_ROWS ? out_channels : out + TILE_A_ROWS;
+}
+
+// Token t of a [tokens][in_channels] activation tile of the given dtype.
+static ALWAYS_INLINE const void *tile_token(const void *X, uint32_t dtype,
+					    uint32_t in_channels, uint32_t t)
+{
+	return (const uint8_t *)X +
+	       (uint64_t)t * in_channels * (dtype == LORA_DTYPE_F32 ? 4 : 2);
+}
+
+static ALWAYS_INLINE void matmul_B_scalar_body(const void *x, uint32_t dtype,
+					       const float *B,
+					       uint32_t rank, uint32_t in_channels,
+					       float *intermediate)
+{
+	for (uint32_t r = 0; r < rank; r++)
+	{
+		const float *row = B + (uint64_t)r * in_channels;
+		float sum = 0.0f;
+		for (uint32_t c = 0; c < in_channels; c++)
+		{
+			sum += load_x(x, c, dtype) * row[c];
+		}
+		intermediate[r] = sum;
+	}
+}
+
+static void matmul_B_scalar(const float *x, const float *B,
+			    uint32_t rank, uint32_t in_channels,
+			    float *intermediate)
+{
+	RANK_DISPATCH(rank,
+		      matmul_B_scalar_body(x, LORA_DTYPE_F32, B, R, in_channels,
+					   intermediate));
+}
+
+static void matmul_B_half_scalar(const uint16_t *x, uint32_t dtype,
+				 const float *B, uint32_t rank,
+				 uint32_t in_channels, float *intermediate)
+{
+	HALF_DISPATCH(dtype,
+		      RANK_DISPATCH(rank,
+				    matmul_B_scalar_body(x, D, B, R, in_channels,
+							 intermediate)));
+}
+
+static ALWAYS_INLINE void matmul_A_scalar_body(const float *intermediate, const float *A,
+					       uint32_t out_channels, uint32_t rank,
+					       float *output)
+{
+	for (uint32_t out = 0; out < out_channels; out++)
+	{
+		const float *row = A + (uint64_t)out * rank;
+		float sum = 0.0f;
+		for (uint32_t r = 0; r < rank; r++)
+		{
+			sum += intermediate[r] * row[r];
+		}
+		output[out] = sum;
+	}
+}
+
+static void matmul_A_scalar(const float *intermediate, const float *A,
+			    uint32_t out_channels, uint32_t rank,
+			    float *output)
+{
+	RANK_DISPATCH(rank,
+		      matmul_A_scalar_body(intermediate, A, out_channels, R, output));
+}
+
+static ALWAYS_INLINE void matmul_B_tile_scalar_body(const void *X, uint32_t dtype,
+						    uint32_t tokens, const float *B,
+						    uint32_t rank, uint32_t in_channels,
+						    float *intermediate)
+{
+	uint32_t t = 0;
+
+	for (; t + TILE_BLOCK <= tokens; t += TILE_BLOCK)
+	{
+		const void *x0 = tile_token(X, dtype, in_channels, t);
+		const void *x1 = tile_token(X, dtype, in_channels, t + 1);
+		const void *x2 = tile_token(X, dtype, in_channels, t + 2);
+		const void *x3 = tile_token(X, dtype, in_channels, t + 3);
+		float *out = intermediate + (uint64_t)t * rank;
+
+		for (uint32_t r = 0; r < rank; r++)
+		{
+			const float *row = B + (uint64_t)r * in_channels;
+			float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+
+			for (uint32_t c = 0; c < in_channels; c++)
+			{
+				const float b = row[c];
+
+				s0 += load_x(x0, c, dtype) * b;
+				s1 += load_x(x1, c, dtype) * b;
+				s2 += load_x(x2, c, dtype) * b;
+				s3 += load_x(x3, c, dtype) * b;
+			}
+			out[r] = s0;
+			out[rank + r] = s1;
+			out[2 * rank + r] = s2;
+			out[3 * rank + r] = s3;
+		}
+	}
+	for (; t < tokens; t++)
+	{
+		matmul_B_scalar_body(tile_token(X, dtype, in_channels, t), dtype,
+				     B, rank, in_channels,
+				     intermediate + (uint64_t)t * rank);
+	}
+}
+
+static void matmul_B_tile_scalar(const void *X, uint32_t dtype,
+				 uint32_t tokens, const float *B,
+				 uint32_t rank, uint32_t in_channels,
+				 float *intermediate)
+{
+	DTYPE_DISPATCH(dtype,
+		       RANK_DISPATCH(rank,
+				     matmul_B_tile_scalar_body(X, D, tokens, B, R,
+							       in_channels,
+							       intermediate)));
+}
+
+static ALWAYS_INLINE void matmul_A_tile_scalar_body(const float *intermediate,
+						    uint32_t tokens, const float *A,
+						    uint32_t out_channels, uint32_t rank,
+						    float *output)
+{
+	for (uint32_t o0 = 0; o0 < out_channels; o0 += TILE_A_ROWS)
+	{
+		const uint32_t o1 = tile_a_end(o0, out_channels);
+
+		for (uint32_t t = 0; t < tokens; t++)
+		{
+			const float *x = intermediate + (uint64_t)t * rank;
+			float *y = output + (uint64_t)t * out_channels;
+
+			for (uint32_t out = o0; out < o1; out++)
+			{
+				const float *row = A + (uint64_t)out * rank;
+				float sum = 0.0f;
+
+				for (uint32_t r = 0; r < rank; r++)
+				{
+					sum += x[r] * row[r];
+				}
+				y[out] = sum;
+			}
+		}
+	}
+}
+
+static void matmul_A_tile_scalar(const float *intermediate, uint32_t tokens,
+				 const float *A, uint32_t out_channels,
+				 uint32_t rank, float *output)
+{
+	RANK_DISPATCH(rank,
+		      matmul_A_tile_scalar_body(intermediate, tokens, A,
+						out_channels, R, output));
+}
+
+static void accumulate_scalar(float *acc, const float *x, uint32_t n)
+{
+	for (uint32_t c = 0; c < n; c++)
+	{
+		acc[c] += x[c];
+	}
+}
+
+static void accumulate_half_scalar(float *acc, const uint16_t *x,
+				   uint32_t dtype, uint32_t n)
+{
+	for (uint32_t c = 0; c < n; c++)
+	{
+		acc[c] += load_x(x, c, dtype);
+	}
+}
+
+static void widen_half_scalar(float *dst, const uint16_t *x, uint32_t dtype,
+			      uint32_t n)
+{
+	for (uint32_t c = 0; c < n; c++)
+	{
+		dst[c] = load_x(x, c, dtype);
+	}
+}
+
+// Outputs are small next to the inputs, so every variant narrows with this.
+static void narrow_half_scalar(uint16_t *dst, const float *x, uint32_t dtype,
+			       uint32_t n)
+{
+	for (uint32_t c = 0; c < n; c++)
+	{
+		dst[c] = dtype == LORA_DTYPE_F16 ? f32_to_f16(x[c]) :
+						    f32_to_bf16(x[c]);
+	}
+}
+
+static void matmul_B_q8_scalar(const float *x, const int8_t *B_q,
+			       const float *B_scale,
+			       uint32_t rank, uint32_t in_channels,
+			       float *intermediate)
+{
+	for (uint32_t r = 0; r < rank; r++)
+	{
+		const int8_t *row = B_q + (uint64_t)r * in_channels;
+		float sum = 0.0f;
+		for (uint32_t c = 0; c < in_channels; c++)
+		{
+			sum += x[c] * row[c];
+		}
+		intermediate[r] = sum * B_scale[r];
+	}
+}
+
+static void matmul_B_q4_scalar(const float *x, const uint8_t *B_q,
+			       const float *B_scale,
+			       uint32_t rank, uint32_t in_channels,
+			       float *intermediate)
+{
+	const uint32_t groups = in_channels / LORA_Q4_GROUP;
+
+	for (uint32_t r = 0; r < rank; r++)
+	{
+		const uint8_t *row = B_q + (uint64_t)r * in_channels / 2;
+		const float *scale = B_scale + (uint64_t)r * groups;
+		float sum = 0.0f;
+		for (uint32_t g = 0; g < groups; g++)
+		{
+			const uint8_t *blk = row + g * (LORA_Q4_GROUP / 2);
+			const float *xg = x + g * LORA_Q4_GROUP;
+			float gsum = 0.0f;
+			for (uint32_t j = 0; j < LORA_Q4_GROUP / 2; j++)
+			{
+				gsum += xg[j] * ((blk[j] & 0x0F) - 8);
+				gsum += xg[j + LORA_Q4_GROUP / 2] * ((blk[j] >> 4) - 8);
+			}
+			sum += gsum * scale[g];
+		}
+		intermediate[r] = sum;
+	}
+}
+
+static ALWAYS_INLINE void matmul_A_q8_scalar_body(const float *intermediate, const int8_t *A_q,
+						  const float *A_scale,
+						  uint32_t out_channels, uint32_t rank,
+						  float *output)
+{
+	for (uint32_t out = 0; out < out_channels; out++)
+	{
+		const int8_t *row = A_q + (uint64_t)out * rank;
+		float sum = 0.0f;
+		for (uint32_t r = 0; r < rank; r++)
+		{
+			sum += intermediate[r] * row[r];
+		}
+		output[out] = sum * A_scale[out];
+	}
+}
+
+static void matmul_A_q8_scalar(const float *intermediate, const int8_t *A_q,
+			       const float *A_scale,
+			       uint32_t out_channels, uint32_t rank,
+			       float *output)
+{
+	RANK_DISPATCH(rank,
+		      matmul_A_q8_scalar_body(intermediate, A_q, A_scale, out_channels, R, output));
+}
+
+// ---------------------------------------------------------------------------
+// NEON (AArch64)
+// ---------------------------------------------------------------------------
+
+#if defined(__aarch64__)
+// Four elements of an activation vector of the given dtype, as fp32.
+static ALWAYS_INLINE float32x4_t load_x_neon(const void *x, uint32_t c,
+					     uint32_t dtype)
+{
+	switch (dtype)
+	{
+	case LORA_DTYPE_F16:
+		return vcvt_f32_f16(vreinterpret_f16_u16(
+			vld1_u16((const uint16_t *)x + c)));
+	case LORA_DTYPE_BF16:
+		return vreinterpretq_f32_u32(vshll_n_u16(
+			vld1_u16((const uint16_t *)x + c), 16));
+	default:
+		return vld1q_f32((const float *)x + c);
+	}
+}
+
+static ALWAYS_INLINE float dot_neon(const void *x, uint32_t dtype,
+				     const float *row, uint32_t n)
+{
+	float32x4_t acc0 = vdupq_n_f32(0.0f);
+	float32x4_t acc1 = vdupq_n_f32(0.0f);
+	float32x4_t acc2 = vdupq_n_f32(0.0f);
+	float32x4_t acc3 = vdupq_n_f32(0.0f);
+	uint32_t c = 0;
+	float sum;
+
+	for (; c + 16 <= n; c += 16)
+	{
+		acc0 = vfmaq_f32(acc0, load_x_neon(x, c, dtype), vld1q_f32(row + c));
+		acc1 = vfmaq_f32(acc1, load_x_neon(x, c + 4, dtype), vld1q_f32(row + c + 4));
+		acc2 = vfmaq_f32(acc2, load_x_neon(x, c + 8, dtype), vld1q_f32(row + c + 8));
+		acc3 = vfmaq_f32(acc3, load_x_neon(x, c + 12, dtype), vld1q_f32(row + c + 12));
+	}
+	for (; c + 4 <= n; c += 4)
+	{
+		acc0 = vfmaq_f32(acc0, load_x_neon(x, c, dtype), vld1q_f32(row + c));
+	}
+	sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+	for (; c < n; c++)
+	{
+		sum += load_x(x, c, dtype) * row[c];
+	}
+	return sum;
+}
+
+static ALWAYS_INLINE void matmul_B_neon_body(const void *x, uint32_t dtype,
+					     const float *B,
+					     uint32_t rank, uint32_t in_channels,
+					     float *intermediate)
+{
+	uint32_t r = 0;
+
+	// Four rows at a time: each x vector is loaded once and feeds four
+	// rows, with two accumulators per row to hide the FMA latency.
+	for (; r + 4 <= rank; r += 4)
+	{
+		const float *b0 = B + (uint64_t)r * in_channels;
+		const float *b1 = b0 + in_channels;
+		const float *b2 = b1 + in_channels;
+		const float *b3 = b2 + in_channels;
+		float32x4_t a0 = vdupq_n_f32(0.0f), a0h = vdupq_n_f32(0.0f);
+		float32x4_t a1 = vdupq_n_f32(0.0f), a1h = vdupq_n_f32(0.0f);
+		float32x4_t a2 = vdupq_n_f32(0.0f), a2h = vdupq_n_f32(0.0f);
+		float32x4_t a3 = vdupq_n_f32(0.0f), a3h = vdupq_n_f32(0.0f);
+		float s0, s1, s2, s3;
+		uint32_t c = 0;
+
+		for (; c + 8 <= in_channels; c += 8)
+		{
+			float32x4_t xl = load_x_neon(x, c, dtype);
+			float32x4_t xh = load_x_neon(x, c + 4, dtype);
+			a0 = vfmaq_f32(a0, xl, vld1q_f32(b0 + c));
+			a0h = vfmaq_f32(a0h, xh, vld1q_f32(b0 + c + 4));
+			a1 = vfmaq_f32(a1, xl, vld1q_f32(b1 + c));
+			a1h = vfmaq_f32(a1h, xh, vld1q_f32(b1 + c + 4));
+			a2 = vfmaq_f32(a2, xl, vld1q_f32(b2 + c));
+			a2h = vfmaq_f32(a2h, xh, vld1q_f32(b2 + c + 4));
+			a3 = vfmaq_f32(a3, xl, vld1q_f32(b3 + c));
+			a3h = vfmaq_f32(a3h, xh, vld1q_f32(b3 + c + 4));
+		}
+		s0 = vaddvq_f32(vaddq_f32(a0, a0h));
+		s1 = vaddvq_f32(vaddq_f32(a1, a1h));
+		s2 = vaddvq_f32(vaddq_f32(a2, a2h));
+		s3 = vaddvq_f32(vaddq_f32(a3, a3h));
+		for (; c < in_channels; c++)
+		{
+			const float xc = load_x(x, c, dtype);
+
+			s0 += xc * b0[c];
+			s1 += xc * b1[c];
+			s2 += xc * b2[c];
+			s3 += xc * b3[c];
+		}
+		intermediate[r] = s0;
+		intermediate[r + 1] = s1;
+		intermediate[r + 2] = s2;
+		intermediate[r + 3] = s3;
+	}
+	for (; r < rank; r++)
+	{
+		intermediate[r] = dot_neon(x, dtype, B + (uint64_t)r * in_channels,
+					   in_channels);
+	}
+}
+
+static void matmul_B_neon(const float *x, const float *B,
+			  uint32_t rank, uint32_t in_channels,
+			  float *intermediate)
+{
+	RANK_DISPATCH(rank,
+		      matmul_B_neon_body(x, LORA_DTYPE_F32, B, R, in_channels, intermediate));
+}
+
+static ALWAYS_INLINE void matmul_A_neon_body(const float *intermediate, const float *A,
+					     uint32_t out_channels, uint32_t rank,
+					     float *output)
+{
+	for (uint32_t out = 0; out < out_channels; out++)
+	{
+		output[out] = dot_neon(intermediate, LORA_DTYPE_F32, A + (uint64_t)out * rank,
+				       rank);
+	}
+}
+
+static void matmul_A_neon(const float *intermediate, const float *A,
+			  uint32_t out_channels, uint32_t rank,
+			  float *output)
+{
+	RANK_DISPATCH(rank,
+		      matmul_A_neon_body(intermediate, A, out_channels, R, output));
+}
+
+static ALWAYS_INLINE void matmul_B_tile_neon_body(const void *X, uint32_t dtype,
+						  uint32_t tokens, const float *B,
+						  uint32_t rank, uint32_t in_channels,
+						  float *intermediate)
+{
+	uint32_t t = 0;
+
+	// TILE_BLOCK tokens by four rows: sixteen accumulators, each B and x
+	// vector loaded once per block.
+	for (; t + TILE_BLOCK <= tokens; t += TILE_BLOCK)
+	{
+		const void *x[TILE_BLOCK];
+		float *out = intermediate + (uint64_t)t * rank;
+		uint32_t r = 0;
+
+		for (uint32_t i = 0; i < TILE_BLOCK; i++)
+			x[i] = tile_token(X, dtype, in_channels, t + i);
+		for (; r + 4 <= rank; r += 4)
+		{
+			const float *b[4];
+			float32x4_t acc[TILE_BLOCK][4];
+			uint32_t c = 0;
+
+			for (uint32_t j = 0; j < 4; j++)
+				b[j] = B + (uint64_t)(r + j) * in_channels;
+			for (uint32_t i = 0; i < TILE_BLOCK; i++)
+				for (uint32_t j = 0; j < 4; j++)
+					acc[i][j] = vdupq_n_f32(0.0f);
+			for (; c + 4 <= in_channels; c += 4)
+			{
+				float32x4_t bv[4];
+
+				for (uint32_t j = 0; j < 4; j++)
+					bv[j] = vld1q_f32(b[j] + c);
+				for (uint32_t i = 0; i < TILE_BLOCK; i++)
+				{
+					const float32x4_t xv = load_x_neon(x[i], c, dtype);
+
+					for (uint32_t j = 0; j < 4; j++)
+						acc[i][j] = vfmaq_f32(acc[i][j], xv, bv[j]);
+				}
+			}
+			for (uint32_t i = 0; i < TILE_BLOCK; i++)
+			{
+				for (uint32_t j = 0; j < 4; j++)
+				{
+					float sum = vaddvq_f32(acc[i][j]);
+
+					for (uint32_t k = c; k < in_channels; k++)
+						sum += load_x(x[i], k, dtype) * b[j][k];
+					out[(uint64_t)i * rank + r + j] = sum;
+				}
+			}
+		}
+		for (; r < rank; r++)
+		{
+			const float *row = B + (uint64_t)r * in_channels;
+
+			for (uint32_t i = 0; i < TILE_BLOCK; i++)
+				out[(uint64_t)i * rank + r] =
+					dot_neon(x[i], dtype, row, in_channels);
+		}
+	}
+	for (; t < tokens; t++)
+	{
+		matmul_B_neon_body(tile_token(X, dtype, in_channels, t), dtype,
+				   B, rank, in_channels,
+				   intermediate + (uint64_t)t * rank);
+	}
+}
+
+static void matmul_B_tile_neon(const void *X, uint32_t dtype,
+			       uint32_t tokens, const float *B,
+			       uint32_t rank, uint32_t in_channels,
+			       float *intermediate)
+{
+	DTYPE_DISPATCH(dtype,
+		       RANK_DISPATCH(rank,
+				     matmul_B_tile_neon_body(X, D, tokens, B, R,
+							     in_channels,
+							     intermediate)));
+}
+
+static ALWAYS_INLINE void matmul_A_tile_neon_body(const float *intermediate,
+						  uint32_t tokens, const float *A,
+						  uint32_t out_channels, uint32_t rank,
+						  float *output)
+{
+	for (uint32_t o0 = 0; o0 < out_channels; o0 += TILE_A_ROWS)
+	{
+		const uint32_t o1 = tile_a_end(o0, out_channels);
+
+		for (uint32_t t = 0; t < tokens; t++)
+		{
+			const float *x = intermediate + (uint64_t)t * rank;
+			float *y = output + (uint64_t)t * out_channels;
+
+			for (uint32_t out = o0; out < o1; out++)
+			{
+				y[out] = dot_neon(x, LORA_DTYPE_F32,
+						  A + (uint64_t)out * rank, rank);
+			}
+		}
+	}
+}
+
+static void matmul_A_tile_neon(const float *intermediate, uint32_t tokens,
+			       const float *A, uint32_t out_channels,
+			       uint32_t rank, float *output)
+{
+	RANK_DISPATCH(rank,
+		      matmul_A_tile_neon_body(intermediate, tokens, A,
+					      out_channels, R, output));
+}
+
+static void accumulate_neon(float *acc, const float *x, uint32_t n)
+{
+	uint32_t c = 0;
+
+	for (; c + 16 <= n; c += 16)
+	{
+		vst1q_f32(acc + c, vaddq_f32(vld1q_f32(acc + c), vld1q_f32(x + c)));
+		vst1q_f32(acc + c + 4, vaddq_f32(vld1q_f32(acc + c + 4), vld1q_f32(x + c + 4)));
+		vst1q_f32(acc + c + 8, vaddq_f32(vld1q_f32(acc + c + 8), vld1q_f32(x + c + 8)));
+		vst1q_f32(acc + c + 12, vaddq_f32(vld1q_f32(acc + c + 12), vld1q_f32(x + c + 12)));
+	}
+	for (; c < n; c++)
+	{
+		acc[c] += x[c];
+	}
+}
+
+static void matmul_B_half_neon(const uint16_t *x, uint32_t dtype,
+			       const float *B, uint32_t rank,
+			       uint32_t in_channels, float *intermediate)
+{
+	HALF_DISPATCH(dtype,
+		      RANK_DISPATCH(rank,
+				    matmul_B_neon_body(x, D, B, R, in_channels,
+						       intermediate)));
+}
+
+static void accumulate_half_neon(float *acc, const uint16_t *x,
+				 uint32_t dtype, uint32_t n)
+{
+	uint32_t c = 0;
+
+	for (; c + 8 <= n; c += 8)
+	{
+		vst1q_f32(acc + c, vaddq_f32(vld1q_f32(acc + c), load_x_neon(x, c, dtype)));
+		vst1q_f32(acc + c + 4, vaddq_f32(vld1q_f32(acc + c + 4), load_x_neon(x, c + 4, dtype)));
+	}
+	for (; c < n; c++)
+	{
+		acc[c] += load_x(x, c, dtype);
+	}
+}
+
+static void widen_half_neon(float *dst, const uint16_t *x, uint32_t dtype,
+			    uint32_t n)
+{
+	uint32_t c = 0;
+
+	for (; c + 4 <= n; c += 4)
+	{
+		vst1q_f32(dst + c, load_x_neon(x, c, dtype));
+	}
+	for (; c < n; c++)
+	{
+		dst[c] = load_x(x, c, dtype);
+	}
+}
+
+// Widen eight int8 weights to two float vectors.
+static inline void cvt_s8x8_neon(int8x8_t q, float32x4_t *lo, float32x4_t *hi)
+{
+	int16x8_t w = vmovl_s8(q);
+
+	*lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(w)));
+	*hi = vcvtq_f32_s32(vmovl_high_s16(w));
+}
+
+static void matmul_B_q8_neon(const float *x, const int8_t *B_q,
+			     const float *B_scale,
+			     uint32_t rank, uint32_t in_channels,
+			     float *intermediate)
+{
+	for (uint32_t r = 0; r < rank; r++)
+	{
+		const int8_t *row = B_q + (uint64_t)r * in_channels;
+		float32x4_t acc0 = vdupq_n_f32(0.0f);
+		float32x4_t acc1 = vdupq_n_f32(0.0f);
+		float32x4_t acc2 = vdupq_n_f32(0.0f);
+		float32x4_t acc3 = vdupq_n_f32(0.0f);
+		uint32_t c = 0;
+		float sum;
+
+		for (; c + 16 <= in_channels; c += 16)
+		{
+			float32x4_t w0, w1, w2, w3;
+			cvt_s8x8_neon(vld1_s8(row + c), &w0, &w1);
+			cvt_s8x8_neon(vld1_s8(row + c + 8), &w2, &w3);
+			acc0 = vfmaq_f32(acc0, vld1q_f32(x + c), w0);
+			acc1 = vfmaq_f32(acc1, vld1q_f32(x + c + 4), w1);
+			acc2 = vfmaq_f32(acc2, vld1q_f32(x + c + 8), w2);
+			acc3 = vfmaq_f32(acc3, vld1q_f32(x + c + 12), w3);
+		}
+		sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1),
+					   vaddq_f32(acc2, acc3)));
+		for (; c < in_channels; c++)
+		{
+			sum += x[c] * row[c];
+		}
+		intermediate[r] = sum * B_scale[r];
+	}
+}
+
+static void matmul_B_q4_neon(const float *x, const uint8_t *B_q,
+			     const float *B_scale,
+			     uint32_t rank, uint32_t in_channels,
+			     float *intermediate)
+{
+	const uint32_t groups = in_channels / LORA_Q4_GROUP;
+	const uint8x16_t mask = vdupq_n_u8(0x0F);
+	const int8x16_t bias = vdupq_n_s8(8);
+
+	for (uint32_t r = 0; r < rank; r++)
+	{
+		const uint8_t *row = B_q + (uint64_t)r * in_channels / 2;
+		const float *scale = B_scale + (uint64_t)r * groups;
+		float32x4_t acc = vdupq_n_f32(0.0f);
+
+		for (uint32_t g = 0; g < groups; g++)
+		{
+			const float *xg = x + g * LORA_Q4_GROUP;
+			uint8x16_t v = vld1q_u8(row + g * (LORA_Q4_GROUP / 2));
+			int8x16_t lo = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v, mask)), bias);
+			int8x16_t hi = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v, 4)), bias);
+			float32x4_t w[8];
+			float32x4_t g0, g1;
+
+			cvt_s8x8_neon(vget_low_s8(lo), &w[0], &w[1]);
+			cvt_s8x8_neon(vget_high_s8(lo), &w[2], &w[3]);
+			cvt_s8x8_neon(vget_low_s8(hi), &w[4], &w[5]);
+			cvt_s8x8_neon(vget_high_s8(hi), &w[6], &w[7]);
+			g0 = vmulq_f32(vld1q_f32(xg), w[0]);
+			g1 = vmulq_f32(vld1q_f32(xg + 4), w[1]);
+			g0 = vfmaq_f32(g0, vld1q_f32(xg + 8), w[2]);
+			g1 = vfmaq_f32(g1, vld1q_f32(xg + 12), w[3]);
+			g0 = vfmaq_f32(g0, vld1q_f32(xg + 16), w[4]);
+			g1 = vfmaq_f32(g1, vld1q_f32(xg + 20), w[5]);
+			g0 = vfmaq_f32(g0, vld1q_f32(xg + 24), w[6]);
+			g1 = vfmaq_f32(g1, vld1q_f32(xg + 28), w[7]);
+			acc = vfmaq_n_f32(acc, vaddq_f32(g0, g1), scale[g]);
+		}
+		intermediate[r] = vaddvq_f32(acc);
+	}
+}
+#endif /* __aarch64__ */
+
+// ---------------------------------------------------------------------------
+// AVX2 + FMA (x86-64 host builds, selected at runtime)
+// ---------------------------------------------------------------------------
+
+#if defined(__x86_64__)
+#define AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+
+static bool avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+	       __builtin_cpu_supports("f16c");
+}
+
+AVX2_TARGET static ALWAYS_INLINE float hsum_avx2(__m256 v)
+{
+	__m128 lo = _mm256_castps256_ps128(v);
+	__m128 hi = _mm256_extractf128_ps(v, 1);
+
+	lo = _mm_add_ps(lo, hi);
+	lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+	lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+	return _mm_cvtss_f32(lo);
+}
+
+// Eight elements of an activation vector of the given dtype, as fp32.
+AVX2_TARGET static ALWAYS_INLINE __m256 load_x_avx2(const void *x, uint32_t c,
+						   uint32_t dtype)
+{
+	const __m128i *h = (const __m128i *)((const uint16_t *)x + c);
+
+	switch (dtype)
+	{
+	case LORA_DTYPE_F16:
+		return _mm256_cvtph_ps(_mm_loadu_si128(h));
+	case LORA_DTYPE_BF16:
+		return _mm256_castsi256_ps(_mm256_slli_epi32(
+			_mm256_cvtepu16_epi32(_mm_loadu_si128(h)), 16));
+	default:
+		return _mm256_loadu_ps((const float *)x + c);
+	}
+}
+
+AVX2_TARGET static ALWAYS_INLINE float dot_avx2(const void *x, uint32_t dtype,
+						 const float *row, uint32_t n)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	uint32_t c = 0;
+	float sum;
+
+	for (; c + 32 <= n; c += 32)
+	{
+		acc0 = _mm256_fmadd_ps(load_x_avx2(x, c, dtype), _mm256_loadu_ps(row + c), acc0);
+		acc1 = _mm256_fmadd_ps(load_x_avx2(x, c + 8, dtype), _mm256_loadu_ps(row + c + 8), acc1);
+		acc2 = _mm256_fmadd_ps(load_x_avx2(x, c + 16, dtype), _mm256_loadu_ps(row + c + 16), acc2);
+		acc3 = _mm256_fmadd_ps(load_x_avx2(x, c + 24, dtype), _mm256_loadu_ps(row + c + 24), acc3);
+	}
+	for (; c + 8 <= n; c += 8)
+	{
+		acc0 = _mm256_fmadd_ps(load_x_avx2(x, c, dtype), _mm256_loadu_ps(row + c), acc0);
+	}
+	sum = hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1),
+				      _mm256_add_ps(acc2, acc3)));
+	for (; c < n; c++)
+	{
+		sum += load_x(x, c, dtype) * row[c];
+	}
+	return sum;
+}
+
+AVX2_TARGET static ALWAYS_INLINE void matmul_B_avx2_body(const void *x, uint32_t dtype,
+							 const float *B,
+							 uint32_t rank, uint32_t in_channels,
+							 float *intermediate)
+{
+	uint32_t r = 0;
+
+	// Same blocking as the NEON variant: four rows share each x load,
+	// two accumulators per row.
+	for (; r + 4 <= rank; r += 4)
+	{
+		const float *b0 = B + (uint64_t)r * in_channels;
+		const float *b1 = b0 + in_channels;
+		const float *b2 = b1 + in_channels;
+		const float *b3 = b2 + in_channels;
+		__m256 a0 = _mm256_setzero_ps(), a0h = _mm256_setzero_ps();
+		__m256 a1 = _mm256_setzero_ps(), a1h = _mm256_setzero_ps();
+		__m256 a2 = _mm256_setzero_ps(), a2h = _mm256_setzero_ps();
+		__m256 a3 = _mm256_setzero_ps(), a3h = _mm256_setzero_ps();
+		float s0, s1, s2, s3;
+		uint32_t c = 0;
+
+		for (; c + 16 <= in_channels; c += 16)
+		{
+			__m256 xl = load_x_avx2(x, c, dtype);
+			__m256 xh = load_x_avx2(x, c + 8, dtype);
+			a0 = _mm256_fmadd_ps(xl, _mm256_loadu_ps(b0 + c), a0);
+			a0h = _mm256_fmadd_ps(xh, _mm256_loadu_ps(b0 + c + 8), a0h);
+			a1 = _mm256_fmadd_ps(xl, _mm256_loadu_ps(b1 + c), a1);
+			a1h = _mm256_fmadd_ps(xh, _mm256_loadu_ps(b1 + c + 8), a1h);
+			a2 = _mm256_fmadd_ps(xl, _mm256_loadu_ps(b2 + c), a2);
+			a2h = _mm256_fmadd_ps(xh, _mm256_loadu_ps(b2 + c + 8), a2h);
+			a3 = _mm256_fmadd_ps(xl, _mm256_loadu_ps(b3 + c), a3);
+			a3h = _mm256_fmadd_ps(xh, _mm256_loadu_ps(b3 + c + 8), a3h);
+		}
+		s0 = hsum_avx2(_mm256_add_ps(a0, a0h));
+		s1 = hsum_avx2(_mm256_add_ps(a1, a1h));
+		s2 = hsum_avx2(_mm256_add_ps(a2, a2h));
+		s3 = hsum_avx2(_mm256_add_ps(a3, a3h));
+		for (; c < in_channels; c++)
+		{
+			const float xc = load_x(x, c, dtype);
+
+			s0 += xc * b0[c];
+			s1 += xc * b1[c];
+			s2 += xc * b2[c];
+			s3 += xc * b3[c];
+		}
+		intermediate[r] = s0;
+		intermediate[r + 1] = s1;
+		intermediate[r + 2] = s2;
+		intermediate[r + 3] = s3;
+	}
+	for (; r < rank; r++)
+	{
+		intermediate[r] = dot_avx2(x, dtype, B + (uint64_t)r * in_channels,
+					   in_channels);
+	}
+}
+
+AVX2_TARGET static void matmul_B_avx2(const float *x, const float *B,
+				      uint32_t rank, uint32_t in_channels,
+				      float *intermediate)
+{
+	RANK_DISPATCH(rank,
+		      matmul_B_avx2_body(x, LORA_DTYPE_F32, B, R, in_channels, intermediate));
+}
+
+AVX2_TARGET static ALWAYS_INLINE void matmul_A_avx2_body(const float *intermediate,
+							 const float *A,
+							 uint32_t out_channels, uint32_t rank,
+							 float *output)
+{
+	for (uint32_t out = 0; out < out_channels; out++)
+	{
+		output[out] = dot_avx2(intermediate, LORA_DTYPE_F32, A + (uint64_t)out * rank,
+				       rank);
+	}
+}
+
+AVX2_TARGET static void matmul_A_avx2(const float *intermediate, const float *A,
+				      uint32_t out_channels, uint32_t rank,
+				      float *output)
+{
+	RANK_DISPATCH(rank,
+		      matmul_A_avx2_body(intermediate, A, out_channels, R, output));
+}
+
+AVX2_TARGET static ALWAYS_INLINE void matmul_B_tile_avx2_body(const void *X, uint32_t dtype,
+							      uint32_t tokens, const float *B,
+							      uint32_t rank, uint32_t in_channels,
+							      float *intermediate)
+{
+	uint32_t t = 0;
+
+	// TILE_BLOCK tokens by two rows: eight accumulators plus the loaded
+	// vectors fit the sixteen ymm registers.
+	for (; t + TILE_BLOCK <= tokens; t += TILE_BLOCK)
+	{
+		const void *x0 = tile_token(X, dtype, in_channels, t);
+		const void *x1 = tile_token(X, dtype, in_channels, t + 1);
+		const void *x2 = tile_token(X, dtype, in_channels, t + 2);
+		const void *x3 = tile_token(X, dtype, in_channels, t + 3);
+		float *out = intermediate + (uint64_t)t * rank;
+		uint32_t r = 0;
+
+		for (; r + 2 <= rank; r += 2)
+		{
+			const float *b0 = B + (uint64_t)r * in_channels;
+			const float *b1 = b0 + in_channels;
+			__m256 a00 = _mm256_setzero_ps(), a01 = _mm256_setzero_ps();
+			__m256 a10 = _mm256_setzero_ps(), a11 = _mm256_setzero_ps();
+			__m256 a20 = _mm256_setzero_ps(), a21 = _mm256_setzero_ps();
+			__m256 a30 = _mm256_setzero_ps(), a31 = _mm256_setzero_ps();
+			float s[TILE_BLOCK][2];
+			uint32_t c = 0;
+
+			for (; c + 8 <= in_channels; c += 8)
+			{
+				const __m256 bv0 = _mm256_loadu_ps(b0 + c);
+				const __m256 bv1 = _mm256_loadu_ps(b1 + c);
+				__m256 xv;
+
+				xv = load_x_avx2(x0, c, dtype);
+				a00 = _mm256_fmadd_ps(xv, bv0, a00);
+				a01 = _mm256_fmadd_ps(xv, bv1, a01);
+				xv = load_x_avx2(x1, c, dtype);
+				a10 = _mm256_fmadd_ps(xv, bv0, a10);
+				a11 = _mm256_fmadd_ps(xv, bv1, a11);
+				xv = load_x_avx2(x2, c, dtype);
+				a20 = _mm256_fmadd_ps(xv, bv0, a20);
+				a21 = _mm256_fmadd_ps(xv, bv1, a21);
+				xv = load_x_avx2(x3, c, dtype);
+				a30 = _mm256_fmadd_ps(xv, bv0, a30);
+				a31 = _mm256_fmadd_ps(xv, bv1, a31);
+			}
+			s[0][0] = hsum_avx2(a00);
+			s[0][1] = hsum_avx2(a01);
+			s[1][0] = hsum_avx2(a10);
+			s[1][1] = hsum_avx2(a11);
+			s[2][0] = hsum_avx2(a20);
+			s[2][1] = hsum_avx2(a21);
+			s[3][0] = hsum_avx2(a30);
+			s[3][1] = hsum_avx2(a31);
+			for (; c < in_channels; c++)
+			{
+				const float xc[TILE_BLOCK] = {
+					load_x(x0, c, dtype), load_x(x1, c, dtype),
+					load_x(x2, c, dtype), load_x(x3, c, dtype),
+				};
+
+				for (uint32_t i = 0; i < TILE_BLOCK; i++)
+				{
+					s[i][0] += xc[i] * b0[c];
+					s[i][1] += xc[i] * b1[c];
+				}
+			}
+			for (uint32_t i = 0; i < TILE_BLOCK; i++)
+			{
+				out[(uint64_t)i * rank + r] = s[i][0];
+				out[(uint64_t)i * rank + r + 1] = s[i][1];
+			}
+		}
+		for (; r < rank; r++)
+		{
+			const float *row = B + (uint64_t)r * in_channels;
+
+			out[r] = dot_avx2(x0, dtype, row, in_channels);
+			out[rank + r] = dot_avx2(x1, dtype, row, in_channels);
+			out[2 * rank + r] = dot_avx2(x2, dtype, row, in_channels);
+			out[3 * rank + r] = dot_avx2(x3, dtype, row, in_channels);
+		}
+	}
+	for (; t < tokens; t++)
+	{
+		matmul_B_avx2_body(tile_token(X, dtype, in_channels, t), dtype,
+				   B, rank, in_channels,
+				   intermediate + (uint64_t)t * rank);
+	}
+}
+
+AVX2_TARGET static void matmul_B_tile_avx2(const void *X, uint32_t dtype,
+					   uint32_t tokens, const float *B,
+					   uint32_t rank, uint32_t in_channels,
+					   float *intermediate)
+{
+	DTYPE_DISPATCH(dtype,
+		       RANK_DISPATCH(rank,
+				     matmul_B_tile_avx2_body(X, D, tokens, B, R,
+							     in_channels,
+							     intermediate)));
+}
+
+AVX2_TARGET static ALWAYS_INLINE void matmul_A_tile_avx2_body(const float *intermediate,
+							      uint32_t tokens, const float *A,
+							      uint32_t out_channels, uint32_t rank,
+							      float *output)
+{
+	for (uint32_t o0 = 0; o0 < out_channels; o0 += TILE_A_ROWS)
+	{
+		const uint32_t o1 = tile_a_end(o0, out_channels);
+
+		for (uint32_t t = 0; t < tokens; t++)
+		{
+			const float *x = intermediate + (uint64_t)t * rank;
+			float *y = output + (uint64_t)t * out_channels;
+
+			for (uint32_t out = o0; out < o1; out++)
+			{
+				y[out] = dot_avx2(x, LORA_DTYPE_F32,
+						  A + (uint64_t)out * rank, rank);
+			}
+		}
+	}
+}
+
+AVX2_TARGET static void matmul_A_tile_avx2(const float *intermediate,
+					   uint32_t tokens, const float *A,
+					   uint32_t out_channels, uint32_t rank,
+					   float *output)
+{
+	RANK_DISPATCH(rank,
+		      matmul_A_tile_avx2_body(intermediate, tokens, A,
+					      out_channels, R, output));
+}
+
+AVX2_TARGET static void accumulate_avx2(float *acc, const float *x, uint32_t n)
+{
+	uint32_t c = 0;
+
+	for (; c + 32 <= n; c += 32)
+	{
+		_mm256_storeu_ps(acc + c, _mm256_add_ps(_mm256_loadu_ps(acc + c), _mm256_loadu_ps(x + c)));
+		_mm256_storeu_ps(acc + c + 8, _mm256_add_ps(_mm256_loadu_ps(acc + c + 8), _mm256_loadu_ps(x + c + 8)));
+		_mm256_storeu_ps(acc + c + 16, _mm256_add_ps(_mm256_loadu_ps(acc + c + 16), _mm256_loadu_ps(x + c + 16)));
+		_mm256_storeu_ps(acc + c + 24, _mm256_add_ps(_mm256_loadu_ps(acc + c + 24), _mm256_loadu_ps(x + c + 24)));
+	}
+	for (; c < n; c++)
+	{
+		acc[c] += x[c];
+	}
+}
+
+AVX2_TARGET static void matmul_B_half_avx2(const uint16_t *x, uint32_t dtype,
+					   const float *B, uint32_t rank,
+					   uint32_t in_channels,
+					   float *intermediate)
+{
+	HALF_DISPATCH(dtype,
+		      RANK_DISPATCH(rank,
+				    matmul_B_avx2_body(x, D, B, R, in_channels,
+						       intermediate)));
+}
+
+AVX2_TARGET static void accumulate_half_avx2(float *acc, const uint16_t *x,
+					     uint32_t dtype, uint32_t n)
+{
+	uint32_t c = 0;
+
+	for (; c + 16 <= n; c += 16)
+	{
+		_mm256_storeu_ps(acc + c, _mm256_add_ps(_mm256_loadu_ps(acc + c), load_x_avx2(x, c, dtype)));
+		_mm256_storeu_ps(acc + c + 8, _mm256_add_ps(_mm256_loadu_ps(acc + c + 8), load_x_avx2(x, c + 8, dtype)));
+	}
+	for (; c < n; c++)
+	{
+		acc[c] += load_x(x, c, dtype);
+	}
+}
+
+AVX2_TARGET static void widen_half_avx2(float *dst, const uint16_t *x,
+					uint32_t dtype, uint32_t n)
+{
+	uint32_t c = 0;
+
+	for (; c + 8 <= n; c += 8)
+	{
+		_mm256_storeu_ps(dst + c, load_x_avx2(x, c, dtype));
+	}
+	for (; c < n; c++)
+	{
+		dst[c] = load_x(x, c, dtype);
+	}
+}
+
+// Widen eight int8 weights to one float vector.
+AVX2_TARGET static inline __m256 cvt_s8x8_avx2(const int8_t *q)
+{
+	__m128i v = _mm_loadl_epi64((const __m128i *)q);
+
+	return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v));
+}
+
+AVX2_TARGET static void matmul_B_q8_avx2(const float *x, const int8_t *B_q,
+					 const float *B_scale,
+					 uint32_t rank, uint32_t in_channels,
+					 float *intermediate)
+{
+	for (uint32_t r = 0; r < rank; r++)
+	{
+		const int8_t *row = B_q + (uint64_t)r * in_channels;
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		__m256 acc2 = _mm256_setzero_ps();
+		__m256 acc3 = _mm256_setzero_ps();
+		uint32_t c = 0;
+		float sum;
+
+		for (; c + 32 <= in_channels; c += 32)
+		{
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + c), cvt_s8x8_avx2(row + c), acc0);
+			acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + c + 8), cvt_s8x8_avx2(row + c + 8), acc1);
+			acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + c + 16), cvt_s8x8_avx2(row + c + 16), acc2);
+			acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + c + 24), cvt_s8x8_avx2(row + c + 24), acc3);
+		}
+		sum = hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1),
+					      _mm256_add_ps(acc2, acc3)));
+		for (; c < in_channels; c++)
+		{
+			sum += x[c] * row[c];
+		}
+		intermediate[r] = sum * B_scale[r];
+	}
+}
+
+AVX2_TARGET static void matmul_B_q4_avx2(const float *x, const uint8_t *B_q,
+					 const float *B_scale,
+					 uint32_t rank, uint32_t in_channels,
+					 float *intermediate)
+{
+	const uint32_t groups = in_channels / LORA_Q4_GROUP;
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	const __m256 bias = _mm256_set1_ps(8.0f);
+
+	for (uint32_t r = 0; r < rank; r++)
+	{
+		const uint8_t *row = B_q + (uint64_t)r * in_channels / 2;
+		const float *scale = B_scale + (uint64_t)r * groups;
+		__m256 acc = _mm256_setzero_ps();
+
+		for (uint32_t g = 0; g < groups; g++)
+		{
+			const float *xg = x + g * LORA_Q4_GROUP;
+			__m128i v = _mm_loadu_si128((const __m128i *)(row + g * (LORA_Q4_GROUP / 2)));
+			__m128i lo = _mm_and_si128(v, mask);
+			__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+			__m256 w0 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(lo)), bias);
+			__m256 w1 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8))), bias);
+			__m256 w2 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(hi)), bias);
+			__m256 w3 = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8))), bias);
+			__m256 g0 = _mm256_mul_ps(_mm256_loadu_ps(xg), w0);
+			__m256 g1 = _mm256_mul_ps(_mm256_loadu_ps(xg + 8), w1);
+
+			g0 = _mm256_fmadd_ps(_mm256_loadu_ps(xg + 16), w2, g0);
+			g1 = _mm256_fmadd_ps(_mm256_loadu_ps(xg + 24), w3, g1);
+			acc = _mm256_fmadd_ps(_mm256_add_ps(g0, g1),
+					      _mm256_set1_ps(scale[g]), acc);
+		}
+		intermediate[r] = hsum_avx2(acc);
+	}
+}
+#endif /* __x86_64__ */
+
+const struct lora_kernels lora_kernel_table[] = {
+#if defined(__aarch64__)
+	{
+		.name = "neon",
+		.supported = always_supported,
+		.matmul_B = matmul_B_neon,
+		.matmul_A = matmul_A_neon,
+		.matmul_B_tile = matmul_B_tile_neon,
+		.matmul_A_tile = matmul_A_tile_neon,
+		.accumulate = accumulate_neon,
+		.matmul_B_q8 = matmul_B_q8_neon,
+		.matmul_B_q4 = matmul_B_q4_neon,
+		.matmul_A_q8 = matmul_A_q8_scalar,
+		.matmul_B_half = matmul_B_half_neon,
+		.accumulate_half = accumulate_half_neon,
+		.widen_half = widen_half_neon,
+		.narrow_half = narrow_half_scalar,
+	},
+#endif
+#if defined(__x86_64__)
+	{
+		.name = "avx2",
+		.supported = avx2_supported,
+		.matmul_B = matmul_B_avx2,
+		.matmul_A = matmul_A_avx2,
+		.matmul_B_tile = matmul_B_tile_avx2,
+		.matmul_A_tile = matmul_A_tile_avx2,
+		.accumulate = accumulate_avx2,
+		.matmul_B_q8 = matmul_B_q8_avx2,
+		.matmul_B_q4 = matmul_B_q4_avx2,
+		.matmul_A_q8 = matmul_A_q8_scalar,
+		.matmul_B_half = matmul_B_half_avx2,
+		.accumulate_half = accumulate_half_avx2,
+		.widen_half = widen_half_avx2,
+		.narrow_half = narrow_half_scalar,
+	},
+#endif
+	{
+		.name = "scalar",
+		.supported = always_supported,
+		.matmul_B = matmul_B_scalar,
+		.matmul_A = matmul_A_scalar,
+		.matmul_B_tile = matmul_B_tile_scalar,
+		.matmul_A_tile = matmul_A_tile_scalar,
+		.accumulate = accumulate_scalar,
+		.matmul_B_q8 = matmul_B_q8_scalar,
+		.matmul_B_q4 = matmul_B_q4_scalar,
+		.matmul_A_q8 = matmul_A_q8_scalar,
+		.matmul_B_half = matmul_B_half_scalar,
+		.accumulate_half = accumulate_half_scalar,
+		.widen_half = widen_half_scalar,
+		.narrow_half = narrow_half_scalar,
+	},
+};
+
+const uint32_t lora_kernel_count =
+	sizeof(lora_kernel_table) / sizeof(lora_kernel_table[0]);
+
+const struct lora_kernels *lora_kernels_select(void)
+{
+	for (uint32_t i = 0; i < lora_kernel_count; i++)
+	{
+		if (lora_kernel_table[i].supported())
+			return &lora_kernel_table[i];
+	}
+	return &lora_kernel_table[lora_kernel_count - 1];
+}
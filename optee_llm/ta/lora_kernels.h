@@ -0,0 +1,96 @@
+/*
+ * LoRA compute kernels.
+ *
+ * The kernels are plain C with no dependency on the TEE Internal API so
+ * that they can be built and measured outside the TA as well. Each variant
+ * (scalar, NEON, AVX2) fills one struct lora_kernels; the TA selects the
+ * best variant the CPU supports once, in TA_CreateEntryPoint().
+ */
+
+#ifndef LORA_KERNELS_H
+#define LORA_KERNELS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <optee_llm_ta.h>
+
+// Alignment of the weight buffers handed to the kernels (one cache line).
+#define LORA_WEIGHT_ALIGN 64
+
+// Most tokens the forward pass hands to one matmul_B_tile/matmul_A_tile call.
+#define LORA_TILE_TOKENS 16
+
+struct lora_kernels {
+	const char *name;
+	// Returns true if the running CPU can execute this variant.
+	bool (*supported)(void);
+	// intermediate[r] = dot(x, B[r]) for r < rank; B is [rank][in_channels].
+	void (*matmul_B)(const float *x, const float *B,
+			 uint32_t rank, uint32_t in_channels,
+			 float *intermediate);
+	// output[o] = dot(intermediate, A[o]) for o < out_channels;
+	// A is [out_channels][rank].
+	void (*matmul_A)(const float *intermediate, const float *A,
+			 uint32_t out_channels, uint32_t rank,
+			 float *output);
+	// Multi-token forms of matmul_B/matmul_A, for up to LORA_TILE_TOKENS
+	// tokens at a time. Blocks of tokens share every weight load, so the
+	// weights are streamed once per block rather than once per token.
+	// intermediate[t][r] = dot(X[t], B[r]); X is [tokens][in_channels] of
+	// dtype (any LORA_DTYPE_*) and intermediate is [tokens][rank].
+	void (*matmul_B_tile)(const void *X, uint32_t dtype, uint32_t tokens,
+			      const float *B, uint32_t rank,
+			      uint32_t in_channels, float *intermediate);
+	// output[t][o] = dot(intermediate[t], A[o]); output is
+	// [tokens][out_channels].
+	void (*matmul_A_tile)(const float *intermediate, uint32_t tokens,
+			      const float *A, uint32_t out_channels,
+			      uint32_t rank, float *output);
+	// acc[c] += x[c] for c < n; the streaming reduction of the pooled path.
+	void (*accumulate)(float *acc, const float *x, uint32_t n);
+
+	// Quantized adapters (see LORA_FMT_* in optee_llm_ta.h). The weights
+	// are dequantized inside the dot products, never into a float copy.
+	// LORA_FMT_Q8 lora_B: intermediate[r] = B_scale[r] * dot(x, B_q[r]).
+	void (*matmul_B_q8)(const float *x, const int8_t *B_q,
+			    const float *B_scale,
+			    uint32_t rank, uint32_t in_channels,
+			    float *intermediate);
+	// LORA_FMT_Q4 lora_B: one scale per LORA_Q4_GROUP inputs of a row;
+	// in_channels must be a multiple of LORA_Q4_GROUP.
+	void (*matmul_B_q4)(const float *x, const uint8_t *B_q,
+			    const float *B_scale,
+			    uint32_t rank, uint32_t in_channels,
+			    float *intermediate);
+	// Quantized lora_A: output[o] = A_scale[o] * dot(intermediate, A_q[o]).
+	void (*matmul_A_q8)(const float *intermediate, const int8_t *A_q,
+			    const float *A_scale,
+			    uint32_t out_channels, uint32_t rank,
+			    float *output);
+
+	// Half precision activations, dtype LORA_DTYPE_F16 or LORA_DTYPE_BF16
+	// (see optee_llm_ta.h). Elements are widened to fp32 as they are
+	// loaded and all arithmetic is fp32.
+	// matmul_B for LORA_FMT_F32 weights with a half precision x.
+	void (*matmul_B_half)(const uint16_t *x, uint32_t dtype,
+			      const float *B, uint32_t rank,
+			      uint32_t in_channels, float *intermediate);
+	// acc[c] += x[c] for c < n.
+	void (*accumulate_half)(float *acc, const uint16_t *x, uint32_t dtype,
+				uint32_t n);
+	// dst[c] = x[c] for c < n, widening to fp32.
+	void (*widen_half)(float *dst, const uint16_t *x, uint32_t dtype,
+			   uint32_t n);
+	// dst[c] = x[c] for c < n, rounding to the nearest half value.
+	void (*narrow_half)(uint16_t *dst, const float *x, uint32_t dtype,
+			    uint32_t n);
+};
+
+// All variants, best first. The scalar variant is last and always supported.
+extern const struct lora_kernels lora_kernel_table[];
+extern const uint32_t lora_kernel_count;
+
+// The first variant in lora_kernel_table the CPU supports.
+const struct lora_kernels *lora_kernels_select(void);
+
+#endif /* LORA_KERNELS_H */
@@ -0,0 +1,127 @@
+/*
+ * Cache of shared prompt prefixes.
+ */
+
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "lora_prefix.h"
+
+void lora_prefix_init(struct lora_prefix_cache *pc, uint32_t budget)
+{
+	TAILQ_INIT(&pc->lru);
+	pc->budget = budget;
+	pc->bytes = 0;
+	pc->entries = 0;
+	pc->hits = 0;
+	pc->misses = 0;
+	pc->evictions = 0;
+}
+
+void lora_prefix_remove(struct lora_prefix_cache *pc,
+			struct lora_prefix_entry *e)
+{
+	TAILQ_REMOVE(&pc->lru, e, link);
+	pc->bytes -= e->bytes;
+	pc->entries--;
+	TEE_Free(e);
+}
+
+void lora_prefix_clear(struct lora_prefix_cache *pc)
+{
+	while (!TAILQ_EMPTY(&pc->lru))
+		lora_prefix_remove(pc, TAILQ_FIRST(&pc->lru));
+}
+
+// Evict least recently used entries until bytes more fit in the budget.
+static void make_room(struct lora_prefix_cache *pc, uint32_t bytes)
+{
+	struct lora_prefix_entry *e;
+
+	while (pc->bytes + bytes > pc->budget &&
+	       (e = TAILQ_LAST(&pc->lru, lora_prefix_list)))
+	{
+		lora_prefix_remove(pc, e);
+		pc->evictions++;
+	}
+}
+
+static bool key_equal(const struct lora_prefix_key *a,
+		      const struct lora_prefix_key *b)
+{
+	return a->hash == b->hash && a->generation == b->generation &&
+	       a->adapter_id == b->adapter_id &&
+	       a->input_dtype == b->input_dtype && a->tokens == b->tokens;
+}
+
+struct lora_prefix_entry *lora_prefix_find(struct lora_prefix_cache *pc,
+					   const struct lora_prefix_key *key)
+{
+	struct lora_prefix_entry *e;
+
+	TAILQ_FOREACH(e, &pc->lru, link)
+	{
+		if (!key_equal(&e->key, key))
+			continue;
+		pc->hits++;
+		if (e != TAILQ_FIRST(&pc->lru))
+		{
+			TAILQ_REMOVE(&pc->lru, e, link);
+			TAILQ_INSERT_HEAD(&pc->lru, e, link);
+		}
+		return e;
+	}
+	pc->misses++;
+	return NULL;
+}
+
+struct lora_prefix_entry *lora_prefix_add(struct lora_prefix_cache *pc,
+					  const struct lora_prefix_key *key,
+					  uint32_t width,
+					  uint32_t out_channels)
+{
+	// One allocation: the entry, then sum, last, max and the rows.
+	const uint64_t floats = (2 + (uint64_t)key->tokens) * width +
+				out_channels;
+	const uint64_t bytes = sizeof(struct lora_prefix_entry) +
+			       floats * sizeof(float);
+	struct lora_prefix_entry *e;
+
+	if (bytes > pc->budget)
+		return NULL;
+	make_room(pc, bytes);
+
+	e = TEE_Malloc(bytes, TEE_MALLOC_FILL_ZERO);
+	if (!e)
+		return NULL;
+	e->key = *key;
+	e->width = width;
+	e->bytes = bytes;
+	e->sum = (float *)(e + 1);
+	e->last = e->sum + width;
+	e->max = e->last + width;
+	e->rows = e->max + out_channels;
+
+	TAILQ_INSERT_HEAD(&pc->lru, e, link);
+	pc->bytes += bytes;
+	pc->entries++;
+	return e;
+}
+
+void lora_prefix_set_budget(struct lora_prefix_cache *pc, uint32_t budget)
+{
+	pc->budget = budget;
+	make_room(pc, 0);
+}
+
+void lora_prefix_get_stats(const struct lora_prefix_cache *pc,
+			   lora_prefix_stats_t *stats)
+{
+	stats->hits = pc->hits;
+	stats->misses = pc->misses;
+	stats->evictions = pc->evictions;
+	stats->entries = pc->entries;
+	stats->resident_bytes = pc->bytes;
+	stats->budget_bytes = pc->budget;
+	stats->reserved = 0;
+}
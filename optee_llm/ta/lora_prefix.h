@@ -0,0 +1,74 @@
+/*
+ * Cache of shared prompt prefixes (LORA_FLAG_PREFIX), keyed by the host's
+ * prefix hash.
+ *
+ * An entry holds what the forward pass needs of a prefix in place of its
+ * tokens: the per-token projections in rank space (out_channels wide for a
+ * merged adapter), their sum, the last one, and the element-wise max of
+ * the per-token outputs. Entries are kept on a list in least recently used
+ * order and their secure memory is accounted against a budget, as adapters
+ * are in the registry.
+ */
+
+#ifndef LORA_PREFIX_H
+#define LORA_PREFIX_H
+
+#include <sys/queue.h>
+#include <tee_internal_api.h>
+#include <optee_llm_ta.h>
+
+struct lora_prefix_key {
+	uint64_t hash;
+	// Registry generation of the adapter the state was computed with, so
+	// state of a replaced adapter is never used.
+	uint64_t generation;
+	uint32_t adapter_id;
+	uint32_t input_dtype;
+	uint32_t tokens;
+};
+
+struct lora_prefix_entry {
+	TAILQ_ENTRY(lora_prefix_entry) link;
+	struct lora_prefix_key key;
+	uint32_t width;		// floats per projection
+	uint32_t bytes;		// secure memory charged to the budget
+	float *sum;		// [width]
+	float *last;		// [width]
+	float *max;		// [out_channels]
+	float *rows;		// [tokens][width]
+};
+
+TAILQ_HEAD(lora_prefix_list, lora_prefix_entry);
+
+struct lora_prefix_cache {
+	struct lora_prefix_list lru;	// most recently used first
+	uint32_t budget;
+	uint32_t bytes;
+	uint32_t entries;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+void lora_prefix_init(struct lora_prefix_cache *pc, uint32_t budget);
+void lora_prefix_clear(struct lora_prefix_cache *pc);
+
+// Find the entry for key and mark it most recently used. Counts a hit or
+// a miss.
+struct lora_prefix_entry *lora_prefix_find(struct lora_prefix_cache *pc,
+					   const struct lora_prefix_key *key);
+// Add an empty entry for key, evicting to make room; the caller fills in
+// its state. NULL if it does not fit the budget or memory is short.
+struct lora_prefix_entry *lora_prefix_add(struct lora_prefix_cache *pc,
+					  const struct lora_prefix_key *key,
+					  uint32_t width,
+					  uint32_t out_channels);
+// Drop an entry, e.g. one whose state could not be computed.
+void lora_prefix_remove(struct lora_prefix_cache *pc,
+			struct lora_prefix_entry *e);
+// Change the budget, evicting entries that no longer fit.
+void lora_prefix_set_budget(struct lora_prefix_cache *pc, uint32_t budget);
+void lora_prefix_get_stats(const struct lora_prefix_cache *pc,
+			   lora_prefix_stats_t *stats);
+
+#endif /* LORA_PREFIX_H */
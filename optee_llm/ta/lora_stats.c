@@ -0,0 +1,54 @@
+/*
+ * Request counters of the TA instance.
+ */
+
+#include <tee_internal_api.h>
+
+#include "lora_stats.h"
+
+static lora_stats_t stats;
+static bool timing_on;
+
+static uint32_t hist_bucket(uint64_t ns)
+{
+	const uint32_t b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+	return b < LORA_HIST_BUCKETS ? b : LORA_HIST_BUCKETS - 1;
+}
+
+void lora_stats_record(uint64_t bytes_in, uint64_t bytes_out,
+		       const lora_timing_t *timing)
+{
+	stats.invocations++;
+	stats.bytes_in += bytes_in;
+	stats.bytes_out += bytes_out;
+	if (!timing)
+		return;
+
+	stats.timed++;
+	for (uint32_t p = 0; p < LORA_PHASE_COUNT; p++)
+	{
+		stats.phase_ns[p] += timing->phase_ns[p];
+		stats.hist[p][hist_bucket(timing->phase_ns[p])]++;
+	}
+}
+
+bool lora_stats_timing(void)
+{
+	return timing_on;
+}
+
+void lora_stats_get(lora_stats_t *out)
+{
+	*out = stats;
+}
+
+void lora_stats_control(uint32_t ops)
+{
+	if (ops & LORA_STATS_TIMING_ON)
+		timing_on = true;
+	if (ops & LORA_STATS_TIMING_OFF)
+		timing_on = false;
+	if (ops & LORA_STATS_RESET)
+		TEE_MemFill(&stats, 0, sizeof(stats));
+}
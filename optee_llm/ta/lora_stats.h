@@ -0,0 +1,73 @@
+/*
+ * Request instrumentation: a monotonic clock, per-phase timing of the
+ * request being served and the counters returned by
+ * TA_OPTEE_LLM_CMD_LORA_STATS.
+ *
+ * Timing is opt-in per request. An untimed request carries a NULL
+ * lora_timing_t and every phase boundary reduces to one branch.
+ */
+
+#ifndef LORA_STATS_H
+#define LORA_STATS_H
+
+#include <tee_internal_api.h>
+#include <optee_llm_ta.h>
+
+#if defined(__x86_64__)
+#include <time.h>
+#endif
+
+// Monotonic time in nanoseconds.
+static inline uint64_t lora_timer_ns(void)
+{
+#if defined(__aarch64__)
+	// The generic timer is readable from EL0 and, unlike
+	// TEE_GetSystemTime(), resolves well below a millisecond.
+	uint64_t cnt, frq;
+
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(cnt));
+	__asm__ volatile("mrs %0, cntfrq_el0" : "=r"(frq));
+	return cnt / frq * 1000000000ull + cnt % frq * 1000000000ull / frq;
+#elif defined(__x86_64__)
+	// OP-TEE has no x86 port, so this is the host emulation build.
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+	TEE_Time t;
+
+	TEE_GetSystemTime(&t);
+	return (uint64_t)t.seconds * 1000000000ull + t.millis * 1000000ull;
+#endif
+}
+
+// Start of a phase of a request timed by t, which may be NULL.
+static inline uint64_t lora_phase_start(const lora_timing_t *t)
+{
+	return t ? lora_timer_ns() : 0;
+}
+
+// Charge the time since start to phase; returns the start of the next one.
+static inline uint64_t lora_phase_end(lora_timing_t *t, uint32_t phase,
+				      uint64_t start)
+{
+	uint64_t now;
+
+	if (!t)
+		return 0;
+	now = lora_timer_ns();
+	t->phase_ns[phase] += now - start;
+	return now;
+}
+
+// Account a successful request; timing is NULL if it was not timed.
+void lora_stats_record(uint64_t bytes_in, uint64_t bytes_out,
+		       const lora_timing_t *timing);
+// True if every request should be timed (LORA_STATS_TIMING_ON).
+bool lora_stats_timing(void);
+void lora_stats_get(lora_stats_t *stats);
+// Apply LORA_STATS_* operations.
+void lora_stats_control(uint32_t ops);
+
+#endif /* LORA_STATS_H */
@@ -0,0 +1,242 @@
+/*
+ * On-device fine-tuning of resident adapters.
+ */
+
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "lora_train.h"
+
+// The state for entry's adapter, allocated on its first step and charged
+// to the registry budget with it.
+static struct lora_train_state *get_state(struct lora_cache *cache,
+					  struct lora_cache_entry *entry,
+					  bool reset)
+{
+	const lora_adapter_desc_t *d = &entry->adapter.desc;
+	const uint32_t params = d->rank * d->in_channels +
+				d->out_channels * d->rank;
+	const size_t floats = 3 * (size_t)params +
+			      LORA_TILE_TOKENS * ((size_t)2 * d->rank +
+						  d->out_channels +
+						  LORA_TRAIN_COLS);
+	struct lora_train_state *s = entry->train;
+
+	if (s)
+	{
+		if (reset)
+		{
+			s->steps = 0;
+			TEE_MemFill(s->m, 0, 2 * (size_t)params * sizeof(float));
+		}
+		return s;
+	}
+
+	if (lora_cache_alloc_train(cache, entry,
+				   sizeof(*s) + floats * sizeof(float)))
+		return NULL;
+	s = entry->train;
+	s->params = params;
+	s->grad = (float *)(s + 1);
+	s->m = s->grad + params;
+	s->v = s->m + params;
+	s->h = s->v + params;
+	s->dh = s->h + LORA_TILE_TOKENS * d->rank;
+	s->g = s->dh + LORA_TILE_TOKENS * d->rank;
+	s->x = s->g + LORA_TILE_TOKENS * d->out_channels;
+	return s;
+}
+
+// dst[c] = x[c] for c < n of a row of the given LORA_DTYPE_*.
+static void widen(const struct lora_kernels *kern, float *dst, const void *x,
+		  uint32_t dtype, uint32_t n)
+{
+	if (dtype == LORA_DTYPE_F32)
+		TEE_MemMove(dst, x, n * sizeof(float));
+	else
+		kern->widen_half(dst, x, dtype, n);
+}
+
+// Forward and backward pass of up to LORA_TILE_TOKENS tokens, adding their
+// gradients to s->grad. Each token's projection h = lora_B x is computed
+// once and serves both the lora_A gradient and, through
+// dh = lora_A^T g, the lora_B gradient.
+static void train_tile(const struct lora_adapter *ad,
+		       const struct lora_kernels *kern,
+		       struct lora_train_state *s, const void *X,
+		       uint32_t in_dtype, const void *G, uint32_t grad_dtype,
+		       uint32_t tokens)
+{
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t rank = ad->desc.rank;
+	const size_t x_stride = (size_t)in * lora_dtype_size(in_dtype);
+	const size_t g_stride = (size_t)out * lora_dtype_size(grad_dtype);
+	const float *A = (const float *)(ad->weights + ad->layout.A);
+	float *dB = s->grad;
+	float *dA = s->grad + rank * in;
+
+	lora_adapter_matmul_B_tile(ad, kern, X, in_dtype, tokens, NULL, s->h);
+
+	// dA += g h^T and dh = lora_A^T g, token by token: both are only
+	// out_channels x rank.
+	for (uint32_t t = 0; t < tokens; t++)
+	{
+		const float *h = s->h + t * rank;
+		float *dh = s->dh + t * rank;
+		float *g = s->g + t * out;
+
+		widen(kern, g, (const uint8_t *)G + t * g_stride, grad_dtype,
+		      out);
+		TEE_MemFill(dh, 0, rank * sizeof(float));
+		for (uint32_t o = 0; o < out; o++)
+		{
+			const float *a = A + o * rank;
+			float *da = dA + o * rank;
+
+			for (uint32_t r = 0; r < rank; r++)
+			{
+				da[r] += g[o] * h[r];
+				dh[r] += g[o] * a[r];
+			}
+		}
+	}
+
+	// dB += dh^T X, one block of columns at a time: the tile's inputs
+	// for the block are widened once and every row of dB is visited
+	// once per tile rather than once per token.
+	for (uint32_t c0 = 0; c0 < in; c0 += LORA_TRAIN_COLS)
+	{
+		const uint32_t n = in - c0 < LORA_TRAIN_COLS ? in - c0 :
+							       LORA_TRAIN_COLS;
+
+		for (uint32_t t = 0; t < tokens; t++)
+		{
+			widen(kern, s->x + t * LORA_TRAIN_COLS,
+			      (const uint8_t *)X + t * x_stride +
+			      (size_t)c0 * lora_dtype_size(in_dtype),
+			      in_dtype, n);
+		}
+		for (uint32_t r = 0; r < rank; r++)
+		{
+			float *row = dB + (size_t)r * in + c0;
+
+			for (uint32_t t = 0; t < tokens; t++)
+			{
+				const float d = s->dh[t * rank + r];
+				const float *x = s->x + t * LORA_TRAIN_COLS;
+
+				for (uint32_t c = 0; c < n; c++)
+					row[c] += d * x[c];
+			}
+		}
+	}
+}
+
+// b^n by squaring.
+static float pow_u32(float b, uint32_t n)
+{
+	float r = 1.0f;
+
+	while (n)
+	{
+		if (n & 1)
+			r *= b;
+		b *= b;
+		n >>= 1;
+	}
+	return r;
+}
+
+// sqrt(x) for x >= 0 without math.h: a bit-level estimate within a few
+// percent, refined by Newton's method to float precision.
+static float sqrt_pos(float x)
+{
+	union {
+		float f;
+		uint32_t u;
+	} v = { .f = x };
+
+	if (x <= 0.0f)
+		return 0.0f;
+	v.u = (v.u >> 1) + 0x1fbb4000u;
+	for (int i = 0; i < 3; i++)
+		v.f = 0.5f * (v.f + x / v.f);
+	return v.f;
+}
+
+static void sgd_update(float *w, const float *g, uint32_t n,
+		       const lora_train_step_t *step)
+{
+	for (uint32_t i = 0; i < n; i++)
+		w[i] -= step->lr * (g[i] + step->weight_decay * w[i]);
+}
+
+static void adam_update(struct lora_train_state *s, float *w,
+			const lora_train_step_t *step)
+{
+	const float b1 = step->beta1;
+	const float b2 = step->beta2;
+	float c1, c2;
+
+	s->steps++;
+	c1 = 1.0f / (1.0f - pow_u32(b1, s->steps));
+	c2 = 1.0f / (1.0f - pow_u32(b2, s->steps));
+	for (uint32_t i = 0; i < s->params; i++)
+	{
+		const float g = s->grad[i];
+
+		s->m[i] = b1 * s->m[i] + (1.0f - b1) * g;
+		s->v[i] = b2 * s->v[i] + (1.0f - b2) * g * g;
+		w[i] -= step->lr * (s->m[i] * c1 /
+				    (sqrt_pos(s->v[i] * c2) + step->eps) +
+				    step->weight_decay * w[i]);
+	}
+}
+
+TEE_Result lora_train_step(struct lora_cache *cache,
+			   struct lora_cache_entry *entry,
+			   const struct lora_kernels *kern,
+			   const lora_train_step_t *step,
+			   const void *X, const void *G)
+{
+	struct lora_adapter *ad = &entry->adapter;
+	const size_t x_stride = (size_t)ad->desc.in_channels *
+				lora_dtype_size(step->input_dtype);
+	const size_t g_stride = (size_t)ad->desc.out_channels *
+				lora_dtype_size(step->grad_dtype);
+	// LORA_FMT_F32 keeps lora_A right after lora_B, so the weights are
+	// one vector in the order of the gradients.
+	float *w = (float *)(ad->weights + ad->layout.B);
+	struct lora_train_state *s;
+
+	s = get_state(cache, entry, step->flags & LORA_TRAIN_RESET);
+	if (!s)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	TEE_MemFill(s->grad, 0, s->params * sizeof(float));
+	for (uint32_t t = 0; t < step->tokens; t += LORA_TILE_TOKENS)
+	{
+		const uint32_t n = step->tokens - t < LORA_TILE_TOKENS ?
+				   step->tokens - t : LORA_TILE_TOKENS;
+
+		train_tile(ad, kern, s, (const uint8_t *)X + t * x_stride,
+			   step->input_dtype,
+			   (const uint8_t *)G + t * g_stride, step->grad_dtype,
+			   n);
+	}
+
+	if (step->optimizer == LORA_OPT_ADAM)
+		adam_update(s, w, step);
+	else
+		sgd_update(w, s->grad, s->params, step);
+
+	// A merged adapter runs from lora_A lora_B, so rebuild it. Running
+	// factored is always possible, so a failed merge only costs speed;
+	// renewing the entry charges it for whichever form it ends up in.
+	if (ad->merged && lora_adapter_merge(ad) != TEE_SUCCESS)
+		DMSG("Adapter %u runs factored after training", entry->id);
+
+	lora_cache_renew(cache, entry);
+	return TEE_SUCCESS;
+}
@@ -0,0 +1,53 @@
+/*
+ * On-device fine-tuning (TA_OPTEE_LLM_CMD_LORA_TRAIN): a fused forward and
+ * backward pass over a batch of tokens and an SGD or Adam step applied to
+ * a resident LORA_FMT_F32 adapter.
+ *
+ * Each adapter being trained has a state hung off its registry entry: the
+ * gradient accumulators, the Adam moments and the tile buffers of the
+ * pass, in one TA heap allocation charged to the registry budget with the
+ * adapter. The state belongs to one load of the adapter and is freed with
+ * the entry when the adapter is evicted, removed or reloaded.
+ */
+
+#ifndef LORA_TRAIN_H
+#define LORA_TRAIN_H
+
+#include <tee_internal_api.h>
+#include <optee_llm_ta.h>
+
+#include "lora_cache.h"
+#include "lora_kernels.h"
+
+// Columns of lora_B's gradient updated per block: a block of every row
+// stays in L1 while a tile's tokens are added into it.
+#define LORA_TRAIN_COLS		256
+
+struct lora_train_state {
+	uint32_t params;	// rank * in_channels + out_channels * rank
+	uint32_t steps;		// Adam steps taken
+	// [params] each, lora_B's entries first and then lora_A's, as the
+	// weights are laid out.
+	float *grad;
+	float *m;
+	float *v;
+	// Per tile: [LORA_TILE_TOKENS][rank] projections and their
+	// gradients, [LORA_TILE_TOKENS][out_channels] widened upstream
+	// gradients and [LORA_TILE_TOKENS][LORA_TRAIN_COLS] widened inputs.
+	float *h;
+	float *dh;
+	float *g;
+	float *x;
+};
+
+// Run one step on entry's adapter: X is [step->tokens][in_channels] and G
+// is [step->tokens][out_channels], both already checked against the
+// adapter's shape. Updates the weights, and the merged matrix if the
+// adapter has one, and gives the entry a new registry generation.
+TEE_Result lora_train_step(struct lora_cache *cache,
+			   struct lora_cache_entry *entry,
+			   const struct lora_kernels *kern,
+			   const lora_train_step_t *step,
+			   const void *X, const void *G);
+
+#endif /* LORA_TRAIN_H */
@@ -0,0 +1,324 @@
+/*
+ * Sealed adapter uploads.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "lora_upload.h"
+
+// Secure storage object holding the upload key.
+static const char lora_key_object[] = "lora_upload_key";
+
+// Contents of the key object.
+struct lora_stored_key {
+	uint32_t epoch;
+	uint8_t key[LORA_SEALED_KEY_SIZE];
+};
+
+// Read the stored upload key; TEE_ERROR_ITEM_NOT_FOUND if there is none.
+static TEE_Result read_key(struct lora_stored_key *sk)
+{
+	TEE_ObjectHandle obj;
+	TEE_Result res;
+	size_t count;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+				       lora_key_object,
+				       strlen(lora_key_object),
+				       TEE_DATA_FLAG_ACCESS_READ |
+				       TEE_DATA_FLAG_SHARE_READ, &obj);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_ReadObjectData(obj, sk, sizeof(*sk), &count);
+	if (res == TEE_SUCCESS && count != sizeof(*sk))
+		res = TEE_ERROR_CORRUPT_OBJECT;
+	TEE_CloseObject(obj);
+	return res;
+}
+
+static TEE_Result write_key(const struct lora_stored_key *sk)
+{
+	TEE_ObjectHandle obj;
+	TEE_Result res;
+
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					 lora_key_object,
+					 strlen(lora_key_object),
+					 TEE_DATA_FLAG_ACCESS_WRITE |
+					 TEE_DATA_FLAG_OVERWRITE,
+					 TEE_HANDLE_NULL, NULL, 0, &obj);
+	if (res != TEE_SUCCESS)
+	{
+		EMSG("Failed to create upload key, res=0x%08x", res);
+		return res;
+	}
+
+	res = TEE_WriteObjectData(obj, sk, sizeof(*sk));
+	if (res != TEE_SUCCESS)
+	{
+		EMSG("Failed to write upload key, res=0x%08x", res);
+		TEE_CloseAndDeletePersistentObject1(obj);
+		return res;
+	}
+	TEE_CloseObject(obj);
+	return TEE_SUCCESS;
+}
+
+#ifdef CFG_LORA_PROVISION_KEY
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// The provisioning key, given to the build as 64 hex digits.
+static TEE_Result provision_key(uint8_t key[LORA_SEALED_KEY_SIZE])
+{
+	static const char hex[] = CFG_LORA_PROVISION_KEY;
+
+	if (sizeof(hex) != LORA_SEALED_KEY_SIZE * 2 + 1)
+		return TEE_ERROR_NOT_SUPPORTED;
+	for (uint32_t i = 0; i < LORA_SEALED_KEY_SIZE; i++)
+	{
+		const int hi = hex_digit(hex[2 * i]);
+		const int lo = hex_digit(hex[2 * i + 1]);
+
+		if (hi < 0 || lo < 0)
+			return TEE_ERROR_NOT_SUPPORTED;
+		key[i] = hi << 4 | lo;
+	}
+	return TEE_SUCCESS;
+}
+#else
+// Built without a provisioning key: keys can only be rotated.
+static TEE_Result provision_key(uint8_t key[LORA_SEALED_KEY_SIZE])
+{
+	(void)key;
+	return TEE_ERROR_NOT_SUPPORTED;
+}
+#endif
+
+// Set up an AES-GCM decryption under key. The key only lives in the
+// transient object, which the operation copies.
+static TEE_Result open_operation(const uint8_t key[LORA_SEALED_KEY_SIZE],
+				 TEE_OperationHandle *op)
+{
+	TEE_ObjectHandle key_obj = TEE_HANDLE_NULL;
+	TEE_Attribute attr;
+	TEE_Result res;
+
+	res = TEE_AllocateOperation(op, TEE_ALG_AES_GCM, TEE_MODE_DECRYPT,
+				    LORA_SEALED_KEY_SIZE * 8);
+	if (res == TEE_SUCCESS)
+		res = TEE_AllocateTransientObject(TEE_TYPE_AES,
+						  LORA_SEALED_KEY_SIZE * 8,
+						  &key_obj);
+	if (res == TEE_SUCCESS)
+	{
+		TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key,
+				     LORA_SEALED_KEY_SIZE);
+		res = TEE_PopulateTransientObject(key_obj, &attr, 1);
+	}
+	if (res == TEE_SUCCESS)
+		res = TEE_SetOperationKey(*op, key_obj);
+
+	TEE_FreeTransientObject(key_obj);
+	if (res != TEE_SUCCESS && *op)
+	{
+		TEE_FreeOperation(*op);
+		*op = TEE_HANDLE_NULL;
+	}
+	return res;
+}
+
+// Decrypt the wrapped key under kek into next.
+static TEE_Result unwrap_key(const lora_key_wrap_t *wrap,
+			     const uint8_t kek[LORA_SEALED_KEY_SIZE],
+			     uint8_t next[LORA_SEALED_KEY_SIZE])
+{
+	TEE_OperationHandle op = TEE_HANDLE_NULL;
+	size_t out_len = LORA_SEALED_KEY_SIZE;
+	TEE_Result res;
+
+	res = open_operation(kek, &op);
+	if (res == TEE_SUCCESS)
+		res = TEE_AEInit(op, wrap->nonce, sizeof(wrap->nonce),
+				 LORA_SEALED_TAG_SIZE * 8,
+				 offsetof(lora_key_wrap_t, nonce),
+				 sizeof(wrap->key));
+	if (res == TEE_SUCCESS)
+	{
+		TEE_AEUpdateAAD(op, wrap, offsetof(lora_key_wrap_t, nonce));
+		res = TEE_AEDecryptFinal(op, wrap->key, sizeof(wrap->key),
+					 next, &out_len, (void *)wrap->tag,
+					 sizeof(wrap->tag));
+	}
+	if (res == TEE_SUCCESS && out_len != LORA_SEALED_KEY_SIZE)
+		res = TEE_ERROR_GENERIC;
+	if (op)
+		TEE_FreeOperation(op);
+	return res;
+}
+
+// Only whoever holds the provisioning key or the current upload key can
+// produce a wrapped key that unwraps, so the normal world can neither
+// learn the key nor substitute one of its own.
+TEE_Result lora_upload_set_key(const lora_key_wrap_t *wrap)
+{
+	struct lora_stored_key cur, next;
+	uint8_t kek[LORA_SEALED_KEY_SIZE];
+	TEE_Result res;
+
+	if (wrap->magic != LORA_KEY_WRAP_MAGIC || wrap->reserved ||
+	    !wrap->epoch)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = read_key(&cur);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND)
+		cur.epoch = 0;
+	else if (res != TEE_SUCCESS)
+		return res;
+
+	if (wrap->wrapping == LORA_KEY_WRAP_PROVISION)
+		res = provision_key(kek);
+	else if (wrap->wrapping != LORA_KEY_WRAP_CURRENT)
+		res = TEE_ERROR_BAD_PARAMETERS;
+	else if (res == TEE_SUCCESS)
+		TEE_MemMove(kek, cur.key, sizeof(kek));
+	if (res == TEE_SUCCESS && wrap->epoch <= cur.epoch)
+		res = TEE_ERROR_ACCESS_CONFLICT;
+	if (res == TEE_SUCCESS)
+		res = unwrap_key(wrap, kek, next.key);
+	if (res == TEE_SUCCESS)
+	{
+		next.epoch = wrap->epoch;
+		res = write_key(&next);
+	}
+	else
+	{
+		EMSG("Upload key rejected, res=0x%08x", res);
+	}
+
+	TEE_MemFill(kek, 0, sizeof(kek));
+	TEE_MemFill(&cur, 0, sizeof(cur));
+	TEE_MemFill(&next, 0, sizeof(next));
+	return res;
+}
+
+TEE_Result lora_upload_begin(struct lora_upload *up, uint32_t id,
+			     uint32_t flags, const lora_sealed_hdr_t *hdr)
+{
+	struct lora_stored_key sk;
+	TEE_Result res;
+
+	lora_upload_end(up);
+
+	if (hdr->magic != LORA_SEALED_MAGIC ||
+	    hdr->version != LORA_SEALED_VERSION || hdr->reserved ||
+	    hdr->chunk_size < LORA_SEALED_MIN_CHUNK ||
+	    hdr->chunk_size > LORA_SEALED_MAX_CHUNK)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = lora_adapter_alloc(&up->ad, &hdr->desc);
+	if (res == TEE_SUCCESS)
+	{
+		res = read_key(&sk);
+		if (res == TEE_ERROR_ITEM_NOT_FOUND)
+			EMSG("No upload key");
+	}
+	if (res == TEE_SUCCESS)
+		res = open_operation(sk.key, &up->op);
+	TEE_MemFill(&sk, 0, sizeof(sk));
+	if (res != TEE_SUCCESS)
+	{
+		lora_upload_end(up);
+		return res;
+	}
+
+	up->active = true;
+	up->flags = flags;
+	up->next = 0;
+	up->aad.hdr = *hdr;
+	up->aad.adapter_id = id;
+	up->aad.chunks = (up->ad.layout.size + hdr->chunk_size - 1) /
+			 hdr->chunk_size;
+	return TEE_SUCCESS;
+}
+
+TEE_Result lora_upload_chunk(struct lora_upload *up, uint32_t index,
+			     const void *data, uint32_t size, bool *done)
+{
+	const uint32_t offset = index * up->aad.hdr.chunk_size;
+	uint8_t nonce[LORA_SEALED_NONCE_SIZE];
+	uint32_t len;
+	size_t out_len;
+	TEE_Result res;
+
+	*done = false;
+	if (!up->active)
+		return TEE_ERROR_BAD_STATE;
+	if (index != up->next)
+	{
+		lora_upload_end(up);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	len = up->ad.layout.size - offset;
+	if (len > up->aad.hdr.chunk_size)
+		len = up->aad.hdr.chunk_size;
+	if (size != len + LORA_SEALED_TAG_SIZE)
+	{
+		lora_upload_end(up);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	memcpy(nonce, up->aad.hdr.nonce, sizeof(up->aad.hdr.nonce));
+	nonce[8] = index >> 24;
+	nonce[9] = index >> 16;
+	nonce[10] = index >> 8;
+	nonce[11] = index;
+
+	// Decrypt straight into place: the sealed plaintext is already the
+	// serialized layout the kernels read.
+	out_len = len;
+	res = TEE_AEInit(up->op, nonce, sizeof(nonce),
+			 LORA_SEALED_TAG_SIZE * 8, sizeof(up->aad), len);
+	if (res == TEE_SUCCESS)
+	{
+		TEE_AEUpdateAAD(up->op, &up->aad, sizeof(up->aad));
+		res = TEE_AEDecryptFinal(up->op, data, len,
+					 up->ad.weights + offset, &out_len,
+					 (uint8_t *)data + len,
+					 LORA_SEALED_TAG_SIZE);
+	}
+	if (res == TEE_SUCCESS && out_len != len)
+		res = TEE_ERROR_GENERIC;
+	if (res != TEE_SUCCESS)
+	{
+		EMSG("Chunk %u of adapter %u failed, res=0x%08x",
+		     index, up->aad.adapter_id, res);
+		lora_upload_end(up);
+		return res;
+	}
+
+	*done = ++up->next == up->aad.chunks;
+	return TEE_SUCCESS;
+}
+
+void lora_upload_end(struct lora_upload *up)
+{
+	if (up->op)
+		TEE_FreeOperation(up->op);
+	up->op = TEE_HANDLE_NULL;
+	lora_adapter_free(&up->ad);
+	up->active = false;
+}
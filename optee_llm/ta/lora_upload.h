@@ -0,0 +1,42 @@
+/*
+ * Sealed adapter uploads (TA_OPTEE_LLM_CMD_LORA_UPLOAD_*): the upload key
+ * in secure storage and the per-session state of an upload in progress.
+ */
+
+#ifndef LORA_UPLOAD_H
+#define LORA_UPLOAD_H
+
+#include <stdbool.h>
+#include <tee_internal_api.h>
+#include <optee_llm_ta.h>
+
+#include "lora_adapter.h"
+
+struct lora_upload {
+	bool active;
+	uint32_t flags;		// LORA_LOAD_*
+	// Header, adapter ID and chunk count: the AAD of every chunk.
+	lora_sealed_aad_t aad;
+	// Weights being decrypted into, sized from aad.hdr.desc at begin.
+	struct lora_adapter ad;
+	uint32_t next;		// index of the chunk expected next
+	TEE_OperationHandle op;	// AES-GCM decryption under the upload key
+};
+
+// Unwrap a new upload key (see lora_key_wrap_t) and store it in place of
+// the current one.
+TEE_Result lora_upload_set_key(const lora_key_wrap_t *wrap);
+
+// Start an upload of the adapter described by hdr, discarding any upload
+// in progress.
+TEE_Result lora_upload_begin(struct lora_upload *up, uint32_t id,
+			     uint32_t flags, const lora_sealed_hdr_t *hdr);
+// Decrypt and verify the sealed chunk with the given index into the
+// adapter's weights. Any failure ends the upload. *done is set when this
+// was the last chunk; up->ad then holds the complete, verified adapter.
+TEE_Result lora_upload_chunk(struct lora_upload *up, uint32_t index,
+			     const void *data, uint32_t size, bool *done);
+// End the upload and release everything it holds.
+void lora_upload_end(struct lora_upload *up);
+
+#endif /* LORA_UPLOAD_H */
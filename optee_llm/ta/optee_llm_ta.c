@@ -25,170 +25,1648 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <float.h>
 #include <tee_internal_api.h>
 #include <tee_internal_api_extensions.h>
 #include <optee_llm_ta.h> // CHANGED TA FILE HEADER
 
-// Populate these with random data, eventually the right weights
-float lora_B[RANK][IN_CHANNELS];
-float lora_A[OUT_CHANNELS][RANK];
-
-// Helper function to initialize the random data
-static void populate_random_data(void)
-{
-    TEE_GenerateRandom(lora_B, sizeof(lora_B));
-    TEE_GenerateRandom(lora_A, sizeof(lora_A));
-    
-    // Scale the random values into the [0, 1) float range without math.h.
-    // Cast each float value to an int, apply modulo, then convert to float.
-    for (int r = 0; r < RANK; r++) {
-        for (int c = 0; c < IN_CHANNELS; c++) {
-            int temp = ((int)lora_B[r][c]) % 100;
-            if (temp < 0)
-                temp += 100;
-            lora_B[r][c] = temp / 100.0f;
-        }
-    }
-    for (int o = 0; o < OUT_CHANNELS; o++) {
-        for (int r = 0; r < RANK; r++) {
-            int temp = ((int)lora_A[o][r]) % 100;
-            if (temp < 0)
-                temp += 100;
-            lora_A[o][r] = temp / 100.0f;
-        }
-    }
-}
-
-// Forward pass functions as defined earlier.
-static void matmul_B(const float x[IN_CHANNELS],
-	      const float B[RANK][IN_CHANNELS],
-	      float intermediate[RANK])
-{
-	for (int r = 0; r < RANK; r++)
-	{
-		float sum = 0.0f;
-		for (int c = 0; c < IN_CHANNELS; c++)
+#include "lora_adapter.h"
+#include "lora_cache.h"
+#include "lora_kernels.h"
+#include "lora_prefix.h"
+#include "lora_stats.h"
+#include "lora_train.h"
+#include "lora_upload.h"
+
+// Kernel variant (NEON, AVX2 or scalar) chosen in TA_CreateEntryPoint().
+static const struct lora_kernels *kern;
+
+// Phase times of the TA_OPTEE_LLM_CMD_LORA request being served, or NULL
+// when it is not timed.
+static lora_timing_t *req_timing;
+
+// Request flags this TA implements. Any other bit is rejected, so that a
+// flag added later is never served as if it were clear.
+#define LORA_FLAGS_KNOWN \
+	(LORA_FLAG_REFERENCE | LORA_FLAG_RAGGED | LORA_FLAG_PREFIX)
+
+// An unfinished streamed request (TA_OPTEE_LLM_CMD_LORA_STREAM_*). The
+// pooled mean sums the input tokens and projects at finalize; the
+// reference mean sums the per-token outputs, and LORA_OUT_LAST and
+// LORA_OUT_MAX keep the last or the running max output.
+struct lora_stream {
+	bool active;
+	uint32_t adapter_id;
+	uint32_t batch_size;
+	uint32_t flags;
+	uint32_t output_mode;
+	uint32_t input_dtype;
+	uint32_t output_dtype;
+	// Registry generation of the adapter at BEGIN. A stream only ever
+	// sees one set of weights: if the adapter is reloaded, replaced,
+	// trained or evicted before FINALIZE, the stream fails.
+	uint64_t generation;
+	uint64_t tokens;
+	// [batch_size][in_channels] input sums (pooled mean) or
+	// [batch_size][out_channels] per-sample outputs (all other modes)
+	float *acc;
+};
+
+// The pooled mean is the only streamed mode that accumulates in input space.
+static bool stream_pools_input(const struct lora_stream *stream)
+{
+	return stream->output_mode == LORA_OUT_MEAN &&
+	       !(stream->flags & LORA_FLAG_REFERENCE);
+}
+
+// Per-session state, allocated in TA_OpenSessionEntryPoint() and handed back
+// by the framework as sess_ctx on every invocation. Adapters are set up by
+// TA_OPTEE_LLM_CMD_LORA_LOAD into the session's registry and only read by
+// inference.
+struct lora_session {
+	struct lora_cache cache;
+	struct lora_prefix_cache prefixes;
+	struct lora_stream stream;
+	struct lora_upload upload;
+	// TA copy of the token offsets of the ragged request being served,
+	// room for offsets_cap of them.
+	uint32_t *offsets;
+	uint32_t offsets_cap;
+};
+
+// Set up an adapter's weights and add it to the registry. This is the only
+// place weights are written, so the per-request path never pays for it.
+static TEE_Result load_lora_weights(struct lora_session *sess,
+				    uint32_t param_types, TEE_Param params[4])
+{
+	// Expected parameter types:
+	// Param0: VALUE a = weight source, b = load flags
+	// Param1: Serialized adapter MEMREF (LORA_WEIGHTS_MEMREF only) or NONE
+	// Param2: lora_adapter_desc_t MEMREF, or NONE for the default
+	//         LORA_FMT_F32 shape
+	// Param3: VALUE a = adapter ID, or NONE for adapter 0
+	lora_adapter_desc_t desc = {
+		.format = LORA_FMT_F32,
+		.in_channels = IN_CHANNELS,
+		.out_channels = OUT_CHANNELS,
+		.rank = RANK,
+		.max_batch_size = MAX_BATCH_SIZE,
+		.max_seq_length = MAX_SEQ_LENGTH,
+	};
+	struct lora_adapter ad = { .mem = NULL };
+	struct lora_cache_entry *entry;
+	const uint32_t t1 = TEE_PARAM_TYPE_GET(param_types, 1);
+	const uint32_t t2 = TEE_PARAM_TYPE_GET(param_types, 2);
+	const uint32_t t3 = TEE_PARAM_TYPE_GET(param_types, 3);
+	uint32_t id = 0;
+	TEE_Result res;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT ||
+	    (t1 != TEE_PARAM_TYPE_NONE && t1 != TEE_PARAM_TYPE_MEMREF_INPUT) ||
+	    (t2 != TEE_PARAM_TYPE_NONE && t2 != TEE_PARAM_TYPE_MEMREF_INPUT) ||
+	    (t3 != TEE_PARAM_TYPE_NONE && t3 != TEE_PARAM_TYPE_VALUE_INPUT))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (t2 == TEE_PARAM_TYPE_MEMREF_INPUT)
+	{
+		if (params[2].memref.size != sizeof(desc))
+			return TEE_ERROR_BAD_PARAMETERS;
+		TEE_MemMove(&desc, params[2].memref.buffer, sizeof(desc));
+	}
+	if (t3 == TEE_PARAM_TYPE_VALUE_INPUT)
+		id = params[3].value.a;
+
+	// A failed load leaves no adapter behind rather than a partial one,
+	// and the old adapter's memory is released before the new one is
+	// allocated.
+	lora_cache_remove(&sess->cache, id);
+
+	switch (params[0].value.a)
+	{
+	case LORA_WEIGHTS_RANDOM:
+		res = lora_adapter_alloc(&ad, &desc);
+		if (res != TEE_SUCCESS)
+			return res;
+		lora_adapter_randomize(&ad);
+		break;
+	case LORA_WEIGHTS_MEMREF:
+		if (t1 != TEE_PARAM_TYPE_MEMREF_INPUT)
+			return TEE_ERROR_BAD_PARAMETERS;
+		res = lora_adapter_alloc(&ad, &desc);
+		if (res != TEE_SUCCESS)
+			return res;
+		if (params[1].memref.size != ad.layout.size)
+		{
+			lora_adapter_free(&ad);
+			return TEE_ERROR_BAD_PARAMETERS;
+		}
+		TEE_MemMove(ad.weights, params[1].memref.buffer,
+			    ad.layout.size);
+		break;
+	case LORA_WEIGHTS_STORAGE:
+		res = lora_adapter_load_storage(&ad, id);
+		if (res != TEE_SUCCESS)
+		{
+			lora_adapter_free(&ad);
+			return res;
+		}
+		break;
+	default:
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (params[0].value.b & LORA_LOAD_PERSIST)
+	{
+		res = lora_adapter_persist(&ad, id);
+		if (res != TEE_SUCCESS)
 		{
-			sum += x[c] * B[r][c];
+			lora_adapter_free(&ad);
+			return res;
 		}
-		intermediate[r] = sum;
 	}
+
+	return lora_cache_insert(&sess->cache, id, &ad, &entry);
+}
+
+static TEE_Result get_cache_stats(struct lora_session *sess,
+				  uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+	lora_cache_stats_t stats;
+
+	if (param_types != expected_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (params[0].memref.size < sizeof(stats))
+	{
+		params[0].memref.size = sizeof(stats);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	lora_cache_get_stats(&sess->cache, &stats);
+	TEE_MemMove(params[0].memref.buffer, &stats, sizeof(stats));
+	params[0].memref.size = sizeof(stats);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result set_cache_budget(struct lora_session *sess,
+				   uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+
+	if (param_types != expected_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	lora_cache_set_budget(&sess->cache, params[0].value.a);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result get_prefix_stats(struct lora_session *sess,
+				   uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+	lora_prefix_stats_t stats;
+
+	if (param_types != expected_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (params[0].memref.size < sizeof(stats))
+	{
+		params[0].memref.size = sizeof(stats);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	lora_prefix_get_stats(&sess->prefixes, &stats);
+	TEE_MemMove(params[0].memref.buffer, &stats, sizeof(stats));
+	params[0].memref.size = sizeof(stats);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result set_prefix_budget(struct lora_session *sess,
+				    uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+
+	if (param_types != expected_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	lora_prefix_set_budget(&sess->prefixes, params[0].value.a);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result set_upload_key(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+	lora_key_wrap_t wrap;
+
+	if (param_types != expected_types ||
+	    params[0].memref.size != sizeof(wrap))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	// Checked and unwrapped from a TA copy.
+	TEE_MemMove(&wrap, params[0].memref.buffer, sizeof(wrap));
+	return lora_upload_set_key(&wrap);
+}
+
+static TEE_Result begin_upload(struct lora_session *sess,
+			       uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+			    TEE_PARAM_TYPE_MEMREF_INPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+	lora_sealed_hdr_t hdr;
+
+	if (param_types != expected_types ||
+	    params[1].memref.size != sizeof(hdr))
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(&hdr, params[1].memref.buffer, sizeof(hdr));
+
+	// Unlike TA_OPTEE_LLM_CMD_LORA_LOAD, any adapter resident under the ID
+	// stays until the last chunk verifies: nothing unverified may
+	// displace it, at the cost of holding both while the upload runs.
+	return lora_upload_begin(&sess->upload, params[0].value.a,
+				 params[0].value.b, &hdr);
+}
+
+static TEE_Result upload_chunk(struct lora_session *sess,
+			       uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+			    TEE_PARAM_TYPE_VALUE_INPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+	struct lora_upload *up = &sess->upload;
+	struct lora_cache_entry *entry;
+	TEE_Result res;
+	bool done;
+
+	if (param_types != expected_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = lora_upload_chunk(up, params[1].value.a,
+				params[0].memref.buffer,
+				params[0].memref.size, &done);
+	if (res != TEE_SUCCESS || !done)
+		return res;
+
+	// Every chunk has verified: the new adapter replaces the old one in
+	// storage and in the registry.
+	if (up->flags & LORA_LOAD_PERSIST)
+		res = lora_adapter_persist(&up->ad, up->aad.adapter_id);
+	if (res == TEE_SUCCESS)
+		res = lora_cache_insert(&sess->cache, up->aad.adapter_id,
+					&up->ad, &entry);
+	lora_upload_end(up);
+	return res;
+}
+
+// Address of token t of a [tokens][in_channels] tensor of the given dtype.
+static const void *input_token(const void *input, uint32_t dtype,
+			       uint32_t in_channels, size_t t)
+{
+	return (const uint8_t *)input + t * in_channels * lora_dtype_size(dtype);
+}
+
+// Store n output values at element idx of an output tensor of the given
+// dtype, rounding them for the half precision dtypes.
+static void store_output(void *output, uint32_t dtype, size_t idx,
+			 const float *v, uint32_t n)
+{
+	if (dtype == LORA_DTYPE_F32)
+		TEE_MemMove((float *)output + idx, v, n * sizeof(float));
+	else
+		kern->narrow_half((uint16_t *)output + idx, v, dtype, n);
+}
+
+// Multiply n values by the scale of a multi-adapter table entry
+// (lora_multi_entry_t.scale). Every other request runs at scale 1, which
+// is skipped; otherwise the pass is timed as LORA_PHASE_SCALE.
+static void apply_scale(float *v, uint32_t n, float scale)
+{
+	uint64_t t;
+
+	if (scale == 1.0f)
+		return;
+	t = lora_phase_start(req_timing);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		v[i] *= scale;
+	}
+	lora_phase_end(req_timing, LORA_PHASE_SCALE, t);
+}
+
+// Merged form of the forward pass: one projection by the pre-multiplied
+// lora_A lora_B of n <= LORA_TILE_TOKENS tokens of x into [n][out_channels]
+// rows at output, scaled in output space (merged adapters have few
+// outputs). Timed as LORA_PHASE_MATMUL_B.
+static void lora_forward_merged(const void *x, uint32_t dtype, uint32_t n,
+				const struct lora_adapter *ad, float scale,
+				float *output)
+{
+	const uint64_t t = lora_phase_start(req_timing);
+
+	lora_adapter_matmul_merged(ad, kern, x, dtype, n, output);
+	lora_phase_end(req_timing, LORA_PHASE_MATMUL_B, t);
+	apply_scale(output, n * ad->desc.out_channels, scale);
+}
+
+// Forward pass functions as defined earlier. matmul_B/matmul_A come from
+// the selected kernel variant and the adapter's weight format; all shapes
+// come from the adapter descriptor. x holds in_channels elements of dtype
+// and output receives out_channels floats, written exactly once: the scale
+// is applied in rank space, before lora_A, rather than in a pass over the
+// output. widen is in_channels floats of scratch for half precision x.
+static void lora_forward_token(const void *x, uint32_t dtype,
+			const struct lora_adapter *ad,
+			float scale,
+			float *widen,
+			float *output)
+{
+	float intermediate[LORA_MAX_RANK];
+	uint64_t t;
+
+	if (ad->merged)
+	{
+		lora_forward_merged(x, dtype, 1, ad, scale, output);
+		return;
+	}
+
+	t = lora_phase_start(req_timing);
+	if (dtype == LORA_DTYPE_F32)
+		lora_adapter_matmul_B(ad, kern, x, intermediate);
+	else
+		lora_adapter_matmul_B_half(ad, kern, x, dtype, widen,
+					   intermediate);
+	lora_phase_end(req_timing, LORA_PHASE_MATMUL_B, t);
+	apply_scale(intermediate, ad->desc.rank, scale);
+	t = lora_phase_start(req_timing);
+	lora_adapter_matmul_A(ad, kern, intermediate, output);
+	lora_phase_end(req_timing, LORA_PHASE_MATMUL_A, t);
+}
+
+// The tile area of a cache entry's scratch, after the mean and the two
+// output vectors: a tile's [n][rank] lora_B projections, or for a merged
+// adapter its [n][out_channels] outputs.
+static float *tile_scratch(const struct lora_adapter *ad, float *scratch)
+{
+	return scratch + ad->desc.in_channels + 2 * ad->desc.out_channels;
+}
+
+static uint32_t tile_tokens(uint32_t remaining)
+{
+	return remaining < LORA_TILE_TOKENS ? remaining : LORA_TILE_TOKENS;
 }
 
-static void matmul_A(const float intermediate[RANK],
-	      const float A[OUT_CHANNELS][RANK],
-	      float output[OUT_CHANNELS])
+// lora_B projections of n <= LORA_TILE_TOKENS consecutive tokens of x in one
+// pass over the weights, scaled in rank space: tile is [n][rank].
+static void lora_project_tile(const void *x, uint32_t dtype, uint32_t n,
+			      const struct lora_adapter *ad, float scale,
+			      float *widen, float *tile)
 {
-	for (int out = 0; out < OUT_CHANNELS; out++)
+	const uint64_t t = lora_phase_start(req_timing);
+
+	lora_adapter_matmul_B_tile(ad, kern, x, dtype, n, widen, tile);
+	lora_phase_end(req_timing, LORA_PHASE_MATMUL_B, t);
+	apply_scale(tile, n * ad->desc.rank, scale);
+}
+
+// Write n deltas v to output at element idx, or with add, add them to the
+// values there; v is clobbered in the half precision case.
+static void emit_row(void *output, uint32_t out_dtype, size_t idx, float *v,
+		     uint32_t n, bool add)
+{
+	if (add && out_dtype == LORA_DTYPE_F32)
 	{
-		float sum = 0.0f;
-		for (int r = 0; r < RANK; r++)
+		kern->accumulate((float *)output + idx, v, n);
+		return;
+	}
+	if (add)
+		kern->accumulate_half(v, (const uint16_t *)output + idx,
+				      out_dtype, n);
+	store_output(output, out_dtype, idx, v, n);
+}
+
+// Per-token deltas of tokens consecutive tokens of x, a tile at a time,
+// into [tokens][out_channels] rows of out_dtype at output; with add, onto
+// the rows already there. fp32 rows are written by matmul_A_tile directly,
+// the others are staged and rounded. scratch is the cache entry's scratch.
+static void lora_forward_rows(const void *x, uint32_t dtype, uint32_t tokens,
+			      const struct lora_adapter *ad, float scale,
+			      float *scratch, void *output, uint32_t out_dtype,
+			      bool add)
+{
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t rank = ad->desc.rank;
+	float *widen = scratch;
+	float *token_output = widen + in;
+	float *tile = tile_scratch(ad, scratch);
+
+	const bool direct = !add && out_dtype == LORA_DTYPE_F32;
+
+	for (uint32_t t0 = 0; t0 < tokens; t0 += LORA_TILE_TOKENS)
+	{
+		const uint32_t n = tile_tokens(tokens - t0);
+		const void *xt = input_token(x, dtype, in, t0);
+		float *rows = direct ? (float *)output + (size_t)t0 * out : NULL;
+		uint64_t t;
+
+		if (ad->merged)
+		{
+			lora_forward_merged(xt, dtype, n, ad, scale,
+					    direct ? rows : tile);
+			if (direct)
+				continue;
+			t = lora_phase_start(req_timing);
+			for (uint32_t i = 0; i < n; i++)
+			{
+				emit_row(output, out_dtype,
+					 (size_t)(t0 + i) * out,
+					 tile + i * out, out, add);
+			}
+			lora_phase_end(req_timing, LORA_PHASE_OUTPUT, t);
+			continue;
+		}
+
+		lora_project_tile(xt, dtype, n, ad, scale, widen, tile);
+		t = lora_phase_start(req_timing);
+		if (direct)
+		{
+			lora_adapter_matmul_A_tile(ad, kern, tile, n, rows);
+			lora_phase_end(req_timing, LORA_PHASE_MATMUL_A, t);
+			continue;
+		}
+		for (uint32_t i = 0; i < n; i++)
 		{
-			sum += intermediate[r] * A[out][r];
+			lora_adapter_matmul_A(ad, kern, tile + i * rank,
+					      token_output);
+			t = lora_phase_end(req_timing, LORA_PHASE_MATMUL_A, t);
+			emit_row(output, out_dtype, (size_t)(t0 + i) * out,
+				 token_output, out, add);
+			t = lora_phase_end(req_timing, LORA_PHASE_OUTPUT, t);
 		}
-		output[out] = sum;
 	}
 }
 
-static void lora_forward_token(const float x[IN_CHANNELS],
-			const float B[RANK][IN_CHANNELS],
-			const float A[OUT_CHANNELS][RANK],
-			float scale,
-			float output[OUT_CHANNELS])
+// Fold the per-token outputs of seq_length tokens of x into acc, a tile at
+// a time: the element-wise max with max, otherwise the sum. With seed the
+// first token's output initializes acc. scratch is the cache entry's
+// scratch; acc may be its per-sample output vector.
+static void lora_fold_tokens(const void *x, uint32_t dtype,
+			     uint32_t seq_length,
+			     const struct lora_adapter *ad, float scale,
+			     float *scratch, bool max, bool seed, float *acc)
 {
-	float intermediate[RANK];
-	matmul_B(x, B, intermediate);
-	matmul_A(intermediate, A, output);
-	for (int i = 0; i < OUT_CHANNELS; i++)
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t rank = ad->desc.rank;
+	float *widen = scratch;
+	float *token_output = widen + in;
+	float *tile = tile_scratch(ad, scratch);
+
+	for (uint32_t t0 = 0; t0 < seq_length; t0 += LORA_TILE_TOKENS)
 	{
-		output[i] *= scale;
+		const uint32_t n = tile_tokens(seq_length - t0);
+		const void *xt = input_token(x, dtype, in, t0);
+		uint64_t t;
+
+		// A merged tile already holds the n per-token outputs.
+		if (ad->merged)
+			lora_forward_merged(xt, dtype, n, ad, scale, tile);
+		else
+			lora_project_tile(xt, dtype, n, ad, scale, widen, tile);
+		t = lora_phase_start(req_timing);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			const float *y = tile + i * out;
+
+			if (seed && t0 + i == 0)
+			{
+				if (ad->merged)
+					TEE_MemMove(acc, y, out * sizeof(float));
+				else
+					lora_adapter_matmul_A(ad, kern, tile, acc);
+				continue;
+			}
+			if (!ad->merged)
+			{
+				lora_adapter_matmul_A(ad, kern, tile + i * rank,
+						      token_output);
+				y = token_output;
+			}
+			if (!max)
+			{
+				kern->accumulate(acc, y, out);
+				continue;
+			}
+			for (uint32_t o = 0; o < out; o++)
+			{
+				if (y[o] > acc[o])
+					acc[o] = y[o];
+			}
+		}
+		lora_phase_end(req_timing, LORA_PHASE_MATMUL_A, t);
 	}
 }
 
-// Runs LoRA inference for a single sample with a variable sequence length.
-static void lora_forward_sample(const float *input_sample,
+// Reference mean for a single sample: project every token, then average.
+static void lora_forward_sample(const void *input_sample,
+				uint32_t dtype,
 				uint32_t seq_length,
-				const float B[RANK][IN_CHANNELS],
-				const float A[OUT_CHANNELS][RANK],
+				const struct lora_adapter *ad,
 				float scale,
-				float output_sample[OUT_CHANNELS])
+				float *scratch,
+				float *output_sample)
+{
+	const uint32_t out = ad->desc.out_channels;
+
+	lora_fold_tokens(input_sample, dtype, seq_length, ad, scale, scratch,
+			 false, true, output_sample);
+	// Compute the average over the sequence tokens.
+	for (uint32_t i = 0; i < out; i++)
+	{
+		output_sample[i] /= seq_length;
+	}
+}
+
+// sum[in_channels] = the sum of n tokens of x.
+static void sum_tokens(const void *x, uint32_t dtype, uint32_t n,
+		       uint32_t in_channels, float *sum)
+{
+	TEE_MemFill(sum, 0, in_channels * sizeof(float));
+	for (uint32_t token = 0; token < n; token++)
+	{
+		const void *xt = input_token(x, dtype, in_channels, token);
+
+		if (dtype == LORA_DTYPE_F32)
+			kern->accumulate(sum, xt, in_channels);
+		else
+			kern->accumulate_half(sum, xt, dtype, in_channels);
+	}
+}
+
+// Pooled fast path for a single sample. The LoRA branch is linear, so the
+// mean of the per-token projections equals the projection of the mean token:
+// reduce the sequence to one vector in a single streaming pass over the
+// input, then run matmul_B/matmul_A once instead of once per token.
+// mean is in_channels floats of scratch space.
+static void lora_forward_sample_pooled(const void *input_sample,
+				       uint32_t dtype,
+				       uint32_t seq_length,
+				       const struct lora_adapter *ad,
+				       float scale,
+				       float *mean,
+				       float *output_sample)
+{
+	const uint32_t in = ad->desc.in_channels;
+	const float inv_len = 1.0f / seq_length;
+	const uint64_t t = lora_phase_start(req_timing);
+
+	sum_tokens(input_sample, dtype, seq_length, in, mean);
+	for (uint32_t c = 0; c < in; c++)
+	{
+		mean[c] *= inv_len;
+	}
+	lora_phase_end(req_timing, LORA_PHASE_REDUCE, t);
+	lora_forward_token(mean, LORA_DTYPE_F32, ad, scale, NULL,
+			   output_sample);
+}
+
+// Floats per token projection: rank, or out_channels for a merged adapter,
+// whose projection is already its output.
+static uint32_t proj_width(const struct lora_adapter *ad)
+{
+	return ad->merged ? ad->desc.out_channels : ad->desc.rank;
+}
+
+// Unscaled projections of n <= LORA_TILE_TOKENS tokens of x into
+// [n][proj_width()] at proj.
+static void lora_project(const void *x, uint32_t dtype, uint32_t n,
+			 const struct lora_adapter *ad, float *widen,
+			 float *proj)
+{
+	if (ad->merged)
+		lora_forward_merged(x, dtype, n, ad, 1.0f, proj);
+	else
+		lora_project_tile(x, dtype, n, ad, 1.0f, widen, proj);
+}
+
+// output[out_channels] for the projection v: lora_A v, or v itself for a
+// merged adapter.
+static void lora_project_out(const struct lora_adapter *ad, const float *v,
+			     float *output)
 {
-	// Temporary buffer for token-level output.
-	float token_output[OUT_CHANNELS];
-	// Initialize the sample output.
-	for (int i = 0; i < OUT_CHANNELS; i++)
+	const uint64_t t = lora_phase_start(req_timing);
+
+	if (ad->merged)
+		TEE_MemMove(output, v, ad->desc.out_channels * sizeof(float));
+	else
+		lora_adapter_matmul_A(ad, kern, v, output);
+	lora_phase_end(req_timing, LORA_PHASE_MATMUL_A, t);
+}
+
+// Compute the state of the prefix pe from its tokens, the first ones of x.
+static void lora_prefix_fill(const void *x, uint32_t dtype,
+			     const struct lora_adapter *ad, float *scratch,
+			     struct lora_prefix_entry *pe)
+{
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t w = pe->width;
+	const uint32_t n = pe->key.tokens;
+	float *widen = scratch;
+	float *token_output = widen + in;
+
+	for (uint32_t t0 = 0; t0 < n; t0 += LORA_TILE_TOKENS)
 	{
-		output_sample[i] = 0.0f;
+		lora_project(input_token(x, dtype, in, t0), dtype,
+			     tile_tokens(n - t0), ad, widen,
+			     pe->rows + (size_t)t0 * w);
 	}
-	// Process each token.
-	for (uint32_t token = 0; token < seq_length; token++)
+	for (uint32_t t = 0; t < n; t++)
 	{
-		// Calculate pointer offset for this token.
-		const float *x = input_sample + token * IN_CHANNELS;
-		lora_forward_token(x, B, A, scale, token_output);
-		for (int i = 0; i < OUT_CHANNELS; i++)
+		const float *row = pe->rows + (size_t)t * w;
+
+		kern->accumulate(pe->sum, row, w);
+		lora_project_out(ad, row, token_output);
+		for (uint32_t o = 0; o < out; o++)
 		{
-			output_sample[i] += token_output[i];
+			if (!t || token_output[o] > pe->max[o])
+				pe->max[o] = token_output[o];
 		}
 	}
-	// Compute the average over the sequence tokens.
-	for (int i = 0; i < OUT_CHANNELS; i++)
+	TEE_MemMove(pe->last, pe->rows + (size_t)(n - 1) * w,
+		    w * sizeof(float));
+}
+
+// The prefix's per-token outputs as rows of out_dtype at output.
+// token_output is out_channels floats of scratch.
+static void lora_prefix_rows(const struct lora_adapter *ad,
+			     const struct lora_prefix_entry *pe, void *output,
+			     uint32_t out_dtype, float *token_output)
+{
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t w = pe->width;
+	const uint32_t n = pe->key.tokens;
+	const uint64_t t = lora_phase_start(req_timing);
+
+	if (ad->merged)
 	{
-		output_sample[i] /= seq_length;
+		store_output(output, out_dtype, 0, pe->rows, (size_t)n * out);
+		lora_phase_end(req_timing, LORA_PHASE_OUTPUT, t);
+		return;
 	}
+	for (uint32_t t0 = 0; t0 < n; t0 += LORA_TILE_TOKENS)
+	{
+		const uint32_t cnt = tile_tokens(n - t0);
+		const float *rows = pe->rows + (size_t)t0 * w;
+
+		if (out_dtype == LORA_DTYPE_F32)
+		{
+			lora_adapter_matmul_A_tile(ad, kern, rows, cnt,
+						   (float *)output +
+						   (size_t)t0 * out);
+			continue;
+		}
+		for (uint32_t i = 0; i < cnt; i++)
+		{
+			lora_adapter_matmul_A(ad, kern, rows + i * w,
+					      token_output);
+			store_output(output, out_dtype, (size_t)(t0 + i) * out,
+				     token_output, out);
+		}
+	}
+	lora_phase_end(req_timing, LORA_PHASE_MATMUL_A, t);
 }
 
+// Forward pass of a sample whose first tokens are the prefix pe: only the
+// suffix is projected and combined with the prefix state. LORA_OUT_TOKENS
+// rows of out_dtype go to output; the other modes leave the sample's
+// result in sample_output. Prefixed requests are unscaled.
+static void lora_forward_prefixed(const void *x, uint32_t dtype,
+				  uint32_t seq_length,
+				  const struct lora_adapter *ad,
+				  const struct lora_prefix_entry *pe,
+				  const tensor_dims_t *dims, float *scratch,
+				  void *output, float *sample_output)
+{
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t w = pe->width;
+	const uint32_t n = pe->key.tokens;
+	const uint32_t rest = seq_length - n;
+	const uint32_t out_dtype = dims->output_dtype;
+	const void *suffix = input_token(x, dtype, in, n);
+	float *mean = scratch;
+	float *token_output = mean + in;
+	float *tile = tile_scratch(ad, scratch);
+	// A merged adapter's projections are out_channels wide and sum
+	// straight into sample_output.
+	float rank_acc[LORA_MAX_RANK];
+	float *acc = ad->merged ? sample_output : rank_acc;
+	uint64_t t;
 
-// Main inference function
-static TEE_Result run_lora_inference(uint32_t param_types, TEE_Param params[4])
+	switch (dims->output_mode)
+	{
+	case LORA_OUT_TOKENS:
+		lora_prefix_rows(ad, pe, output, out_dtype, token_output);
+		if (rest)
+			lora_forward_rows(suffix, dtype, rest, ad, 1.0f, scratch,
+					  (uint8_t *)output + (size_t)n * out *
+					  lora_dtype_size(out_dtype),
+					  out_dtype, false);
+		break;
+	case LORA_OUT_LAST:
+		if (rest)
+			lora_forward_token(input_token(suffix, dtype, in, rest - 1),
+					   dtype, ad, 1.0f, mean, sample_output);
+		else
+			lora_project_out(ad, pe->last, sample_output);
+		break;
+	case LORA_OUT_MAX:
+		TEE_MemMove(sample_output, pe->max, out * sizeof(float));
+		if (rest)
+			lora_fold_tokens(suffix, dtype, rest, ad, 1.0f, scratch,
+					 true, false, sample_output);
+		break;
+	default:
+		// The mean's numerator is the prefix sum plus the suffix
+		// projections, pooled in input space unless the reference
+		// path is asked for.
+		TEE_MemMove(acc, pe->sum, w * sizeof(float));
+		if (rest && dims->flags & LORA_FLAG_REFERENCE)
+		{
+			for (uint32_t t0 = 0; t0 < rest; t0 += LORA_TILE_TOKENS)
+			{
+				const uint32_t cnt = tile_tokens(rest - t0);
+
+				lora_project(input_token(suffix, dtype, in, t0),
+					     dtype, cnt, ad, mean, tile);
+				for (uint32_t i = 0; i < cnt; i++)
+				{
+					kern->accumulate(acc, tile + i * w, w);
+				}
+			}
+		}
+		else if (rest)
+		{
+			t = lora_phase_start(req_timing);
+			sum_tokens(suffix, dtype, rest, in, mean);
+			lora_phase_end(req_timing, LORA_PHASE_REDUCE, t);
+			lora_project(mean, LORA_DTYPE_F32, 1, ad, NULL, tile);
+			kern->accumulate(acc, tile, w);
+		}
+		for (uint32_t i = 0; i < w; i++)
+		{
+			acc[i] /= seq_length;
+		}
+		lora_project_out(ad, acc, sample_output);
+		break;
+	}
+}
+
+// Copy the token offsets that follow a LORA_FLAG_RAGGED tensor_dims_t in
+// the dims memref src into the session, check them there and return the
+// copy in *offsets: the host cannot change them once checked. dims_size
+// excludes any lora_prefix_t after them.
+static TEE_Result ragged_offsets(struct lora_session *sess,
+				 const tensor_dims_t *dims, const void *src,
+				 size_t dims_size, uint32_t max_seq_length,
+				 const uint32_t **offsets)
+{
+	// batch_size is at most the adapter's max_batch_size here.
+	const uint32_t n = dims->batch_size + 1;
+	uint32_t *o;
+
+	if (dims_size != sizeof(*dims) + (size_t)n * sizeof(uint32_t))
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (n > sess->offsets_cap)
+	{
+		TEE_Free(sess->offsets);
+		sess->offsets_cap = 0;
+		sess->offsets = TEE_Malloc(n * sizeof(uint32_t),
+					   TEE_MALLOC_FILL_ZERO);
+		if (!sess->offsets)
+			return TEE_ERROR_OUT_OF_MEMORY;
+		sess->offsets_cap = n;
+	}
+	o = sess->offsets;
+	TEE_MemMove(o, (const uint8_t *)src + sizeof(*dims),
+		    n * sizeof(uint32_t));
+	if (o[0] != 0)
+		return TEE_ERROR_BAD_PARAMETERS;
+	for (uint32_t s = 0; s < dims->batch_size; s++)
+	{
+		if (o[s + 1] <= o[s] || o[s + 1] - o[s] > max_seq_length)
+			return TEE_ERROR_BAD_PARAMETERS;
+	}
+	*offsets = o;
+	return TEE_SUCCESS;
+}
+
+// Main inference function. Returns the bytes read and written in
+// *bytes_in and *bytes_out.
+static TEE_Result lora_inference(struct lora_session *sess,
+				 TEE_Param params[4],
+				 uint64_t *bytes_in, uint64_t *bytes_out)
+{
+	const float scale = 1.0f;
+	uint64_t t = lora_phase_start(req_timing);
+
+	// Get pointers to the buffers.
+	const void *input = params[0].memref.buffer;
+	void *output = params[1].memref.buffer;
+
+	// Parse dimensions from param2. They are copied out of shared memory,
+	// as are the ragged offsets and the prefix, so that nothing the
+	// checks below pass can change afterwards.
+	if (params[2].memref.size < sizeof(tensor_dims_t))
+		return TEE_ERROR_BAD_PARAMETERS;
+	tensor_dims_t dims_copy;
+	const tensor_dims_t *dims = &dims_copy;
+
+	TEE_MemMove(&dims_copy, params[2].memref.buffer, sizeof(dims_copy));
+
+	// Look up the requested adapter; a miss reloads it from storage.
+	struct lora_cache_entry *entry;
+	TEE_Result res = lora_cache_get(&sess->cache, dims->adapter_id, &entry);
+	if (res != TEE_SUCCESS)
+		return res;
+	t = lora_phase_end(req_timing, LORA_PHASE_LOOKUP, t);
+
+	const struct lora_adapter *ad = &entry->adapter;
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+
+	// Validate dimensions against the loaded adapter. Its limits are
+	// capped by LORA_MAX_BATCH and LORA_MAX_SEQ, so the tensor sizes
+	// below fit in 64 bits but not necessarily in a 32-bit size_t.
+	const bool ragged = dims->flags & LORA_FLAG_RAGGED;
+	const uint32_t *offsets = NULL;
+
+	if (dims->flags & ~LORA_FLAGS_KNOWN ||
+	    dims->in_channels != in ||
+	    dims->batch_size > ad->desc.max_batch_size ||
+	    (!ragged && (dims->seq_length == 0 ||
+			 dims->seq_length > ad->desc.max_seq_length)) ||
+	    dims->output_mode > LORA_OUT_MAX ||
+	    !lora_dtype_size(dims->input_dtype) ||
+	    !lora_dtype_size(dims->output_dtype))
+		return TEE_ERROR_BAD_PARAMETERS;
+	// A lora_prefix_t, if any, ends the dims memref.
+	const bool prefixed = dims->flags & LORA_FLAG_PREFIX;
+	const size_t dims_size = params[2].memref.size -
+				 (prefixed ? sizeof(lora_prefix_t) : 0);
+	lora_prefix_t prefix;
+
+	if (prefixed && params[2].memref.size <
+			sizeof(*dims) + sizeof(prefix))
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (ragged)
+	{
+		res = ragged_offsets(sess, dims, params[2].memref.buffer,
+				     dims_size, ad->desc.max_seq_length,
+				     &offsets);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+	if (prefixed)
+	{
+		// The prefix is only 4-byte aligned after ragged offsets.
+		TEE_MemMove(&prefix,
+			    (const uint8_t *)params[2].memref.buffer + dims_size,
+			    sizeof(prefix));
+		if (!prefix.tokens || prefix.reserved ||
+		    (!ragged && prefix.tokens > dims->seq_length))
+			return TEE_ERROR_BAD_PARAMETERS;
+		for (uint32_t s = 0; ragged && s < dims->batch_size; s++)
+		{
+			if (offsets[s + 1] - offsets[s] < prefix.tokens)
+				return TEE_ERROR_BAD_PARAMETERS;
+		}
+	}
+
+	const uint32_t in_dtype = dims->input_dtype;
+	const uint32_t out_dtype = dims->output_dtype;
+
+	// Tokens in the batch; per-token output keeps all of them.
+	const size_t tokens = ragged ? offsets[dims->batch_size] :
+			      (size_t)dims->batch_size * dims->seq_length;
+	const size_t out_rows = dims->output_mode == LORA_OUT_TOKENS ?
+				tokens : dims->batch_size;
+
+	// The buffers must hold what the dimensions describe. Sizes are
+	// computed in 64 bits; once they are known to fit the memrefs, the
+	// offsets derived from them fit a size_t too.
+	*bytes_in = (uint64_t)tokens * in * lora_dtype_size(in_dtype);
+	*bytes_out = (uint64_t)out_rows * out * lora_dtype_size(out_dtype);
+	if (params[0].memref.size < *bytes_in ||
+	    params[1].memref.size < *bytes_out)
+		return TEE_ERROR_SHORT_BUFFER;
+	t = lora_phase_end(req_timing, LORA_PHASE_VALIDATE, t);
+
+	// The prefix state comes from the cache, or from the first sample on
+	// a miss and then serves the whole batch. A prefix the cache cannot
+	// hold is not shared: every sample runs in full.
+	struct lora_prefix_entry *pe = NULL;
+
+	if (prefixed && dims->batch_size)
+	{
+		const struct lora_prefix_key key = {
+			.hash = prefix.hash,
+			.generation = entry->generation,
+			.adapter_id = dims->adapter_id,
+			.input_dtype = in_dtype,
+			.tokens = prefix.tokens,
+		};
+
+		bool fill = false;
+
+		pe = lora_prefix_find(&sess->prefixes, &key);
+		if (!pe)
+		{
+			pe = lora_prefix_add(&sess->prefixes, &key,
+					     proj_width(ad), out);
+			fill = pe != NULL;
+		}
+		lora_phase_end(req_timing, LORA_PHASE_PREFIX, t);
+		if (fill)
+			lora_prefix_fill(input, in_dtype, ad, entry->scratch,
+					 pe);
+	}
+
+	// Run the forward pass for each sample.
+	// The input tensor is assumed to be flattened in row-major order:
+	// [batch_size * seq_length * in_channels], or the packed ragged
+	// [tokens * in_channels]. Only a sample's own tokens are visited.
+	for (uint32_t sample = 0; sample < dims->batch_size; sample++)
+	{
+		float *mean = entry->scratch;
+		float *token_output = mean + in;
+		float *sample_output = token_output + out;
+		const size_t first = ragged ? offsets[sample] :
+				     (size_t)sample * dims->seq_length;
+		const uint32_t seq_length = ragged ?
+					    offsets[sample + 1] - offsets[sample] :
+					    dims->seq_length;
+		// Offset into the input for this sample. The per-token paths
+		// widen half precision tokens into the unused mean scratch.
+		const void *sample_input = input_token(input, in_dtype, in, first);
+
+		if (pe)
+		{
+			lora_forward_prefixed(sample_input, in_dtype, seq_length,
+					      ad, pe, dims, entry->scratch,
+					      (uint8_t *)output + first * out *
+					      lora_dtype_size(out_dtype),
+					      sample_output);
+			if (dims->output_mode == LORA_OUT_TOKENS)
+				continue;
+			t = lora_phase_start(req_timing);
+			store_output(output, out_dtype, (size_t)sample * out,
+				     sample_output, out);
+			lora_phase_end(req_timing, LORA_PHASE_OUTPUT, t);
+			continue;
+		}
+
+		switch (dims->output_mode)
+		{
+		case LORA_OUT_TOKENS:
+			// Each token's delta goes straight to its output row.
+			lora_forward_rows(sample_input, in_dtype, seq_length, ad,
+					  scale, entry->scratch,
+					  (uint8_t *)output + first * out *
+					  lora_dtype_size(out_dtype),
+					  out_dtype, false);
+			continue;
+		case LORA_OUT_LAST:
+			lora_forward_token(input_token(sample_input, in_dtype, in, seq_length - 1),
+					   in_dtype, ad, scale, mean, sample_output);
+			break;
+		case LORA_OUT_MAX:
+			lora_fold_tokens(sample_input, in_dtype, seq_length, ad, scale, entry->scratch, true, true, sample_output);
+			break;
+		default:
+			if (dims->flags & LORA_FLAG_REFERENCE)
+				lora_forward_sample(sample_input, in_dtype, seq_length, ad, scale, entry->scratch, sample_output);
+			else
+				lora_forward_sample_pooled(sample_input, in_dtype, seq_length, ad, scale, mean, sample_output);
+			break;
+		}
+		// Write sample output to the flat output buffer: [batch_size * out_channels]
+		t = lora_phase_start(req_timing);
+		store_output(output, out_dtype, (size_t)sample * out, sample_output, out);
+		lora_phase_end(req_timing, LORA_PHASE_OUTPUT, t);
+	}
+
+	return TEE_SUCCESS;
+}
+
+// Serve one request and count it in the TA's counters. It is timed when
+// the caller wants its timing in *report or when timing is on.
+static TEE_Result serve_inference(struct lora_session *sess,
+				  TEE_Param params[4], lora_timing_t *report)
+{
+	const bool timed = report || lora_stats_timing();
+	uint64_t bytes_in = 0;
+	uint64_t bytes_out = 0;
+	lora_timing_t timing;
+	TEE_Result res;
+	uint64_t start;
+
+	if (timed)
+	{
+		TEE_MemFill(&timing, 0, sizeof(timing));
+		req_timing = &timing;
+	}
+	start = lora_phase_start(req_timing);
+	res = lora_inference(sess, params, &bytes_in, &bytes_out);
+	lora_phase_end(req_timing, LORA_PHASE_TOTAL, start);
+	req_timing = NULL;
+	if (res != TEE_SUCCESS)
+		return res;
+
+	lora_stats_record(bytes_in, bytes_out, timed ? &timing : NULL);
+	if (report)
+		*report = timing;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result run_lora_inference(struct lora_session *sess,
+				     uint32_t param_types, TEE_Param params[4])
 {
 	// Expected parameter types:
 	// Param0: Input tensor MEMREF
 	// Param1: Output tensor MEMREF
 	// Param2: Tensor dimensions passed as MEMREF
-	const float scale = 1.0f;
-	
-	populate_random_data();
-	
+	// Param3: lora_timing_t MEMREF_OUTPUT, or NONE for an untimed request
+	const uint32_t t3 = TEE_PARAM_TYPE_GET(param_types, 3);
+	const bool report = t3 == TEE_PARAM_TYPE_MEMREF_OUTPUT;
+	lora_timing_t timing;
+	TEE_Result res;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 1) != TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 2) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    (t3 != TEE_PARAM_TYPE_NONE && !report))
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (report && params[3].memref.size < sizeof(timing))
+	{
+		params[3].memref.size = sizeof(timing);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	res = serve_inference(sess, params, report ? &timing : NULL);
+	if (res != TEE_SUCCESS)
+		return res;
+	if (report)
+	{
+		TEE_MemMove(params[3].memref.buffer, &timing, sizeof(timing));
+		params[3].memref.size = sizeof(timing);
+	}
+	return TEE_SUCCESS;
+}
+
+static TEE_Result get_stats(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t t0 = TEE_PARAM_TYPE_GET(param_types, 0);
+	const uint32_t t1 = TEE_PARAM_TYPE_GET(param_types, 1);
+	lora_stats_t stats;
+
+	if ((t0 != TEE_PARAM_TYPE_NONE && t0 != TEE_PARAM_TYPE_MEMREF_OUTPUT) ||
+	    (t1 != TEE_PARAM_TYPE_NONE && t1 != TEE_PARAM_TYPE_VALUE_INPUT) ||
+	    TEE_PARAM_TYPE_GET(param_types, 2) != TEE_PARAM_TYPE_NONE ||
+	    TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (t0 == TEE_PARAM_TYPE_MEMREF_OUTPUT)
+	{
+		if (params[0].memref.size < sizeof(stats))
+		{
+			params[0].memref.size = sizeof(stats);
+			return TEE_ERROR_SHORT_BUFFER;
+		}
+		lora_stats_get(&stats);
+		TEE_MemMove(params[0].memref.buffer, &stats, sizeof(stats));
+		params[0].memref.size = sizeof(stats);
+	}
+	if (t1 == TEE_PARAM_TYPE_VALUE_INPUT)
+		lora_stats_control(params[1].value.a);
+	return TEE_SUCCESS;
+}
+
+// Whether [offset, offset + len) lies in a buffer of the given size.
+static bool multi_span_ok(uint32_t offset, uint64_t len, size_t size)
+{
+	return (uint64_t)offset + len <= size;
+}
+
+// Apply one table entry: the per-token delta of the entry's adapter over
+// hdr->tokens rows, written or added straight into the output buffer. hdr
+// and e are TA-local copies.
+static TEE_Result run_multi_entry(struct lora_session *sess,
+				  const lora_multi_hdr_t *hdr,
+				  const lora_multi_entry_t *e,
+				  bool output_readable, TEE_Param params[4])
+{
+	const size_t in_esz = lora_dtype_size(hdr->input_dtype);
+	const size_t out_esz = lora_dtype_size(hdr->output_dtype);
+	const bool add = e->flags & LORA_ENTRY_ADD;
+	struct lora_cache_entry *entry;
+	TEE_Result res;
+
+	if (e->flags & ~LORA_ENTRY_ADD || (add && !output_readable) ||
+	    e->input_offset % in_esz || e->output_offset % out_esz)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = lora_cache_get(&sess->cache, e->adapter_id, &entry);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	const struct lora_adapter *ad = &entry->adapter;
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+
+	if (!multi_span_ok(e->input_offset, (uint64_t)hdr->tokens * in * in_esz,
+			   params[0].memref.size) ||
+	    !multi_span_ok(e->output_offset, (uint64_t)hdr->tokens * out * out_esz,
+			   params[1].memref.size))
+		return TEE_ERROR_SHORT_BUFFER;
+
+	const void *input = (const uint8_t *)params[0].memref.buffer +
+			    e->input_offset;
+	void *output = (uint8_t *)params[1].memref.buffer + e->output_offset;
+
+	lora_forward_rows(input, hdr->input_dtype, hdr->tokens, ad, e->scale,
+			  entry->scratch, output, hdr->output_dtype, add);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result run_lora_multi(struct lora_session *sess,
+				 uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t t1 = TEE_PARAM_TYPE_GET(param_types, 1);
+	const lora_multi_entry_t *entries;
+	lora_multi_hdr_t hdr;
+	TEE_Result res;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    (t1 != TEE_PARAM_TYPE_MEMREF_OUTPUT &&
+	     t1 != TEE_PARAM_TYPE_MEMREF_INOUT) ||
+	    TEE_PARAM_TYPE_GET(param_types, 2) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	// The table is in shared memory: the header and each entry are read
+	// once into TA memory, so the host cannot change them after they are
+	// checked.
+	if (params[2].memref.size < sizeof(hdr))
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(&hdr, params[2].memref.buffer, sizeof(hdr));
+	if (hdr.count == 0 || hdr.count > LORA_MULTI_MAX_ENTRIES ||
+	    hdr.tokens == 0 ||
+	    params[2].memref.size !=
+	    sizeof(hdr) + hdr.count * sizeof(lora_multi_entry_t) ||
+	    !lora_dtype_size(hdr.input_dtype) ||
+	    !lora_dtype_size(hdr.output_dtype))
+		return TEE_ERROR_BAD_PARAMETERS;
+	entries = (const lora_multi_entry_t *)
+		  ((const uint8_t *)params[2].memref.buffer + sizeof(hdr));
+
+	// Entries run one after another, each on its adapter's own scratch;
+	// an error stops the table with the earlier entries already applied.
+	for (uint32_t i = 0; i < hdr.count; i++)
+	{
+		lora_multi_entry_t e;
+
+		TEE_MemMove(&e, &entries[i], sizeof(e));
+		res = run_multi_entry(sess, &hdr, &e,
+				      t1 == TEE_PARAM_TYPE_MEMREF_INOUT, params);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+	return TEE_SUCCESS;
+}
+
+// Ring dims spans up to this many words are copied to the stack: a dense
+// request, or a ragged batch of up to 32 samples with a prefix.
+#define RING_DIMS_WORDS	48
+
+// Whether [offset, offset + len) lies in a ring of the given size, past its
+// slot table.
+static bool ring_span_ok(uint32_t offset, uint32_t len, size_t table_end,
+			 size_t size)
+{
+	return offset >= table_end && offset % sizeof(uint32_t) == 0 &&
+	       multi_span_ok(offset, len, size);
+}
+
+// Serve one ring slot as a TA_OPTEE_LLM_CMD_LORA request on its spans of
+// the ring. The dims span is checked and then read again as the request
+// runs, so it is copied out of the ring first; the tensors are read and
+// written in place.
+static TEE_Result serve_ring_slot(struct lora_session *sess, uint8_t *ring,
+				  size_t size, size_t table_end,
+				  const lora_ring_slot_t *slot)
+{
+	uint32_t dims_buf[RING_DIMS_WORDS];
+	TEE_Param params[4];
+	void *dims = dims_buf;
+	TEE_Result res;
+
+	if (slot->reserved ||
+	    !ring_span_ok(slot->dims_offset, slot->dims_size, table_end, size) ||
+	    !ring_span_ok(slot->input_offset, slot->input_size, table_end,
+			  size) ||
+	    !ring_span_ok(slot->output_offset, slot->output_size, table_end,
+			  size))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (slot->dims_size > sizeof(dims_buf))
+	{
+		dims = TEE_Malloc(slot->dims_size, TEE_MALLOC_FILL_ZERO);
+		if (!dims)
+			return TEE_ERROR_OUT_OF_MEMORY;
+	}
+	TEE_MemMove(dims, ring + slot->dims_offset, slot->dims_size);
+
+	TEE_MemFill(params, 0, sizeof(params));
+	params[0].memref.buffer = ring + slot->input_offset;
+	params[0].memref.size = slot->input_size;
+	params[1].memref.buffer = ring + slot->output_offset;
+	params[1].memref.size = slot->output_size;
+	params[2].memref.buffer = dims;
+	params[2].memref.size = slot->dims_size;
+	res = serve_inference(sess, params, NULL);
+
+	if (dims != dims_buf)
+		TEE_Free(dims);
+	return res;
+}
+
+static TEE_Result drain_lora_ring(struct lora_session *sess,
+				  uint32_t param_types, TEE_Param params[4])
+{
+	uint8_t *ring = params[0].memref.buffer;
+	const size_t size = params[0].memref.size;
+	lora_ring_slot_t *slots;
+	lora_ring_hdr_t hdr;
+	size_t table_end;
+	uint32_t failed = 0;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INOUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 1) != TEE_PARAM_TYPE_VALUE_OUTPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 2) != TEE_PARAM_TYPE_NONE ||
+	    TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	// The header and each slot are read once, so the host writing to the
+	// ring during the drain cannot change a request after it is checked.
+	if (size < sizeof(hdr))
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(&hdr, ring, sizeof(hdr));
+	table_end = sizeof(hdr) + (size_t)hdr.slots * sizeof(*slots);
+	if (hdr.slots == 0 || hdr.slots > LORA_RING_MAX_SLOTS ||
+	    hdr.reserved || table_end > size ||
+	    hdr.head - hdr.tail > hdr.slots)
+		return TEE_ERROR_BAD_PARAMETERS;
+	slots = (lora_ring_slot_t *)(ring + sizeof(hdr));
+
+	for (uint32_t i = hdr.tail; i != hdr.head; i++)
+	{
+		lora_ring_slot_t slot;
+		TEE_Result res;
+
+		TEE_MemMove(&slot, &slots[i % hdr.slots], sizeof(slot));
+		res = serve_ring_slot(sess, ring, size, table_end, &slot);
+		slots[i % hdr.slots].status = res;
+		if (res != TEE_SUCCESS)
+			failed++;
+	}
+
+	((lora_ring_hdr_t *)ring)->tail = hdr.head;
+	params[1].value.a = hdr.head - hdr.tail;
+	params[1].value.b = failed;
+	return TEE_SUCCESS;
+}
+
+// Whether a train step's optimizer settings are usable.
+static bool train_step_ok(const lora_train_step_t *step)
+{
+	if (!step->tokens || step->optimizer > LORA_OPT_ADAM ||
+	    step->flags & ~(LORA_TRAIN_RESET | LORA_TRAIN_PERSIST) ||
+	    step->reserved || !lora_dtype_size(step->input_dtype) ||
+	    !lora_dtype_size(step->grad_dtype))
+		return false;
+	// Written so that NaN fails the checks too; FLT_MAX bounds rule out
+	// infinities, which would wipe out the weights just the same.
+	if (!(step->lr > 0.0f && step->lr <= FLT_MAX &&
+	      step->weight_decay >= 0.0f && step->weight_decay <= FLT_MAX))
+		return false;
+	if (step->optimizer == LORA_OPT_ADAM)
+		return step->beta1 >= 0.0f && step->beta1 < 1.0f &&
+		       step->beta2 >= 0.0f && step->beta2 < 1.0f &&
+		       step->eps > 0.0f && step->eps <= FLT_MAX;
+	return true;
+}
+
+static TEE_Result train_lora(struct lora_session *sess,
+			     uint32_t param_types, TEE_Param params[4])
+{
+	struct lora_cache_entry *entry;
+	lora_train_step_t step;
+	TEE_Result res;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 1) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 2) != TEE_PARAM_TYPE_MEMREF_INPUT ||
+	    TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_NONE)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (params[2].memref.size != sizeof(step))
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(&step, params[2].memref.buffer, sizeof(step));
+	if (!train_step_ok(&step))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = lora_cache_get(&sess->cache, step.adapter_id, &entry);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	const struct lora_adapter *ad = &entry->adapter;
+
+	// Quantized weights have no room for small updates.
+	if (ad->desc.format != LORA_FMT_F32)
+		return TEE_ERROR_NOT_SUPPORTED;
+	if ((uint64_t)step.tokens * ad->desc.in_channels *
+	    lora_dtype_size(step.input_dtype) > params[0].memref.size ||
+	    (uint64_t)step.tokens * ad->desc.out_channels *
+	    lora_dtype_size(step.grad_dtype) > params[1].memref.size)
+		return TEE_ERROR_SHORT_BUFFER;
+
+	res = lora_train_step(&sess->cache, entry, kern, &step,
+			      params[0].memref.buffer, params[1].memref.buffer);
+	if (res == TEE_SUCCESS && (step.flags & LORA_TRAIN_PERSIST))
+		res = lora_adapter_persist(ad, step.adapter_id);
+	return res;
+}
+
+static void end_stream(struct lora_stream *stream)
+{
+	TEE_Free(stream->acc);
+	stream->acc = NULL;
+	stream->active = false;
+}
+
+// Look up the stream's adapter, which must still be the load seen at
+// BEGIN. Chunks folded with different weights would not add up to the
+// result of either.
+static TEE_Result stream_adapter(struct lora_session *sess,
+				 struct lora_cache_entry **entry)
+{
+	struct lora_stream *stream = &sess->stream;
+	TEE_Result res;
+
+	if (!stream->active)
+		return TEE_ERROR_BAD_STATE;
+	res = lora_cache_get(&sess->cache, stream->adapter_id, entry);
+	if (res != TEE_SUCCESS)
+		return res;
+	if ((*entry)->generation != stream->generation)
+		return TEE_ERROR_BAD_STATE;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result begin_lora_stream(struct lora_session *sess,
+				    uint32_t param_types, TEE_Param params[4])
+{
 	const uint32_t expected_types =
 	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
-			    TEE_PARAM_TYPE_MEMREF_OUTPUT,
-			    TEE_PARAM_TYPE_MEMREF_INPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE,
 			    TEE_PARAM_TYPE_NONE);
+	struct lora_stream *stream = &sess->stream;
+	struct lora_cache_entry *entry;
+	tensor_dims_t dims;
+	uint32_t width;
+	TEE_Result res;
+
+	if (param_types != expected_types ||
+	    params[0].memref.size < sizeof(dims))
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(&dims, params[0].memref.buffer, sizeof(dims));
+
+	end_stream(stream);
+
+	res = lora_cache_get(&sess->cache, dims.adapter_id, &entry);
+	if (res != TEE_SUCCESS)
+		return res;
+	const lora_adapter_desc_t *desc = &entry->adapter.desc;
+
+	if (dims.flags & ~LORA_FLAGS_KNOWN ||
+	    dims.in_channels != desc->in_channels ||
+	    dims.batch_size == 0 || dims.batch_size > desc->max_batch_size)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (dims.output_mode == LORA_OUT_TOKENS ||
+	    dims.flags & (LORA_FLAG_RAGGED | LORA_FLAG_PREFIX))
+		return TEE_ERROR_NOT_SUPPORTED;
+	if (dims.output_mode > LORA_OUT_MAX ||
+	    !lora_dtype_size(dims.input_dtype) ||
+	    !lora_dtype_size(dims.output_dtype))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	stream->adapter_id = dims.adapter_id;
+	stream->batch_size = dims.batch_size;
+	stream->flags = dims.flags;
+	stream->output_mode = dims.output_mode;
+	stream->input_dtype = dims.input_dtype;
+	stream->output_dtype = dims.output_dtype;
+
+	// batch_size is capped by LORA_MAX_BATCH through the descriptor, so
+	// the size fits even a 32-bit size_t once widened.
+	width = stream_pools_input(stream) ? desc->in_channels :
+					     desc->out_channels;
+	stream->acc = TEE_Malloc((size_t)dims.batch_size * width *
+				 sizeof(float), TEE_MALLOC_FILL_ZERO);
+	if (!stream->acc)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	stream->active = true;
+	stream->generation = entry->generation;
+	stream->tokens = 0;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result append_lora_stream(struct lora_session *sess,
+				     uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+			    TEE_PARAM_TYPE_VALUE_INPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+	struct lora_stream *stream = &sess->stream;
+	struct lora_cache_entry *entry;
+	const float scale = 1.0f;
+	TEE_Result res;
+
 	if (param_types != expected_types)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	// Get pointers to the buffers.
-	float *input = (float *)params[0].memref.buffer;
-	float *output = (float *)params[1].memref.buffer;
+	res = stream_adapter(sess, &entry);
+	if (res != TEE_SUCCESS)
+		return res;
 
-	// Parse dimensions from param2.
-	if (params[2].memref.size < sizeof(tensor_dims_t))
+	const struct lora_adapter *ad = &entry->adapter;
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t dtype = stream->input_dtype;
+	const uint32_t tokens = params[1].value.a;
+	const void *chunk = params[0].memref.buffer;
+
+	// tokens is not capped, so the chunk size is computed in 64 bits.
+	if (params[0].memref.size !=
+	    (uint64_t)stream->batch_size * tokens * in * lora_dtype_size(dtype))
 		return TEE_ERROR_BAD_PARAMETERS;
-	tensor_dims_t *dims = (tensor_dims_t *)params[2].memref.buffer;
 
-	// Validate dimensions.
-	if (dims->in_channels != IN_CHANNELS ||
-	    dims->batch_size > MAX_BATCH_SIZE ||
-	    dims->seq_length > MAX_SEQ_LENGTH)
+	if (tokens == 0)
+		return TEE_SUCCESS;
+
+	for (uint32_t sample = 0; sample < stream->batch_size; sample++)
+	{
+		const void *x = input_token(chunk, dtype, in,
+					    (size_t)sample * tokens);
+		float *widen = entry->scratch;
+
+		if (stream_pools_input(stream))
+		{
+			float *sum = stream->acc + (size_t)sample * in;
+
+			for (uint32_t token = 0; token < tokens; token++)
+			{
+				const void *t = input_token(x, dtype, in, token);
+
+				if (dtype == LORA_DTYPE_F32)
+					kern->accumulate(sum, t, in);
+				else
+					kern->accumulate_half(sum, t, dtype, in);
+			}
+			continue;
+		}
+
+		float *acc = stream->acc + (size_t)sample * out;
+
+		switch (stream->output_mode)
+		{
+		case LORA_OUT_LAST:
+			lora_forward_token(input_token(x, dtype, in, tokens - 1),
+					   dtype, ad, scale, widen, acc);
+			break;
+		case LORA_OUT_MAX:
+			// The first token of the stream seeds the max.
+			lora_fold_tokens(x, dtype, tokens, ad, scale,
+					 entry->scratch, true, stream->tokens == 0,
+					 acc);
+			break;
+		default:
+			lora_fold_tokens(x, dtype, tokens, ad, scale,
+					 entry->scratch, false, false, acc);
+			break;
+		}
+	}
+	stream->tokens += tokens;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result finalize_lora_stream(struct lora_session *sess,
+				       uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t expected_types =
+	    TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE,
+			    TEE_PARAM_TYPE_NONE);
+	struct lora_stream *stream = &sess->stream;
+	struct lora_cache_entry *entry;
+	const float scale = 1.0f;
+	TEE_Result res;
+
+	if (param_types != expected_types)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	// Run the forward pass for each sample.
-	// The input tensor is assumed to be flattened in row-major order:
-	// [batch_size * seq_length * IN_CHANNELS]
-	for (uint32_t sample = 0; sample < dims->batch_size; sample++)
+	res = stream_adapter(sess, &entry);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	const struct lora_adapter *ad = &entry->adapter;
+	const uint32_t in = ad->desc.in_channels;
+	const uint32_t out = ad->desc.out_channels;
+	const uint32_t dtype = stream->output_dtype;
+	const size_t size = (size_t)stream->batch_size * out *
+			    lora_dtype_size(dtype);
+	void *output = params[0].memref.buffer;
+
+	if (stream->tokens == 0)
+		return TEE_ERROR_BAD_STATE;
+	if (params[0].memref.size < size)
+	{
+		params[0].memref.size = size;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	const float inv_len = 1.0f / stream->tokens;
+	float *sample_output = entry->scratch + in + out;
+
+	for (uint32_t sample = 0; sample < stream->batch_size; sample++)
 	{
-		float sample_output[OUT_CHANNELS] = {0};
-		// Offset into the input for this sample.
-		const float *sample_input = input + sample * dims->seq_length * IN_CHANNELS;
-		lora_forward_sample(sample_input, dims->seq_length, lora_B, lora_A, scale, sample_output);
-		// Write sample output to the flat output buffer: [batch_size * OUT_CHANNELS]
-		for (int i = 0; i < OUT_CHANNELS; i++)
+		if (stream_pools_input(stream))
 		{
-			output[sample * OUT_CHANNELS + i] = sample_output[i];
+			float *mean = stream->acc + (size_t)sample * in;
+
+			for (uint32_t c = 0; c < in; c++)
+			{
+				mean[c] *= inv_len;
+			}
+			lora_forward_token(mean, LORA_DTYPE_F32, ad, scale, NULL,
+					   sample_output);
+		}
+		else
+		{
+			const float *acc = stream->acc + (size_t)sample * out;
+			const float norm = stream->output_mode == LORA_OUT_MEAN ?
+					   inv_len : 1.0f;
+
+			for (uint32_t i = 0; i < out; i++)
+			{
+				sample_output[i] = acc[i] * norm;
+			}
 		}
+		store_output(output, dtype, (size_t)sample * out, sample_output,
+			     out);
 	}
+	params[0].memref.size = size;
 
+	end_stream(stream);
 	return TEE_SUCCESS;
 }
 
@@ -199,8 +1677,8 @@ static TEE_Result run_lora_inference(uint32_t param_types, TEE_Param params[4])
 TEE_Result TA_CreateEntryPoint(void)
 {
 	DMSG("has been called");
-	// FIXME: this may be causing lag???
-	// populate_random_data();
+	kern = lora_kernels_select();
+	IMSG("Using %s LoRA kernels", kern->name);
 	return TEE_SUCCESS;
 }
 
@@ -221,8 +1699,9 @@ void TA_DestroyEntryPoint(void)
  */
 TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
 				    TEE_Param __maybe_unused params[4],
-				    void __maybe_unused **sess_ctx)
+				    void **sess_ctx)
 {
+	struct lora_session *sess;
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_NONE,
 						   TEE_PARAM_TYPE_NONE,
 						   TEE_PARAM_TYPE_NONE,
@@ -235,7 +1714,14 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
 
 	/* Unused parameters */
 	(void)&params;
-	(void)&sess_ctx;
+
+	/* Weights are loaded later by TA_OPTEE_LLM_CMD_LORA_LOAD */
+	sess = TEE_Malloc(sizeof(*sess), TEE_MALLOC_FILL_ZERO);
+	if (!sess)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	lora_cache_init(&sess->cache, LORA_CACHE_DEFAULT_BUDGET);
+	lora_prefix_init(&sess->prefixes, LORA_PREFIX_DEFAULT_BUDGET);
+	*sess_ctx = sess;
 
 	/*
 	 * The DMSG() macro is non-standard, TEE Internal API doesn't
@@ -251,9 +1737,16 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
  * Called when a session is closed, sess_ctx hold the value that was
  * assigned by TA_OpenSessionEntryPoint().
  */
-void TA_CloseSessionEntryPoint(void __maybe_unused *sess_ctx)
+void TA_CloseSessionEntryPoint(void *sess_ctx)
 {
-	(void)&sess_ctx; /* Unused parameter */
+	struct lora_session *sess = sess_ctx;
+
+	end_stream(&sess->stream);
+	lora_upload_end(&sess->upload);
+	lora_prefix_clear(&sess->prefixes);
+	lora_cache_clear(&sess->cache);
+	TEE_Free(sess->offsets);
+	TEE_Free(sess);
 	IMSG("Goodbye!\n");
 }
 
@@ -301,11 +1794,11 @@ static TEE_Result dec_value(uint32_t param_types,
  * assigned by TA_OpenSessionEntryPoint(). The rest of the paramters
  * comes from normal world.
  */
-TEE_Result TA_InvokeCommandEntryPoint(void __maybe_unused *sess_ctx,
+TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx,
 				      uint32_t cmd_id,
 				      uint32_t param_types, TEE_Param params[4])
 {
-	(void)&sess_ctx; /* Unused parameter */
+	struct lora_session *sess = sess_ctx;
 
 	switch (cmd_id)
 	{
@@ -314,7 +1807,37 @@ TEE_Result TA_InvokeCommandEntryPoint(void __maybe_unused *sess_ctx,
 	case TA_OPTEE_LLM_CMD_DEC_VALUE:
 		return dec_value(param_types, params);
 	case TA_OPTEE_LLM_CMD_LORA:
-		return run_lora_inference(param_types, params);
+		return run_lora_inference(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_LOAD:
+		return load_lora_weights(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_CACHE_STATS:
+		return get_cache_stats(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_CACHE_BUDGET:
+		return set_cache_budget(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_STREAM_BEGIN:
+		return begin_lora_stream(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_STREAM_APPEND:
+		return append_lora_stream(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_STREAM_FINALIZE:
+		return finalize_lora_stream(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_STATS:
+		return get_stats(param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_MULTI:
+		return run_lora_multi(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_UPLOAD_KEY:
+		return set_upload_key(param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_UPLOAD_BEGIN:
+		return begin_upload(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_UPLOAD_CHUNK:
+		return upload_chunk(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_PREFIX_STATS:
+		return get_prefix_stats(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_PREFIX_BUDGET:
+		return set_prefix_budget(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_RING_DRAIN:
+		return drain_lora_ring(sess, param_types, params);
+	case TA_OPTEE_LLM_CMD_LORA_TRAIN:
+		return train_lora(sess, param_types, params);
 	default:
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
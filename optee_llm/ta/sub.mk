@@ -1,6 +1,21 @@
 global-incdirs-y += include
 #srcs-y += hello_world_ta.c
 srcs-y += optee_llm_ta.c
+srcs-y += lora_adapter.c
+srcs-y += lora_cache.c
+srcs-y += lora_kernels.c
+srcs-y += lora_prefix.c
+srcs-y += lora_stats.c
+srcs-y += lora_train.c
+srcs-y += lora_upload.c
 
 # To remove a certain compiler flag, add a line like this
 #cflags-template_ta.c-y += -Wno-strict-prototypes
+
+# Provisioning key for wrapped upload keys (lora_key_wrap_t), 64 hex
+# digits. It is a secret of whoever provisions the devices and ends up in
+# the TA binary, so build with CFG_ENCRYPT_TA when setting it. Without it
+# the TA only accepts keys wrapped under the current upload key.
+ifneq ($(CFG_LORA_PROVISION_KEY),)
+cflags-lora_upload.c-y += -DCFG_LORA_PROVISION_KEY=\"$(CFG_LORA_PROVISION_KEY)\"
+endif
@@ -47,8 +47,12 @@
 /* Provisioned stack size */
 #define TA_STACK_SIZE			(64 * 1024)
 
-/* Provisioned heap size for TEE_Malloc() and friends */
-#define TA_DATA_SIZE			(64 * 1024)
+/*
+ * Provisioned heap size for TEE_Malloc() and friends. Adapter weights and
+ * the per-session scratch vectors are sized at load time from the adapter
+ * descriptor, so this bounds the largest adapter a session can load.
+ */
+#define TA_DATA_SIZE			(1024 * 1024)
 
 /* The gpd.ta.version property */
 #define TA_VERSION	"1.0"